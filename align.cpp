@@ -0,0 +1,341 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "align.h"
+
+#include <stdlib.h>
+
+// Profile of an image along one axis, at several levels of detail: level 0
+// has the sums of every row (or column), every next level sums pairs of the
+// previous one's values.
+typedef std::vector< std::vector<gint64> > ProfilePyramid;
+
+// Levels are added until the offsets to search at the coarsest one are this
+// small.
+#define COARSEST_SEARCH_RANGE 4
+
+// Too short profiles can't be matched reliably.
+#define MIN_PROFILE_LENGTH 16
+
+// Size of the grid of average gray values signatures are computed from; every
+// row gives SIGNATURE_GRID_WIDTH - 1 bits.
+#define SIGNATURE_GRID_WIDTH  9
+#define SIGNATURE_GRID_HEIGHT 8
+
+// Difference of average gray values of adjacent cells that sets their bit,
+// so that antialiasing noise in blank parts of pages doesn't change it
+#define SIGNATURE_THRESHOLD 1.0
+
+// Cost of leaving a page unpaired when aligning sequences of pages; pages
+// are still paired if their signatures differ in up to twice as many bits.
+#define PAGE_GAP_COST 24
+
+
+// Computes sums of the "ink" (darkness) of every row and column of the image.
+static void get_profiles(cairo_surface_t *s,
+                         std::vector<gint64>& rows, std::vector<gint64>& cols)
+{
+    const int width = cairo_image_surface_get_width(s);
+    const int height = cairo_image_surface_get_height(s);
+    const int stride = cairo_image_surface_get_stride(s);
+    const unsigned char *data = cairo_image_surface_get_data(s);
+
+    rows.assign(height, 0);
+    cols.assign(width, 0);
+
+    for ( int y = 0; y < height; y++, data += stride )
+    {
+        const unsigned char *p = data;
+        gint64 row = 0;
+        for ( int x = 0; x < width; x++, p += 4 )
+        {
+            const int ink = 3 * 255 - p[0] - p[1] - p[2];
+            row += ink;
+            cols[x] += ink;
+        }
+        rows[y] = row;
+    }
+}
+
+
+static void build_pyramid(ProfilePyramid& pyramid, int levels)
+{
+    for ( int level = 1; level < levels; level++ )
+    {
+        const std::vector<gint64>& fine = pyramid[level - 1];
+        std::vector<gint64> coarse((fine.size() + 1) / 2, 0);
+        for ( size_t i = 0; i < fine.size(); i++ )
+            coarse[i / 2] += fine[i];
+        pyramid.push_back(coarse);
+    }
+}
+
+
+// Returns the sum of absolute differences of the profiles when p2 is
+// displaced by 'offset'. Values outside of the profiles are 0, i.e. blank.
+static gint64 profile_distance(const std::vector<gint64>& p1,
+                               const std::vector<gint64>& p2, int offset)
+{
+    const int n1 = (int)p1.size();
+    const int n2 = (int)p2.size();
+    const int begin = offset < 0 ? offset : 0;
+    const int end = n2 + offset > n1 ? n2 + offset : n1;
+
+    gint64 distance = 0;
+    for ( int i = begin; i < end; i++ )
+    {
+        const gint64 v1 = (i >= 0 && i < n1) ? p1[i] : 0;
+        const gint64 v2 = (i - offset >= 0 && i - offset < n2) ? p2[i - offset] : 0;
+        distance += v1 > v2 ? v1 - v2 : v2 - v1;
+    }
+
+    return distance;
+}
+
+
+// Finds the offset of p2 in range -max_offset..max_offset that matches p1
+// best, searching the coarsest level fully and refining the offset at the
+// finer ones.
+static int find_profile_offset(const ProfilePyramid& p1,
+                               const ProfilePyramid& p2,
+                               int max_offset)
+{
+    const int levels = (int)p1.size();
+
+    int best = 0;
+    for ( int level = levels - 1; level >= 0; level-- )
+    {
+        const int range = max_offset >> level;
+
+        // the coarsest level is searched fully, the others only around the
+        // offset found at the previous level
+        int from, to;
+        if ( level == levels - 1 )
+        {
+            from = -range - 1;
+            to = range + 1;
+        }
+        else
+        {
+            best *= 2;
+            from = best - 2;
+            to = best + 2;
+        }
+
+        if ( from < -range )
+            from = -range;
+        if ( to > range )
+            to = range;
+
+        gint64 best_distance = -1;
+        for ( int offset = from; offset <= to; offset++ )
+        {
+            const gint64 distance =
+                profile_distance(p1[level], p2[level], offset);
+            // prefer smaller offsets if they match equally well
+            if ( best_distance < 0 || distance < best_distance ||
+                 (distance == best_distance && abs(offset) < abs(best)) )
+            {
+                best_distance = distance;
+                best = offset;
+            }
+        }
+    }
+
+    return best;
+}
+
+
+bool find_image_offset(cairo_surface_t *s1, cairo_surface_t *s2,
+                       int max_offset, int *offset_x, int *offset_y)
+{
+    if ( max_offset <= 0 )
+        return false;
+
+    ProfilePyramid rows1(1), cols1(1), rows2(1), cols2(1);
+    get_profiles(s1, rows1[0], cols1[0]);
+    get_profiles(s2, rows2[0], cols2[0]);
+
+    // nothing to do if the images already match
+    const gint64 distance0 = profile_distance(rows1[0], rows2[0], 0) +
+                             profile_distance(cols1[0], cols2[0], 0);
+    if ( distance0 == 0 )
+        return false;
+
+    int levels = 1;
+    while ( (max_offset >> (levels - 1)) > COARSEST_SEARCH_RANGE &&
+            (rows1[0].size() >> levels) >= MIN_PROFILE_LENGTH &&
+            (cols1[0].size() >> levels) >= MIN_PROFILE_LENGTH )
+    {
+        levels++;
+    }
+
+    build_pyramid(rows1, levels);
+    build_pyramid(cols1, levels);
+    build_pyramid(rows2, levels);
+    build_pyramid(cols2, levels);
+
+    const int dx = find_profile_offset(cols1, cols2, max_offset);
+    const int dy = find_profile_offset(rows1, rows2, max_offset);
+    if ( dx == 0 && dy == 0 )
+        return false;
+
+    // Only use the offset if it explains most of the differences; changed
+    // content can make other offsets match slightly better by chance.
+    const gint64 distance = profile_distance(rows1[0], rows2[0], dy) +
+                            profile_distance(cols1[0], cols2[0], dx);
+    if ( distance * 2 > distance0 )
+        return false;
+
+    *offset_x = dx;
+    *offset_y = dy;
+    return true;
+}
+
+
+guint64 get_image_signature(cairo_surface_t *s)
+{
+    const int width = cairo_image_surface_get_width(s);
+    const int height = cairo_image_surface_get_height(s);
+    const int stride = cairo_image_surface_get_stride(s);
+    const unsigned char *data = cairo_image_surface_get_data(s);
+
+    // average gray value of every cell of the grid
+    double sums[SIGNATURE_GRID_HEIGHT][SIGNATURE_GRID_WIDTH] = { { 0 } };
+    int counts[SIGNATURE_GRID_HEIGHT][SIGNATURE_GRID_WIDTH] = { { 0 } };
+
+    for ( int y = 0; y < height; y++, data += stride )
+    {
+        const int gy = y * SIGNATURE_GRID_HEIGHT / height;
+        const unsigned char *p = data;
+        for ( int x = 0; x < width; x++, p += 4 )
+        {
+            const int gx = x * SIGNATURE_GRID_WIDTH / width;
+            sums[gy][gx] += (p[0] + p[1] + p[2]) / 3.0;
+            counts[gy][gx]++;
+        }
+    }
+
+    // difference hash: set bits of cells lighter than their right neighbour
+    guint64 signature = 0;
+    for ( int gy = 0; gy < SIGNATURE_GRID_HEIGHT; gy++ )
+    {
+        for ( int gx = 0; gx < SIGNATURE_GRID_WIDTH - 1; gx++ )
+        {
+            const double left = counts[gy][gx]
+                                ? sums[gy][gx] / counts[gy][gx] : 255;
+            const double right = counts[gy][gx + 1]
+                                 ? sums[gy][gx + 1] / counts[gy][gx + 1] : 255;
+
+            signature <<= 1;
+            if ( left > right + SIGNATURE_THRESHOLD )
+                signature |= 1;
+        }
+    }
+
+    return signature;
+}
+
+
+int get_signature_distance(guint64 a, guint64 b)
+{
+    guint64 bits = a ^ b;
+    int count = 0;
+    for ( ; bits; bits &= bits - 1 )
+        count++;
+    return count;
+}
+
+
+std::vector<PagePair> align_page_sequences(const std::vector<guint64>& sigs1,
+                                           const std::vector<guint64>& sigs2)
+{
+    // Needleman-Wunsch alignment: cost[i][j] is the lowest cost of aligning
+    // the first i pages of the first document with the first j pages of the
+    // second one; only two rows of it are kept, but all moves are remembered
+    // to trace the alignment back.
+    enum { MOVE_PAIR, MOVE_DELETED, MOVE_INSERTED };
+
+    const size_t n1 = sigs1.size();
+    const size_t n2 = sigs2.size();
+
+    std::vector<unsigned char> moves((n1 + 1) * (n2 + 1));
+    std::vector<int> prev(n2 + 1), cur(n2 + 1);
+
+    for ( size_t j = 0; j <= n2; j++ )
+    {
+        prev[j] = int(j) * PAGE_GAP_COST;
+        moves[j] = MOVE_INSERTED;
+    }
+
+    for ( size_t i = 1; i <= n1; i++ )
+    {
+        cur[0] = int(i) * PAGE_GAP_COST;
+        moves[i * (n2 + 1)] = MOVE_DELETED;
+
+        for ( size_t j = 1; j <= n2; j++ )
+        {
+            // pairing is preferred if it costs the same as a gap
+            int best = prev[j - 1] +
+                       get_signature_distance(sigs1[i - 1], sigs2[j - 1]);
+            unsigned char move = MOVE_PAIR;
+
+            if ( prev[j] + PAGE_GAP_COST < best )
+            {
+                best = prev[j] + PAGE_GAP_COST;
+                move = MOVE_DELETED;
+            }
+            if ( cur[j - 1] + PAGE_GAP_COST < best )
+            {
+                best = cur[j - 1] + PAGE_GAP_COST;
+                move = MOVE_INSERTED;
+            }
+
+            cur[j] = best;
+            moves[i * (n2 + 1) + j] = move;
+        }
+
+        prev.swap(cur);
+    }
+
+    // trace the moves back from the end
+    std::vector<PagePair> pairs;
+    size_t i = n1, j = n2;
+    while ( i > 0 || j > 0 )
+    {
+        switch ( moves[i * (n2 + 1) + j] )
+        {
+            case MOVE_PAIR:
+                i--;
+                j--;
+                pairs.push_back(PagePair(int(i), int(j)));
+                break;
+            case MOVE_DELETED:
+                i--;
+                pairs.push_back(PagePair(int(i), -1));
+                break;
+            default:
+                j--;
+                pairs.push_back(PagePair(-1, int(j)));
+                break;
+        }
+    }
+
+    return std::vector<PagePair>(pairs.rbegin(), pairs.rend());
+}
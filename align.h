@@ -0,0 +1,66 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _align_h_
+#define _align_h_
+
+// Aligning the compared documents: finding the offset of shifted page
+// content, so that pages that only moved by a few pixels (e.g. when produced
+// by a different PDF generator) aren't reported as entirely different, and
+// pairing pages of documents with inserted or deleted pages.
+
+#include <vector>
+
+#include <glib.h>
+#include <cairo/cairo.h>
+
+// Largest offset looked for by default, in pixels
+#define DEFAULT_MAX_ALIGN_OFFSET 64
+
+// Finds the offset by which s2 should be displaced (as done by diff_images())
+// to match s1 best, at most max_offset pixels in either direction. The
+// search is done coarse-to-fine on projection profiles of the images, i.e.
+// sums of their rows and columns. Returns false, leaving the offsets
+// unchanged, if no offset matches clearly better than none.
+bool find_image_offset(cairo_surface_t *s1, cairo_surface_t *s2,
+                       int max_offset, int *offset_x, int *offset_y);
+
+// Pages of the two documents compared with each other. One of them is -1 if
+// the page was inserted into or deleted from the second document.
+struct PagePair
+{
+    PagePair(int p1, int p2) : page1(p1), page2(p2) {}
+
+    int page1, page2;
+};
+
+// Computes perceptual hash of the image: images that look alike have
+// signatures that differ in few bits (see get_signature_distance()).
+guint64 get_image_signature(cairo_surface_t *s);
+
+// Returns the number of bits in which the signatures differ, 0-64.
+int get_signature_distance(guint64 a, guint64 b);
+
+// Pairs pages of two documents, given signatures of their pages, so that the
+// paired pages are as similar as possible while keeping their order. Pages
+// that don't have a similar enough counterpart are paired with -1.
+std::vector<PagePair> align_page_sequences(const std::vector<guint64>& sigs1,
+                                           const std::vector<guint64>& sigs2);
+
+#endif // _align_h_
@@ -0,0 +1,256 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures speed of diff_row() and of pixel format conversion on synthetic
+// images, printing the results in the format used by "make bench". Before
+// that, checks that all implementations of diff_row() give the same results
+// and fails if they don't, as the results wouldn't be comparable otherwise.
+
+#include "../diffkernel.h"
+#include "../pixelconv.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include <glib.h>
+
+static const int WIDTH = 2480;      // A4 page at 300 DPI
+static const int HEIGHT = 3508;
+static const int ITERATIONS = 10;
+static const int CHECK_ROWS = 20000;
+
+
+// Fills the image with deterministic content; 'changes' is the fraction of
+// pixels that are modified in the second image.
+static void fill_images(std::vector<unsigned char>& img1,
+                        std::vector<unsigned char>& img2,
+                        double changes)
+{
+    guint32 state = 12345;
+    const guint32 threshold = guint32(changes * 65536);
+
+    for ( size_t i = 0; i < img1.size(); i += 4 )
+    {
+        state = state * 1664525u + 1013904223u;
+        const guint32 r = state >> 8;
+
+        img1[i + 0] = (unsigned char)(r);
+        img1[i + 1] = (unsigned char)(r >> 8);
+        img1[i + 2] = (unsigned char)(r >> 16);
+        img1[i + 3] = 0;
+        memcpy(&img2[i], &img1[i], 4);
+
+        if ( ((r >> 4) & 0xFFFF) < threshold )
+            img2[i + 1] ^= 0x40;
+    }
+}
+
+
+// Returns true if the statistics are the same.
+static bool same_stats(const DiffStats& a, const DiffStats& b)
+{
+    return memcmp(a.histogram, b.histogram, sizeof(a.histogram)) == 0 &&
+           a.max_delta == b.max_delta &&
+           a.x1 == b.x1 && a.y1 == b.y1 && a.x2 == b.x2 && a.y2 == b.y2;
+}
+
+
+// Compares every implementation of diff_row() supported by the CPU with
+// diff_row_scalar() and their statistics with the plain C++ one's on
+// CHECK_ROWS random rows of random widths and offsets (so that all tails and
+// misaligned loads are covered), with random tolerances, with and without
+// copying the channel and statistics. Returns false and prints the first
+// mismatch if any.
+static bool check_kernels()
+{
+    guint32 state = 54321;
+    std::vector<unsigned char> row1, row2, ref, out;
+
+    for ( int i = 0; i < CHECK_ROWS; i++ )
+    {
+        state = state * 1664525u + 1013904223u;
+        const int width = (state >> 8) % 100;
+        const int offset = 4 * ((state >> 16) % 4);
+        const bool copy_channel = (state >> 24) & 1;
+        const bool with_stats = (state >> 25) & 1;
+        // statistics of previous rows, whose bounding box is extended
+        const bool had_box = (state >> 26) & 1;
+        const int x = (state >> 27) % 8;
+
+        state = state * 1664525u + 1013904223u;
+        const int tolerance = (state >> 8) % 4 == 0 ? 0 : (state >> 10) % 256;
+        // fraction of pixels that differ, from none to all of them
+        const guint32 changes = (state >> 18) % 5;
+        const int y = (state >> 21) % 8;
+
+        const size_t size = offset + 4 * size_t(width);
+        row1.resize(size);
+        row2.resize(size);
+        for ( size_t j = 0; j < size; j++ )
+        {
+            state = state * 1664525u + 1013904223u;
+            row1[j] = (unsigned char)(state >> 8);
+            row2[j] = (state >> 20) % 4 < changes
+                      ? (unsigned char)(row1[j] + (state >> 24) - 128)
+                      : row1[j];
+        }
+
+        DiffStats initial;
+        if ( had_box )
+        {
+            initial.x1 = initial.x2 = 50;
+            initial.y1 = initial.y2 = 4;
+        }
+
+        ref = row1;
+        const long expected = diff_row_scalar(&ref[offset], &row2[offset],
+                                              width, tolerance, copy_channel);
+
+        DiffStats ref_stats(initial);
+        if ( with_stats )
+        {
+            std::vector<unsigned char> work(row1);
+            diff_row_with_kernel(0, &work[offset], &row2[offset],
+                                 width, tolerance, copy_channel,
+                                 &ref_stats, x, y);
+        }
+
+        // the last kernel is also checked through diff_row()
+        for ( int k = 0; k <= diff_row_kernel_count(); k++ )
+        {
+            const bool dispatched = k == diff_row_kernel_count();
+
+            out = row1;
+            DiffStats stats(initial);
+            DiffStats *pstats = with_stats ? &stats : NULL;
+            const long count =
+                dispatched
+                ? diff_row(&out[offset], &row2[offset], width, tolerance,
+                           copy_channel, pstats, x, y)
+                : diff_row_with_kernel(k, &out[offset], &row2[offset], width,
+                                       tolerance, copy_channel, pstats, x, y);
+
+            const bool stats_ok = !with_stats || same_stats(stats, ref_stats);
+            if ( count != expected || out != ref || !stats_ok )
+            {
+                fprintf(stderr,
+                        "%s kernel differs from scalar one: width %d, offset %d, "
+                        "tolerance %d, copy %d, stats %d: %ld pixels instead of %ld%s%s\n",
+                        dispatched ? "dispatched" : diff_row_kernel_name_at(k),
+                        width, offset / 4, tolerance,
+                        copy_channel, with_stats, count, expected,
+                        out != ref ? ", different output row" : "",
+                        stats_ok ? "" : ", different statistics");
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+// Runs the kernel over the whole image ITERATIONS times and prints time per
+// pixel in nanoseconds.
+static void measure(const char *name, double changes,
+                      bool copy_channel, bool with_stats)
+{
+    const size_t size = size_t(WIDTH) * HEIGHT * 4;
+    std::vector<unsigned char> img1(size), img2(size), work(size);
+    fill_images(img1, img2, changes);
+
+    gint64 elapsed = 0;
+    long count = 0;
+
+    for ( int i = 0; i < ITERATIONS; i++ )
+    {
+        // the kernel may modify the first image, so work on a fresh copy
+        memcpy(&work[0], &img1[0], size);
+
+        DiffStats stats;
+        const gint64 start = g_get_monotonic_time();
+
+        count = 0;
+        for ( int y = 0; y < HEIGHT; y++ )
+        {
+            const size_t offset = size_t(y) * WIDTH * 4;
+            count += diff_row(&work[offset], &img2[offset], WIDTH, 0,
+                              copy_channel, with_stats ? &stats : NULL, 0, y);
+        }
+
+        elapsed += g_get_monotonic_time() - start;
+    }
+
+    const double ns_per_pixel =
+        elapsed * 1000.0 / (double(WIDTH) * HEIGHT * ITERATIONS);
+
+    printf("kernel.%s.ns_per_pixel\t%.3f\n", name, ns_per_pixel);
+    printf("kernel.%s.diff_pixels\t%ld\n", name, count);
+}
+
+
+// Converts the whole image to RGB ITERATIONS times and prints time per pixel
+// in nanoseconds.
+static void measure_convert()
+{
+    const size_t size = size_t(WIDTH) * HEIGHT * 4;
+    std::vector<unsigned char> img1(size), img2(size);
+    std::vector<unsigned char> rgb(size_t(WIDTH) * HEIGHT * 3);
+    fill_images(img1, img2, 0.0);
+
+    const gint64 start = g_get_monotonic_time();
+
+    for ( int i = 0; i < ITERATIONS; i++ )
+    {
+        for ( int y = 0; y < HEIGHT; y++ )
+        {
+            convert_row_to_rgb(&img1[size_t(y) * WIDTH * 4],
+                               &rgb[size_t(y) * WIDTH * 3], WIDTH);
+        }
+    }
+
+    const double ns_per_pixel =
+        (g_get_monotonic_time() - start) * 1000.0 /
+        (double(WIDTH) * HEIGHT * ITERATIONS);
+
+    printf("convert.implementation\t%s\n", convert_row_kernel_name());
+    printf("convert.rgb.ns_per_pixel\t%.3f\n", ns_per_pixel);
+}
+
+
+int main()
+{
+    printf("kernel.implementation\t%s\n", diff_row_kernel_name());
+
+    if ( !check_kernels() )
+        return 1;
+    printf("kernel.check\tok\n");
+
+    measure("identical", 0.0, false, false);
+    measure("sparse", 0.001, false, false);
+    measure("dense", 0.5, false, false);
+    measure("sparse_copy", 0.001, true, false);
+    measure("sparse_stats", 0.001, false, true);
+
+    measure_convert();
+
+    return 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Generates the corpus of PDF files used by "make bench". Every kind of
+// document is written in two versions, kind-a.pdf and kind-b.pdf, which
+// differ in a few controlled places. The output only depends on the seed, so
+// that results of different builds can be compared.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include <glib.h>
+#include <cairo/cairo.h>
+#include <cairo/cairo-pdf.h>
+
+// A4 and A0 page sizes, in points
+static const double A4_WIDTH = 595.0, A4_HEIGHT = 842.0;
+static const double A0_WIDTH = 2384.0, A0_HEIGHT = 3370.0;
+
+// Deterministic pseudo-random numbers, independent of the C library.
+class Random
+{
+public:
+    Random(guint32 seed) : m_state(seed) {}
+
+    guint32 Next()
+    {
+        m_state = m_state * 1664525u + 1013904223u;
+        return m_state >> 8;
+    }
+
+    // returns number in [0, n)
+    int Int(int n) { return int(Next() % guint32(n)); }
+
+    // returns number in [0, 1)
+    double Real() { return (Next() & 0xFFFF) / 65536.0; }
+
+private:
+    guint32 m_state;
+};
+
+
+// Draws one page of given kind. 'modified' is true for the b version of the
+// page, which should differ slightly from the a version.
+typedef void (*draw_page_func)(cairo_t *cr, double w, double h,
+                               int page, bool modified);
+
+struct CorpusDocument
+{
+    const char *name;
+    int pages;
+    double width, height;
+    draw_page_func draw;
+};
+
+
+static void draw_text_page(cairo_t *cr, double w, double h,
+                           int page, bool modified)
+{
+    static const char *const words[] =
+    {
+        "lorem", "ipsum", "dolor", "sit", "amet", "consectetur",
+        "adipiscing", "elit", "sed", "do", "eiusmod", "tempor",
+        "incididunt", "ut", "labore", "et", "dolore", "magna", "aliqua"
+    };
+    const int words_count = sizeof(words) / sizeof(words[0]);
+
+    Random rnd(1000 + page);
+
+    cairo_select_font_face(cr, "serif",
+                           CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_set_font_size(cr, 10);
+    cairo_set_source_rgb(cr, 0, 0, 0);
+
+    int line = 0;
+    for ( double y = 50; y < h - 50; y += 12, line++ )
+    {
+        std::string text;
+        while ( text.size() < 90 )
+        {
+            if ( !text.empty() )
+                text += ' ';
+            text += words[rnd.Int(words_count)];
+        }
+
+        // change one line on every third page
+        if ( modified && page % 3 == 0 && line == 10 )
+            text[0] = 'X';
+
+        cairo_move_to(cr, 50, y);
+        cairo_show_text(cr, text.c_str());
+    }
+}
+
+
+static void draw_vector_page(cairo_t *cr, double w, double h,
+                             int page, bool modified)
+{
+    Random rnd(2000 + page);
+
+    cairo_set_line_width(cr, 0.5);
+
+    for ( int i = 0; i < 2000; i++ )
+    {
+        double x = rnd.Real() * w;
+        double y = rnd.Real() * h;
+
+        // move one shape on every other page
+        if ( modified && page % 2 == 0 && i == 1000 )
+            x += 5;
+
+        cairo_move_to(cr, x, y);
+        cairo_curve_to(cr,
+                       x + rnd.Real() * 60 - 30, y + rnd.Real() * 60 - 30,
+                       x + rnd.Real() * 60 - 30, y + rnd.Real() * 60 - 30,
+                       x + rnd.Real() * 60 - 30, y + rnd.Real() * 60 - 30);
+        cairo_set_source_rgba(cr, rnd.Real(), rnd.Real(), rnd.Real(), 0.7);
+
+        if ( i % 3 == 0 )
+        {
+            cairo_close_path(cr);
+            cairo_fill(cr);
+        }
+        else
+        {
+            cairo_stroke(cr);
+        }
+    }
+}
+
+
+static void draw_image_page(cairo_t *cr, double w, double h,
+                            int page, bool modified)
+{
+    Random rnd(3000 + page);
+
+    const int img_w = 1200, img_h = 1600;
+    cairo_surface_t *img =
+        cairo_image_surface_create(CAIRO_FORMAT_RGB24, img_w, img_h);
+    cairo_surface_flush(img);
+
+    unsigned char *data = cairo_image_surface_get_data(img);
+    const int stride = cairo_image_surface_get_stride(img);
+
+    // smooth gradients with noise, similar to photos
+    for ( int y = 0; y < img_h; y++ )
+    {
+        guint32 *row = (guint32*)(data + y * stride);
+        for ( int x = 0; x < img_w; x++ )
+        {
+            const int noise = rnd.Int(16);
+            const int r = (x * 255 / img_w + noise) & 0xFF;
+            const int g = (y * 255 / img_h + noise) & 0xFF;
+            const int b = ((x + y) * 255 / (img_w + img_h) + page * 16) & 0xFF;
+            row[x] = (r << 16) | (g << 8) | b;
+        }
+    }
+
+    // change a small block on every page
+    if ( modified )
+    {
+        for ( int y = 700; y < 740; y++ )
+            memset(data + y * stride + 500 * 4, 0, 40 * 4);
+    }
+
+    cairo_surface_mark_dirty(img);
+
+    cairo_save(cr);
+    cairo_scale(cr, w / img_w, h / img_h);
+    cairo_set_source_surface(cr, img, 0, 0);
+    cairo_paint(cr);
+    cairo_restore(cr);
+
+    cairo_surface_destroy(img);
+}
+
+
+static void draw_simple_page(cairo_t *cr, double w, double h,
+                             int page, bool modified)
+{
+    Random rnd(4000 + page);
+
+    cairo_set_source_rgb(cr, 0.2, 0.3, 0.8);
+    for ( int i = 0; i < 20; i++ )
+    {
+        cairo_rectangle(cr, rnd.Real() * w, rnd.Real() * h, 40, 20);
+        cairo_fill(cr);
+    }
+
+    // only one page of the many differs
+    if ( modified && page == 250 )
+    {
+        cairo_set_source_rgb(cr, 1, 0, 0);
+        cairo_rectangle(cr, w / 2, h / 2, 10, 10);
+        cairo_fill(cr);
+    }
+}
+
+
+static const CorpusDocument corpus[] =
+{
+    { "text",   20,  A4_WIDTH, A4_HEIGHT, draw_text_page },
+    { "vector", 20,  A4_WIDTH, A4_HEIGHT, draw_vector_page },
+    { "image",  10,  A4_WIDTH, A4_HEIGHT, draw_image_page },
+    { "huge",   2,   A0_WIDTH, A0_HEIGHT, draw_vector_page },
+    { "many",   500, A4_WIDTH / 2, A4_HEIGHT / 2, draw_simple_page },
+};
+
+
+static bool write_document(const CorpusDocument& doc, const char *dir,
+                           bool modified)
+{
+    gchar *filename = g_strdup_printf("%s/%s-%c.pdf",
+                                      dir, doc.name, modified ? 'b' : 'a');
+
+    cairo_surface_t *surface =
+        cairo_pdf_surface_create(filename, doc.width, doc.height);
+#if CAIRO_VERSION >= CAIRO_VERSION_ENCODE(1, 16, 0)
+    // don't put the current time into the files
+    cairo_pdf_surface_set_metadata(surface, CAIRO_PDF_METADATA_CREATE_DATE,
+                                   "2000-01-01T00:00:00Z");
+#endif
+    cairo_t *cr = cairo_create(surface);
+
+    for ( int page = 0; page < doc.pages; page++ )
+    {
+        cairo_save(cr);
+        doc.draw(cr, doc.width, doc.height, page, modified);
+        cairo_restore(cr);
+        cairo_show_page(cr);
+    }
+
+    cairo_destroy(cr);
+    cairo_surface_finish(surface);
+
+    const bool ok = cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS;
+    if ( !ok )
+        fprintf(stderr, "Error writing %s\n", filename);
+
+    cairo_surface_destroy(surface);
+    g_free(filename);
+
+    return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if ( argc != 2 )
+    {
+        fprintf(stderr, "Usage: %s output-directory\n", argv[0]);
+        return 2;
+    }
+
+    const char *dir = argv[1];
+    g_mkdir_with_parents(dir, 0755);
+
+    for ( size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i++ )
+    {
+        if ( !write_document(corpus[i], dir, false) ||
+             !write_document(corpus[i], dir, true) )
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
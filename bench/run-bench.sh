@@ -0,0 +1,60 @@
+#!/bin/sh -e
+#
+# Runs diff-pdf over the benchmark corpus and prints results as lines of
+# "name<TAB>value", which stay the same between versions, so that results of
+# two builds can be compared with diff or paste.
+#
+# Extra options for diff-pdf may be given in BENCH_FLAGS (default: --dpi=150).
+
+if [ $# -ne 4 ]; then
+    echo "Usage: $0 diff-pdf gen-corpus diff-kernel-bench corpus-dir" >&2
+    exit 1
+fi
+
+DIFF_PDF=$1
+GEN_CORPUS=$2
+KERNEL_BENCH=$3
+CORPUS=$4
+
+BENCH_FLAGS=${BENCH_FLAGS:---dpi=150}
+
+$GEN_CORPUS $CORPUS
+
+echo "format	1"
+echo "flags	$BENCH_FLAGS"
+
+$KERNEL_BENCH
+
+STATS=$CORPUS/stats.txt
+
+for kind in text vector image huge many; do
+    for variant in same modified; do
+        if [ $variant = same ]; then
+            second=$CORPUS/$kind-a.pdf
+        else
+            second=$CORPUS/$kind-b.pdf
+        fi
+
+        # --verbose makes diff-pdf compare all pages even if they differ
+        status=0
+        $DIFF_PDF --verbose --stats $BENCH_FLAGS \
+            $CORPUS/$kind-a.pdf $second >/dev/null 2>$STATS || status=$?
+        if [ $status -gt 1 ]; then
+            echo "diff-pdf failed on $kind ($variant):" >&2
+            cat $STATS >&2
+            exit 1
+        fi
+
+        awk -v name="$kind.$variant" '
+            /^[0-9]+ /                { pages++ }
+            /wall time/               { wall = $(NF-1) }
+            /^peak RSS: [0-9.]+ MB$/  { rss = $3 }
+            END {
+                printf "%s.pages\t%d\n", name, pages
+                printf "%s.pages_per_second\t%.2f\n", name, (wall > 0 ? pages * 1000 / wall : 0)
+                printf "%s.peak_rss_mb\t%s\n", name, (rss != "" ? rss : "unknown")
+            }' $STATS
+    done
+done
+
+rm -f $STATS
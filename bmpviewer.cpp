@@ -19,10 +19,23 @@
 
 #include "bmpviewer.h"
 #include "gutter.h"
+#include "pixelconv.h"
 
-#include <wx/sizer.h>
+#include <algorithm>
+
+#include <wx/dcclient.h>
+#include <wx/image.h>
+#include <wx/rawbmp.h>
+#include <wx/thread.h>
+
+// Size of tiles the page is rendered in, in pixels
+#define TILE_SIZE 256
+
+// Maximum size of rendered tiles kept in memory, in MB
+#define TILE_CACHE_SIZE 64
 
 BEGIN_EVENT_TABLE(BitmapViewer, wxScrolledWindow)
+    EVT_PAINT(BitmapViewer::OnPaint)
     EVT_LEFT_DOWN(BitmapViewer::OnMouseDown)
     EVT_LEFT_UP(BitmapViewer::OnMouseUp)
     EVT_MOTION(BitmapViewer::OnMouseMove)
@@ -35,108 +48,236 @@ BitmapViewer::BitmapViewer(wxWindow *parent)
     : wxScrolledWindow(parent,
                        wxID_ANY,
                        wxDefaultPosition, wxDefaultSize,
-                       wxFULL_REPAINT_ON_RESIZE)
+                       wxFULL_REPAINT_ON_RESIZE),
+      m_tiles(TILE_CACHE_SIZE * 1024 * 1024)
 {
     m_gutter = NULL;
+    m_renderer = NULL;
+    m_resolution = 0;
+    m_page = -1;
+    m_which = PAGE_IMAGE_LEFT;
     m_zoom_factor = 1.0;
+    m_draggingPage = false;
 
     SetScrollRate(1, 1);
+}
 
-    wxBitmap dummyBitmap(16, 16);
-    m_content = new wxStaticBitmap(this, wxID_ANY, dummyBitmap);
 
-    wxBoxSizer *sizer = new wxBoxSizer(wxVERTICAL);
-    sizer->Add(m_content, wxSizerFlags(1).Expand());
-    SetSizer(sizer);
+void BitmapViewer::SetRenderer(TileRenderer *renderer, long resolution)
+{
+    m_renderer = renderer;
+    m_resolution = resolution;
+    UpdateBitmap();
+}
+
 
-    // we need to bind mouse-down event to m_content, as this scrolled window
-    // will never see mouse events otherwise
-    m_content->Connect
-               (
-                   wxEVT_LEFT_DOWN,
-                   wxMouseEventHandler(BitmapViewer::OnMouseDown),
-                   NULL,
-                   this
-               );
+void BitmapViewer::SetPage(int page, PageImage which,
+                           const wxSize& size, const wxPoint& offset)
+{
+    m_page = page;
+    m_which = which;
+    m_page_size = size;
+    m_offset = offset;
+    UpdateBitmap();
 }
 
 
 void BitmapViewer::SetBestFitZoom()
 {
+    if ( m_page_size.x <= 0 || m_page_size.y <= 0 )
+        return;
+
     // compute highest scale factor that still doesn't need scrollbars:
 
-    float scale_x = float(GetSize().x) / float(m_orig_image.GetWidth());
-    float scale_y = float(GetSize().y) / float(m_orig_image.GetHeight());
+    float scale_x = float(GetSize().x) / float(m_page_size.x);
+    float scale_y = float(GetSize().y) / float(m_page_size.y);
 
     SetZoom(std::min(scale_x, scale_y));
 }
 
 
-void BitmapViewer::UpdateBitmap()
+void BitmapViewer::ScrollToRect(const wxRect& rect)
 {
-    int new_w = int(m_orig_image.GetWidth() * m_zoom_factor);
-    int new_h = int(m_orig_image.GetHeight() * m_zoom_factor);
+    const wxSize client = GetClientSize();
 
-    if ( new_w != m_orig_image.GetWidth() ||
-         new_h != m_orig_image.GetHeight() )
-    {
-        wxImage scaled =
-            m_orig_image.Scale
-                         (
-                             new_w,
-                             new_h,
-                             // we don't need HQ filtering when upscaling
-                             m_zoom_factor < 1.0
-                                ? wxIMAGE_QUALITY_HIGH
-                                : wxIMAGE_QUALITY_NORMAL
-                         );
-        m_content->SetBitmap(wxBitmap(scaled));
-    }
-    else
-    {
-        m_content->SetBitmap(wxBitmap(m_orig_image));
-    }
+    // the scroll rate is 1, so scroll units are pixels
+    const int x = int((rect.x + rect.width / 2.0) * m_zoom_factor) - client.x / 2;
+    const int y = int((rect.y + rect.height / 2.0) * m_zoom_factor) - client.y / 2;
+    Scroll(std::max(0, x), std::max(0, y));
+
+    if ( m_gutter )
+        m_gutter->UpdateViewPos(this);
+}
+
+
+void BitmapViewer::UpdateBitmap()
+{
+    // tiles queued for the previous view are no longer needed
+    if ( m_renderer )
+        m_renderer->CancelQueued();
+    m_pending.clear();
 
-    GetSizer()->FitInside(this);
+    SetVirtualSize(int(m_page_size.x * m_zoom_factor),
+                   int(m_page_size.y * m_zoom_factor));
+    Refresh();
 
     if ( m_gutter )
         m_gutter->UpdateViewPos(this);
 }
 
 
-void BitmapViewer::Set(const wxImage& image)
+TileRequest BitmapViewer::GetTileRequest(int column, int row) const
 {
-    m_orig_image = image;
-    UpdateBitmap();
+    const wxSize size = GetVirtualSize();
+
+    TileRequest r;
+    r.page = m_page;
+    r.which = m_which;
+    r.resolution = m_resolution * m_zoom_factor;
+    r.x = column * TILE_SIZE;
+    r.y = row * TILE_SIZE;
+    r.width = std::min(TILE_SIZE, size.x - r.x);
+    r.height = std::min(TILE_SIZE, size.y - r.y);
+
+    if ( m_which == PAGE_IMAGE_DIFF )
+    {
+        r.offset_x = int(m_offset.x * m_zoom_factor);
+        r.offset_y = int(m_offset.y * m_zoom_factor);
+    }
+
+    return r;
 }
 
 
-void BitmapViewer::Set(cairo_surface_t *surface)
+void BitmapViewer::OnPaint(wxPaintEvent&)
 {
-    // Cairo's RGB24 surfaces use 32 bits per pixel, while wxImage uses
-    // 24 bits per pixel, so we need to convert between the two representations
-    // manually. Moreover, channels order is different too, RGB vs. BGR.
+    wxPaintDC dc(this);
+    DoPrepareDC(dc);
 
-    const int w = cairo_image_surface_get_width(surface);
-    const int h = cairo_image_surface_get_height(surface);
+    if ( !m_renderer || m_page == -1 )
+        return;
+
+    const wxSize size = GetVirtualSize();
+    if ( size.x <= 0 || size.y <= 0 )
+        return;
 
-    wxImage img(w, h, false);
+    // the damaged area, in the coordinates of the zoomed page
+    wxRect update = GetUpdateRegion().GetBox();
+    update.SetPosition(CalcUnscrolledPosition(update.GetPosition()));
 
-    unsigned char *p_out = img.GetData();
+    const int col_first = std::max(0, update.x / TILE_SIZE);
+    const int row_first = std::max(0, update.y / TILE_SIZE);
+    const int col_last = std::min((size.x - 1) / TILE_SIZE,
+                                  update.GetRight() / TILE_SIZE);
+    const int row_last = std::min((size.y - 1) / TILE_SIZE,
+                                  update.GetBottom() / TILE_SIZE);
+
+    dc.SetPen(*wxTRANSPARENT_PEN);
+    dc.SetBrush(*wxWHITE_BRUSH);
+
+    for ( int row = row_first; row <= row_last; row++ )
+    {
+        for ( int col = col_first; col <= col_last; col++ )
+        {
+            const TileRequest request = GetTileRequest(col, row);
+            const TileKey key(request);
+
+            const wxBitmap *tile = m_tiles.Get(key);
+            if ( tile )
+            {
+                dc.DrawBitmap(*tile, request.x, request.y);
+                continue;
+            }
+
+            // show blank page until the tile is rendered
+            dc.DrawRectangle(request.x, request.y,
+                             request.width, request.height);
+
+            if ( m_pending.insert(key).second )
+                m_renderer->Request(request);
+        }
+    }
+}
+
+
+void BitmapViewer::OnTileReady(const TileRequest& request, cairo_surface_t *tile)
+{
+    if ( wxIsMainThread() )
+        OnTileRendered(request, tile);
+    else
+        CallAfter(&BitmapViewer::OnTileRendered, request, tile);
+}
+
+
+// Converts cairo's RGB24 surface to a bitmap, writing directly into the
+// bitmap's native pixel storage.
+static wxBitmap surface_to_bitmap(cairo_surface_t *surface)
+{
+    const int w = cairo_image_surface_get_width(surface);
+    const int h = cairo_image_surface_get_height(surface);
     const unsigned char *p_in = cairo_image_surface_get_data(surface);
     const int stride = cairo_image_surface_get_stride(surface);
 
+    wxBitmap bitmap(w, h, 24);
+
+    wxNativePixelData data(bitmap);
+    if ( !data )
+    {
+        // raw access isn't available, go through wxImage
+        wxImage img(w, h, false);
+        for ( int y = 0; y < h; y++ )
+            convert_row_to_rgb(p_in + y * stride, img.GetData() + 3 * w * y, w);
+        return wxBitmap(img);
+    }
+
+    typedef wxNativePixelFormat Format;
+
+    wxNativePixelData::Iterator row(data);
     for ( int y = 0; y < h; y++, p_in += stride )
     {
-        for ( int x = 0; x < w; x++ )
+        unsigned char *p_out = (unsigned char*)row.m_ptr;
+
+        if ( Format::SizePixel == 3 &&
+             Format::RED == 0 && Format::GREEN == 1 && Format::BLUE == 2 )
+        {
+            convert_row_to_rgb(p_in, p_out, w);
+        }
+        else if ( Format::SizePixel == 3 &&
+                  Format::RED == 2 && Format::GREEN == 1 && Format::BLUE == 0 )
+        {
+            convert_row_to_bgr(p_in, p_out, w);
+        }
+        else
         {
-            *(p_out++) = *(p_in + 4 * x + 2);
-            *(p_out++) = *(p_in + 4 * x + 1);
-            *(p_out++) = *(p_in + 4 * x + 0);
+            convert_row(p_in, p_out, w, Format::SizePixel,
+                        Format::RED, Format::GREEN, Format::BLUE);
         }
+
+        row.OffsetY(data, 1);
     }
 
-    Set(img);
+    return bitmap;
+}
+
+
+void BitmapViewer::OnTileRendered(TileRequest request, cairo_surface_t *tile)
+{
+    const wxBitmap bitmap = surface_to_bitmap(tile);
+    cairo_surface_destroy(tile);
+
+    const TileKey key(request);
+    m_pending.erase(key);
+    m_tiles.Put(key, bitmap);
+
+    // repaint the tile if it's still part of the shown image
+    const TileRequest current = GetTileRequest(request.x / TILE_SIZE,
+                                               request.y / TILE_SIZE);
+    if ( TileKey(current) == key )
+    {
+        RefreshRect(wxRect(CalcScrolledPosition(wxPoint(request.x, request.y)),
+                           wxSize(request.width, request.height)),
+                    false);
+    }
 }
 
 
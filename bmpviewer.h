@@ -20,25 +20,32 @@
 #ifndef _bmpviewer_h_
 #define _bmpviewer_h_
 
-#include <cairo/cairo.h>
+#include "tilecache.h"
+#include "tilerender.h"
+
+#include <set>
 
-#include <wx/image.h>
-#include <wx/bitmap.h>
-#include <wx/statbmp.h>
 #include <wx/scrolwin.h>
 #include <wx/event.h>
 
 class Gutter;
 
-// widget for comfortable viewing of a bitmap, with high-quality zooming
-class BitmapViewer : public wxScrolledWindow
+// widget for comfortable viewing of a page, rendered in tiles at the
+// resolution needed by the current zoom
+class BitmapViewer : public wxScrolledWindow, public TileObserver
 {
 public:
     BitmapViewer(wxWindow *parent);
 
-    // set the bitmap to be shown
-    void Set(const wxImage& image);
-    void Set(cairo_surface_t *surface);
+    // Sets the renderer of the tiles and the resolution, in DPI, that
+    // corresponds to 100% zoom.
+    void SetRenderer(TileRenderer *renderer, long resolution);
+
+    // Shows given image of the page. 'size' is the page's size at 100% zoom
+    // and 'offset' is the offset of the right page in the diff image, in the
+    // same pixels.
+    void SetPage(int page, PageImage which,
+                 const wxSize& size, const wxPoint& offset);
 
     float GetZoom() const
     {
@@ -54,13 +61,28 @@ public:
     // sets the zoom value to "best fit" for current window size
     void SetBestFitZoom();
 
+    // scrolls the view so that given rectangle of the page, in pixels at 100%
+    // zoom, is in its center
+    void ScrollToRect(const wxRect& rect);
+
     // attaches a gutter that shows current scrolling position to the window
     void AttachGutter(Gutter *g);
 
+    // TileObserver
+    virtual void OnTileReady(const TileRequest& request, cairo_surface_t *tile);
+
 private:
-    // update the content after some change (bitmap, zoom factor, ...)
+    // update the content after some change (page, zoom factor, ...)
     void UpdateBitmap();
 
+    // Returns request for the tile of the currently shown image, at current
+    // zoom, at given column and row.
+    TileRequest GetTileRequest(int column, int row) const;
+
+    // Called in the main thread with a rendered tile.
+    void OnTileRendered(TileRequest request, cairo_surface_t *tile);
+
+    void OnPaint(wxPaintEvent& event);
     void OnMouseDown(wxMouseEvent& event);
     void OnMouseUp(wxMouseEvent& event);
     void OnMouseMove(wxMouseEvent& event);
@@ -69,10 +91,21 @@ private:
     void OnSizeChanged(wxSizeEvent& event);
 
 private:
-    wxStaticBitmap *m_content;
-    wxImage m_orig_image;
+    TileRenderer *m_renderer;
+    long m_resolution;
+
+    // the shown image
+    int m_page;
+    PageImage m_which;
+    wxSize m_page_size;
+    wxPoint m_offset;
+
     float m_zoom_factor;
 
+    TileCache m_tiles;
+    // tiles requested from the renderer and not received yet
+    std::set<TileKey> m_pending;
+
     // is the user currently dragging the page around with the mouse?
     bool m_draggingPage;
     wxPoint m_draggingLastMousePos;
@@ -0,0 +1,198 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "components.h"
+
+#include <algorithm>
+
+ComponentLabeler::ComponentLabeler(bool keep_runs)
+    : m_run_x1(0), m_run_x2(0), m_run_y(-1),
+      m_row_y(-1),
+      m_prev_pos(0),
+      m_keep_runs(keep_runs)
+{
+}
+
+
+void ComponentLabeler::StartRun(int x, int y)
+{
+    if ( m_run_y != -1 )
+        FinishRun();
+
+    if ( y != m_row_y )
+    {
+        // runs of a row that isn't directly above can't touch the new ones
+        if ( y == m_row_y + 1 )
+            m_prev_row.swap(m_row);
+        else
+            m_prev_row.clear();
+        m_row.clear();
+        m_row_y = y;
+        m_prev_pos = 0;
+    }
+
+    m_run_x1 = m_run_x2 = x;
+    m_run_y = y;
+}
+
+
+void ComponentLabeler::FinishRun()
+{
+    Run run;
+    run.x1 = m_run_x1;
+    run.x2 = m_run_x2;
+    run.label = -1;
+
+    // runs of the previous row that end left of this one can't touch any of
+    // the following runs either
+    while ( m_prev_pos < m_prev_row.size() &&
+            m_prev_row[m_prev_pos].x2 < run.x1 - 1 )
+    {
+        m_prev_pos++;
+    }
+
+    for ( size_t i = m_prev_pos;
+          i < m_prev_row.size() && m_prev_row[i].x1 <= run.x2 + 1;
+          i++ )
+    {
+        if ( run.label == -1 )
+            run.label = FindRoot(m_prev_row[i].label);
+        else
+            Union(run.label, m_prev_row[i].label);
+    }
+
+    if ( run.label != -1 )
+    {
+        // joining the runs above may have changed the root
+        run.label = FindRoot(run.label);
+    }
+    else
+    {
+        run.label = (int)m_parent.size();
+        m_parent.push_back(run.label);
+
+        DiffComponent box;
+        box.x = run.x1;
+        box.y = m_run_y;
+        m_boxes.push_back(box);
+    }
+
+    DiffComponent& box = m_boxes[run.label];
+    const int x2 = std::max(box.x + box.width - 1, run.x2);
+    box.x = std::min(box.x, run.x1);
+    box.width = x2 - box.x + 1;
+    box.height = m_run_y - box.y + 1;
+    box.pixel_count += run.x2 - run.x1 + 1;
+
+    m_row.push_back(run);
+
+    if ( m_keep_runs )
+    {
+        LabeledRun labeled;
+        labeled.run.x = run.x1;
+        labeled.run.y = m_run_y;
+        labeled.run.length = run.x2 - run.x1 + 1;
+        labeled.label = run.label;
+        m_runs.push_back(labeled);
+    }
+
+    m_run_y = -1;
+}
+
+
+int ComponentLabeler::FindRoot(int label)
+{
+    int root = label;
+    while ( m_parent[root] != root )
+        root = m_parent[root];
+
+    while ( m_parent[label] != root )
+    {
+        const int next = m_parent[label];
+        m_parent[label] = root;
+        label = next;
+    }
+
+    return root;
+}
+
+
+void ComponentLabeler::Union(int a, int b)
+{
+    a = FindRoot(a);
+    b = FindRoot(b);
+    if ( a == b )
+        return;
+
+    // keep the older label, which is the topmost one, as the root
+    if ( b < a )
+        std::swap(a, b);
+    m_parent[b] = a;
+
+    DiffComponent& ra = m_boxes[a];
+    const DiffComponent& rb = m_boxes[b];
+    const int x2 = std::max(ra.x + ra.width, rb.x + rb.width);
+    const int y2 = std::max(ra.y + ra.height, rb.y + rb.height);
+    ra.x = std::min(ra.x, rb.x);
+    ra.y = std::min(ra.y, rb.y);
+    ra.width = x2 - ra.x;
+    ra.height = y2 - ra.y;
+    ra.pixel_count += rb.pixel_count;
+}
+
+
+long ComponentLabeler::GetComponents(std::vector<DiffComponent>& components,
+                                     long min_pixels)
+{
+    if ( m_run_y != -1 )
+        FinishRun();
+
+    components.clear();
+    long ignored = 0;
+
+    // roots are the components' first runs, so they are in the order of
+    // the components' first pixels
+    for ( size_t i = 0; i < m_parent.size(); i++ )
+    {
+        if ( m_parent[i] != (int)i )
+            continue;
+
+        if ( m_boxes[i].pixel_count < min_pixels )
+            ignored += m_boxes[i].pixel_count;
+        else
+            components.push_back(m_boxes[i]);
+    }
+
+    return ignored;
+}
+
+
+void ComponentLabeler::GetRuns(std::vector<PixelRun>& runs, long min_pixels)
+{
+    if ( m_run_y != -1 )
+        FinishRun();
+
+    runs.clear();
+    for ( size_t i = 0; i < m_runs.size(); i++ )
+    {
+        // labels of runs joined later aren't roots any more
+        if ( m_boxes[FindRoot(m_runs[i].label)].pixel_count >= min_pixels )
+            runs.push_back(m_runs[i].run);
+    }
+}
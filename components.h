@@ -0,0 +1,126 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _components_h_
+#define _components_h_
+
+// Finding connected clusters of differing pixels, so that differences can be
+// reported, navigated and filtered by their location instead of only being
+// counted.
+
+#include <stddef.h>
+
+#include <vector>
+
+// Connected cluster of differing pixels, in pixels of the diff image.
+struct DiffComponent
+{
+    DiffComponent() : x(0), y(0), width(0), height(0), pixel_count(0) {}
+
+    // bounding box of the cluster
+    int x, y, width, height;
+    // number of differing pixels in it
+    long pixel_count;
+};
+
+// Run of differing pixels of a row.
+struct PixelRun
+{
+    int x, y, length;
+};
+
+// Labels connected components of differing pixels in a single pass over the
+// image. Differing pixels are added row by row, left to right, as the diff
+// is computed; consecutive ones are merged into runs, and runs touching runs
+// of the previous row (including diagonally) are joined into the same
+// component with a union-find structure, so that only two rows of runs are
+// kept besides the components, unless all runs are kept to find out which
+// pixels belong to the components that aren't left out.
+class ComponentLabeler
+{
+public:
+    ComponentLabeler(bool keep_runs = false);
+
+    // Adds differing pixel. Pixels must be added in row-major order.
+    void AddPixel(int x, int y)
+    {
+        if ( y == m_run_y && x == m_run_x2 + 1 )
+            m_run_x2 = x;
+        else
+            StartRun(x, y);
+    }
+
+    // Stores components of all pixels added so far into 'components', in the
+    // order of their first pixels, i.e. from top to bottom. Components with
+    // fewer than 'min_pixels' pixels are left out and the number of their
+    // pixels is returned.
+    long GetComponents(std::vector<DiffComponent>& components,
+                       long min_pixels = 0);
+
+    // Stores runs of pixels of components with at least 'min_pixels' pixels
+    // into 'runs', in row-major order. The labeler must have been created
+    // with keep_runs.
+    void GetRuns(std::vector<PixelRun>& runs, long min_pixels = 0);
+
+private:
+    struct Run
+    {
+        int x1, x2;
+        int label;
+    };
+
+    // Run of any row with the label it had when it was added.
+    struct LabeledRun
+    {
+        PixelRun run;
+        int label;
+    };
+
+    // Finishes the current run and starts a new one at given pixel.
+    void StartRun(int x, int y);
+
+    // Adds the current run to the current row's runs and labels it.
+    void FinishRun();
+
+    // Returns the label's root, compressing the path to it.
+    int FindRoot(int label);
+
+    // Joins components of given labels.
+    void Union(int a, int b);
+
+    // the run being extended by AddPixel(); m_run_y is -1 if there's none
+    int m_run_x1, m_run_x2, m_run_y;
+
+    // finished runs of the current row and of the row above it
+    std::vector<Run> m_row, m_prev_row;
+    int m_row_y;
+    // first run of m_prev_row that may still touch the current run
+    size_t m_prev_pos;
+
+    // union-find parent of every label and bounding box and pixel count
+    // of the runs with that label
+    std::vector<int> m_parent;
+    std::vector<DiffComponent> m_boxes;
+
+    // all runs, if they are kept
+    bool m_keep_runs;
+    std::vector<LabeledRun> m_runs;
+};
+
+#endif // _components_h_
@@ -17,1091 +17,659 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "bmpviewer.h"
-#include "gutter.h"
+#include "align.h"
+#include "diffpdf.h"
+#include "membudget.h"
+#include "rastercache.h"
+#include "stats.h"
+#ifdef DIFF_PDF_GUI
+    #include "diffframe.h"
+#endif
 
 #include <stdio.h>
-#include <assert.h>
+#include <string.h>
 
-#include <vector>
+#include <algorithm>
+#include <string>
 
 #include <glib.h>
-#include <poppler.h>
-#include <cairo/cairo.h>
-#include <cairo/cairo-pdf.h>
-
-#include <wx/app.h>
-#include <wx/evtloop.h>
-#include <wx/cmdline.h>
-#include <wx/filename.h>
-#include <wx/log.h>
-#include <wx/frame.h>
-#include <wx/sizer.h>
-#include <wx/toolbar.h>
-#include <wx/artprov.h>
-#include <wx/progdlg.h>
-#include <wx/filesys.h>
-
-
-enum DisplayMode
-{
-    SHOW_DIFF_DOCUMENT,
-    SHOW_LEFT_DOCUMENT,
-    SHOW_RIGHT_DOCUMENT
-};
+#include <glib/gstdio.h>
+
+#define DEFAULT_CACHE_SIZE 1024 // MB
 
 // ------------------------------------------------------------------------
-// PDF rendering functions
+// main()
 // ------------------------------------------------------------------------
 
-bool g_verbose = false;
-bool g_skip_identical = false;
-bool g_mark_differences = false;
-long g_channel_tolerance = 0;
-long g_per_page_pixel_tolerance = 0;
-bool g_grayscale = false;
-// Resolution to use for rasterization, in DPI
-#define DEFAULT_RESOLUTION 300
-long g_resolution = DEFAULT_RESOLUTION;
-
-inline unsigned char to_grayscale(unsigned char r, unsigned char g, unsigned char b)
+// Values of options that may be given both on the command line and for
+// individual pairs in batch mode, in the form filled in by GOption.
+struct CompareArgs
 {
-    return (unsigned char)(0.2126 * r + 0.7152 * g + 0.0722 * b);
-}
+    CompareArgs(const DiffOptions& defaults)
+        : skip_identical(defaults.skip_identical),
+          mark_differences(defaults.mark_differences),
+          grayscale(defaults.grayscale),
+          channel_tolerance(defaults.channel_tolerance),
+          per_page_pixel_tolerance(defaults.per_page_pixel_tolerance),
+          min_region_size(defaults.min_region_size),
+          dpi(defaults.resolution),
+          auto_align(defaults.auto_align),
+          max_align_offset(defaults.max_align_offset),
+          align_pages(defaults.align_pages),
+          patch_output(defaults.patch_output),
+          highlight_changes(defaults.highlight_changes),
+          output_diff(NULL),
+          output_png_dir(NULL),
+          output_mask_dir(NULL),
+          report(NULL)
+    {}
+
+    ~CompareArgs()
+    {
+        g_free(output_diff);
+        g_free(output_png_dir);
+        g_free(output_mask_dir);
+        g_free(report);
+    }
+
+    gboolean skip_identical;
+    gboolean mark_differences;
+    gboolean grayscale;
+    gint channel_tolerance;
+    gint per_page_pixel_tolerance;
+    gint min_region_size;
+    gint dpi;
+    gboolean auto_align;
+    gint max_align_offset;
+    gboolean align_pages;
+    gboolean patch_output;
+    gboolean highlight_changes;
+    gchar *output_diff;
+    gchar *output_png_dir;
+    gchar *output_mask_dir;
+    gchar *report;
+};
 
-cairo_surface_t *render_page(PopplerPage *page)
+
+// Adds options stored in CompareArgs to the context.
+void add_compare_entries(GOptionContext *context, CompareArgs& args)
 {
-    double w, h;
-    poppler_page_get_size(page, &w, &h);
+    const GOptionEntry entries[] =
+    {
+        { "skip-identical", 's', 0, G_OPTION_ARG_NONE, &args.skip_identical,
+          "only output pages with differences", NULL },
 
-    const int w_px = int((int)g_resolution * w / 72.0);
-    const int h_px = int((int)g_resolution * h / 72.0);
+        { "mark-differences", 'm', 0, G_OPTION_ARG_NONE, &args.mark_differences,
+          "additionally mark differences on left side", NULL },
 
-    cairo_surface_t *surface =
-        cairo_image_surface_create(CAIRO_FORMAT_RGB24, w_px, h_px);
+        { "grayscale", 'g', 0, G_OPTION_ARG_NONE, &args.grayscale,
+          "only differences will be in color, unchanged parts will show as gray", NULL },
 
-    cairo_t *cr = cairo_create(surface);
+        { "output-diff", 0, 0, G_OPTION_ARG_FILENAME, &args.output_diff,
+          "output differences to given PDF file", "FILE" },
 
-    // clear the surface to white background:
-    cairo_save(cr);
-    cairo_set_source_rgb(cr, 1, 1, 1);
-    cairo_rectangle(cr, 0, 0, w_px, h_px);
-    cairo_fill(cr);
-    cairo_restore(cr);
+        { "output-png-dir", 0, 0, G_OPTION_ARG_FILENAME, &args.output_png_dir,
+          "write image of differences of every differing page into given directory as page-NNNN.png", "DIR" },
 
-    // Scale so that PDF output covers the whole surface. Image surface is
-    // created with transformation set up so that 1 coordinate unit is 1 pixel;
-    // Poppler assumes 1 unit = 1 point.
-    cairo_scale(cr, (int)g_resolution / 72.0, (int)g_resolution / 72.0);
+        { "output-mask-dir", 0, 0, G_OPTION_ARG_FILENAME, &args.output_mask_dir,
+          "write 1-bit mask of differing pixels of every differing page into given directory as page-NNNN.png", "DIR" },
 
-    poppler_page_render(page, cr);
+        { "patch-output", 0, 0, G_OPTION_ARG_NONE, &args.patch_output,
+          "keep pages of the diff PDF as vector content and only overlay images of the changed regions", NULL },
 
-    cairo_show_page(cr);
+        { "highlight-changes", 0, 0, G_OPTION_ARG_NONE, &args.highlight_changes,
+          "outline the changed regions in the diff PDF (with --patch-output)", NULL },
 
-    cairo_destroy(cr);
+        { "report", 0, 0, G_OPTION_ARG_FILENAME, &args.report,
+          "write details of every page's differences to given JSON file", "FILE" },
 
-    return surface;
-}
+        { "channel-tolerance", 0, 0, G_OPTION_ARG_INT, &args.channel_tolerance,
+          "consider channel values to be equal if within specified tolerance", "N" },
 
+        { "per-page-pixel-tolerance", 0, 0, G_OPTION_ARG_INT, &args.per_page_pixel_tolerance,
+          "total number of pixels allowed to be different per page before specifying the page is different", "N" },
 
-// Creates image of differences between s1 and s2. If the offset is specified,
-// then s2 is displaced by it. If thumbnail and thumbnail_width are specified,
-// then a thumbnail with highlighted differences is created too.
-cairo_surface_t *diff_images(int page, cairo_surface_t *s1, cairo_surface_t *s2,
-                             int offset_x = 0, int offset_y = 0,
-                             wxImage *thumbnail = NULL, int thumbnail_width = -1)
-{
-    assert( s1 || s2 );
+        { "min-region-size", 0, 0, G_OPTION_ARG_INT, &args.min_region_size,
+          "ignore connected clusters of differing pixels smaller than this many pixels", "N" },
 
-    long pixel_diff_count = 0;
-    wxRect r1, r2;
+        { "dpi", 0, 0, G_OPTION_ARG_INT, &args.dpi,
+          "rasterization resolution (default: " G_STRINGIFY(DEFAULT_RESOLUTION) " dpi)", "N" },
 
-    if ( s1 )
-    {
-        r1 = wxRect(0, 0,
-                    cairo_image_surface_get_width(s1),
-                    cairo_image_surface_get_height(s1));
-    }
-    if ( s2 )
-    {
-        r2 = wxRect(offset_x, offset_y,
-                    cairo_image_surface_get_width(s2),
-                    cairo_image_surface_get_height(s2));
-    }
+        { "auto-align", 0, 0, G_OPTION_ARG_NONE, &args.auto_align,
+          "find the offset of shifted content of every page and compare the pages at that offset", NULL },
 
-    // compute union rectangle starting at [0,0] position
-    wxRect rdiff(r1);
-    rdiff.Union(r2);
-    r1.Offset(-rdiff.x, -rdiff.y);
-    r2.Offset(-rdiff.x, -rdiff.y);
-    rdiff.Offset(-rdiff.x, -rdiff.y);
+        { "max-align-offset", 0, 0, G_OPTION_ARG_INT, &args.max_align_offset,
+          "largest offset in pixels looked for by --auto-align (default: " G_STRINGIFY(DEFAULT_MAX_ALIGN_OFFSET) ")", "N" },
 
-    bool changes = false;
+        { "align-pages", 0, 0, G_OPTION_ARG_NONE, &args.align_pages,
+          "pair pages by their content, so that inserted or deleted pages don't make the following pages differ", NULL },
 
-    cairo_surface_t *diff =
-        cairo_image_surface_create(CAIRO_FORMAT_RGB24, rdiff.width, rdiff.height);
+        { NULL }
+    };
 
-    float thumbnail_scale;
-    int thumbnail_height;
+    g_option_context_add_main_entries(context, entries, NULL);
+}
 
-    if ( thumbnail )
-    {
-        thumbnail_scale = float(thumbnail_width) / float(rdiff.width);
-        thumbnail_height = int(rdiff.height * thumbnail_scale);
-        thumbnail->Create(thumbnail_width, thumbnail_height);
-        // initalize the thumbnail with a white rectangle:
-        thumbnail->SetRGB(wxRect(), 255, 255, 255);
-    }
 
-    // clear the surface to white background if the merged images don't fully
-    // overlap:
-    if ( r1 != r2 )
-    {
-        changes = true;
+// Sets comparison options that may be given both on the command line and for
+// individual pairs in batch mode. Returns false if they are invalid.
+bool apply_compare_args(const CompareArgs& args, DiffOptions& options)
+{
+    options.skip_identical = args.skip_identical;
+    options.mark_differences = args.mark_differences;
+    options.grayscale = args.grayscale;
 
-        cairo_t *cr = cairo_create(diff);
-        cairo_set_source_rgb(cr, 1, 1, 1);
-        cairo_rectangle(cr, 0, 0, rdiff.width, rdiff.height);
-        cairo_fill(cr);
-        cairo_destroy(cr);
+    options.per_page_pixel_tolerance = args.per_page_pixel_tolerance;
+    if (options.per_page_pixel_tolerance < 0) {
+        fprintf(stderr, "Invalid per-page-pixel-tolerance: %ld. Must be 0 or more\n", options.per_page_pixel_tolerance);
+        return false;
     }
 
-    const int stride1 = s1 ? cairo_image_surface_get_stride(s1) : 0;
-    const int stride2 = s2 ? cairo_image_surface_get_stride(s2) : 0;
-    const int stridediff = cairo_image_surface_get_stride(diff);
-
-    const unsigned char *data1 = s1 ? cairo_image_surface_get_data(s1) : NULL;
-    const unsigned char *data2 = s2 ? cairo_image_surface_get_data(s2) : NULL;
-    unsigned char *datadiff = cairo_image_surface_get_data(diff);
-
-    // we visualize the differences by taking one channel from s1
-    // and the other two channels from s2:
-
-    // first, copy s1 over:
-    if ( s1 )
-    {
-        unsigned char *out = datadiff + r1.y * stridediff + r1.x * 4;
-        for ( int y = 0;
-              y < r1.height;
-              y++, data1 += stride1, out += stridediff )
-        {
-            memcpy(out, data1, r1.width * 4);
-        }
+    options.min_region_size = args.min_region_size;
+    if (options.min_region_size < 0) {
+        fprintf(stderr, "Invalid min-region-size: %ld. Must be 0 or more\n", options.min_region_size);
+        return false;
     }
 
-    // then, copy B channel from s2 over it; also compare the two versions
-    // to see if there are any differences:
-    if ( s2 )
-    {
-        unsigned char *out = datadiff + r2.y * stridediff + r2.x * 4;
-        for ( int y = 0;
-              y < r2.height;
-              y++, data2 += stride2, out += stridediff )
-        {
-            bool linediff = false;
+    options.channel_tolerance = args.channel_tolerance;
+    if (options.channel_tolerance < 0 || options.channel_tolerance > 255) {
+        fprintf(stderr, "Invalid channel-tolerance: %ld. Valid range is 0(default, exact matching)-255\n", options.channel_tolerance);
+        return false;
+    }
 
-            for ( int x = 0; x < r2.width * 4; x += 4 )
-            {
-                unsigned char cr1 = *(out + x + 0);
-                unsigned char cg1 = *(out + x + 1);
-                unsigned char cb1 = *(out + x + 2);
-
-                unsigned char cr2 = *(data2 + x + 0);
-                unsigned char cg2 = *(data2 + x + 1);
-                unsigned char cb2 = *(data2 + x + 2);
-
-                if ( cr1 > (cr2+g_channel_tolerance) || cr1 < (cr2-g_channel_tolerance)
-                  || cg1 > (cg2+g_channel_tolerance) || cg1 < (cg2-g_channel_tolerance)
-                  || cb1 > (cb2+g_channel_tolerance) || cb1 < (cb2-g_channel_tolerance)
-                   )
-                {
-                    pixel_diff_count++;
-                    changes = true;
-                    linediff = true;
-
-                    if ( thumbnail )
-                    {
-                        // calculate the coordinates in the thumbnail
-                        int tx = int((r2.x + x/4.0) * thumbnail_scale);
-                        int ty = int((r2.y + y) * thumbnail_scale);
-
-                        // Limit the coordinates to the thumbnail size (may be
-                        // off slightly due to rounding errors).
-                        // See https://github.com/vslavik/diff-pdf/pull/58
-                        tx = std::min(tx, thumbnail_width - 1);
-                        ty = std::min(ty, thumbnail_height - 1);
-
-                        // mark changes with red
-                        thumbnail->SetRGB(tx, ty, 255, 0, 0);
-                    }
-                }
-
-                if (g_grayscale)
-                {
-                    // convert both images to grayscale, use blue for s1, red for s2
-                    unsigned char gray1 = to_grayscale(cr1, cg1, cb1);
-                    unsigned char gray2 = to_grayscale(cr2, cg2, cb2);
-                    *(out + x + 0) = gray2;
-                    *(out + x + 1) = (gray1 + gray2) / 2;
-                    *(out + x + 2) = gray1;
-                }
-                else
-                {
-                    // change the B channel to be from s2; RG will be s1
-                    *(out + x + 2) = cb2;
-                }
-            }
+    options.resolution = args.dpi;
+    if (options.resolution < 1 || options.resolution > 2400) {
+        fprintf(stderr, "Invalid dpi: %ld. Valid range is 1-2400 (default: %d)\n", options.resolution, DEFAULT_RESOLUTION);
+        return false;
+    }
 
-            if (g_mark_differences && linediff)
-            {
-                for (int x = 0; x < (10 < r2.width ? 10 : r2.width) * 4; x+=4)
-                {
-                   *(out + x + 0) = 0;
-                   *(out + x + 1) = 0;
-                   *(out + x + 2) = 255;
-                }
-            }
-        }
+    // the prepass is set on the command line only, but its resolution must
+    // not exceed the one of every pair in batch mode
+    if (options.prepass_resolution > options.resolution) {
+        fprintf(stderr, "Invalid dpi: %ld. Must be at least prepass-dpi (%ld)\n", options.resolution, options.prepass_resolution);
+        return false;
     }
 
-    // add background image of the page to the thumbnails
-    if ( thumbnail )
-    {
-        // copy the 'diff' surface into wxImage:
-        wxImage bg(rdiff.width, rdiff.height);
-        unsigned char *in = datadiff;
-        unsigned char *out = bg.GetData();
-        for ( int y = 0; y < rdiff.height; y++, in += stridediff )
-        {
-            for ( int x = 0; x < rdiff.width * 4; x += 4 )
-            {
-                // cairo_surface_t uses BGR order, wxImage has RGB
-                *(out++) = *(in + x + 2);
-                *(out++) = *(in + x + 1);
-                *(out++) = *(in + x + 0);
-            }
-        }
+    options.auto_align = args.auto_align;
+    options.max_align_offset = args.max_align_offset;
+    if (options.max_align_offset < 1) {
+        fprintf(stderr, "Invalid max-align-offset: %ld. Must be 1 or more\n", options.max_align_offset);
+        return false;
+    }
 
-        // scale it to thumbnail size:
-        bg.Rescale(thumbnail_width, thumbnail_height, wxIMAGE_QUALITY_HIGH);
+    options.align_pages = args.align_pages;
+    options.patch_output = args.patch_output;
+    options.highlight_changes = args.highlight_changes;
 
-        // and merge with the diff markers in *thumbnail, making it much
-        // lighter in the process:
-        in = bg.GetData();
-        out = thumbnail->GetData();
-        for ( int i = thumbnail_width * thumbnail_height; i > 0; i-- )
-        {
-            if ( out[1] == 0 ) // G=0 ==> not white
-            {
-                // marked with red color, as place with differences -- don't
-                // paint background image here, make the red as visible as
-                // possible
-                out += 3;
-                in += 3;
-            }
-            else
-            {
-                // merge in lighter background image
-                *(out++) = 128 + *(in++) / 2;
-                *(out++) = 128 + *(in++) / 2;
-                *(out++) = 128 + *(in++) / 2;
-            }
-        }
+    return true;
+}
 
-        // If there were no changes, indicate it by using green
-        // (170,230,130) color for the thumbnail in gutter control:
-        if ( !changes )
-        {
-            out = thumbnail->GetData();
-            for ( int i = thumbnail_width * thumbnail_height;
-                  i > 0;
-                  i--, out += 3 )
-            {
-                out[0] = 170/2 + out[0] / 2;
-                out[1] = 230/2 + out[1] / 2;
-                out[2] = 130/2 + out[2] / 2;
-            }
-        }
-    }
 
-    if ( g_verbose )
-        printf("page %d has %ld pixels that differ\n", page, pixel_diff_count);
+// Reads a line from the file, without the line terminator. Returns false at
+// the end of file.
+bool read_line(FILE *f, std::string& line)
+{
+    line.clear();
 
-    // If we specified a tolerance, then return if we have exceeded that for this page
-    if ( g_per_page_pixel_tolerance == 0 ? changes : pixel_diff_count > g_per_page_pixel_tolerance)
+    char buf[1024];
+    while ( fgets(buf, sizeof(buf), f) )
     {
-        return diff;
+        line += buf;
+        if ( !line.empty() && line[line.size() - 1] == '\n' )
+            break;
     }
-    else
+
+    if ( line.empty() && feof(f) )
+        return false;
+
+    while ( !line.empty() &&
+            (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r') )
     {
-        cairo_surface_destroy(diff);
-        return NULL;
+        line.erase(line.size() - 1);
     }
+
+    return true;
 }
 
 
-// Compares given two pages. If cr_out is not NULL, then the diff image (either
-// differences or unmodified page, if there are no diffs) is drawn to it.
-// If thumbnail and thumbnail_width are specified, then a thumbnail with
-// highlighted differences is created too.
-bool page_compare(int page, cairo_t *cr_out,
-                  PopplerPage *page1, PopplerPage *page2,
-                  wxImage *thumbnail = NULL, int thumbnail_width = -1)
+// Parses options and files of one line of the batch manifest. The options
+// given on the command line, in 'defaults', apply unless they are overridden.
+// Returns false if the line is invalid.
+bool parse_batch_line(const std::string& line, const DiffOptions& defaults,
+                      DiffOptions& options, CompareArgs& args,
+                      std::string& file1, std::string& file2)
 {
-    cairo_surface_t *img1 = page1 ? render_page(page1) : NULL;
-    cairo_surface_t *img2 = page2 ? render_page(page2) : NULL;
-
-    cairo_surface_t *diff = diff_images(page, img1, img2, 0, 0,
-                                        thumbnail, thumbnail_width);
-    const bool has_diff = (diff != NULL);
-
-    if ( cr_out )
-    {
-        if ( diff )
-        {
-            // render the difference as high-resolution bitmap
+    // GOption expects the program name as the first argument
+    const std::string cmdline = "diff-pdf " + line;
 
-            cairo_save(cr_out);
-            cairo_scale(cr_out, 72.0 / g_resolution, 72.0 / g_resolution);
+    int argc;
+    char **argv;
+    if ( !g_shell_parse_argv(cmdline.c_str(), &argc, &argv, NULL) )
+        return false;
 
-            cairo_set_source_surface(cr_out, diff ? diff : img1, 0, 0);
-            cairo_paint(cr_out);
+    GOptionContext *context = g_option_context_new(NULL);
+    g_option_context_set_help_enabled(context, FALSE);
+    add_compare_entries(context, args);
 
-            cairo_restore(cr_out);
-        }
-        else
-        {
-            // save space (as well as improve rendering quality) in diff pdf
-            // by writing unchanged pages in their original form rather than
-            // a rasterized one
+    options = defaults;
 
-            if (!g_skip_identical)
-               poppler_page_render(page1, cr_out);
-        }
+    const bool ok = g_option_context_parse(context, &argc, &argv, NULL) &&
+                    argc == 3 &&
+                    apply_compare_args(args, options);
 
-        if (diff || !g_skip_identical)
-            cairo_show_page(cr_out);
+    if ( ok )
+    {
+        file1 = argv[1];
+        file2 = argv[2];
     }
 
-    if ( diff )
-        cairo_surface_destroy(diff);
+    g_option_context_free(context);
+    g_strfreev(argv);
 
-    if ( img1 )
-        cairo_surface_destroy(img1);
-    if ( img2 )
-        cairo_surface_destroy(img2);
-
-    return !has_diff;
+    return ok;
 }
 
 
-// Compares two documents, writing diff PDF into file named 'pdf_output' if
-// not NULL. if 'differences' is not NULL, puts a map of which pages differ
-// into it. If 'progress' is provided, it is updated to reflect comparison's
-// progress. If 'gutter' is set, then all the pages are added to it, with
-// their respective thumbnails (the gutter must be empty beforehand).
-bool doc_compare(PopplerDocument *doc1, PopplerDocument *doc2,
-                 const char *pdf_output,
-                 std::vector<bool> *differences,
-                 wxProgressDialog *progress = NULL,
-                 Gutter *gutter = NULL)
+// Compares pairs of documents listed in the manifest file ("-" for standard
+// input). Every line contains the two files and, optionally, options for
+// comparing them:
+//
+//   [options] file1.pdf file2.pdf
+//
+// Empty lines and lines starting with '#' are ignored. For every pair, a line
+// with the result ("same", "different" or "error: ...") and the two files,
+// separated by tabs, is printed. Returns the highest of the exit codes
+// individual comparisons would have.
+int run_batch(const char *manifest, const DiffOptions& defaults)
 {
-    int pages_differ = 0;
-
-    cairo_surface_t *surface_out = NULL;
-    cairo_t *cr_out = NULL;
-
-    if ( pdf_output )
+    FILE *f = strcmp(manifest, "-") == 0 ? stdin : g_fopen(manifest, "r");
+    if ( !f )
     {
-        double w, h;
-        poppler_page_get_size(poppler_document_get_page(doc1, 0), &w, &h);
-        surface_out = cairo_pdf_surface_create(pdf_output, w, h);
-        cr_out = cairo_create(surface_out);
+        fprintf(stderr, "Error opening %s\n", manifest);
+        return 3;
     }
 
-    int pages1 = poppler_document_get_n_pages(doc1);
-    int pages2 = poppler_document_get_n_pages(doc2);
-    int pages_total = pages1 > pages2 ? pages1 : pages2;
+    int retval = 0;
+    int line_num = 0;
+    std::string line;
 
-    if ( pages1 != pages2 )
-    {
-        if ( g_verbose )
-            printf("pages count differs: %d vs %d\n", pages1, pages2);
-    }
+    GBytes *baseline = NULL;
+    std::string baseline_file, baseline_hash;
 
-    for ( int page = 0; page < pages_total; page++ )
+    while ( read_line(f, line) )
     {
-        if ( progress )
+        line_num++;
+
+        const size_t start = line.find_first_not_of(" \t");
+        if ( start == std::string::npos || line[start] == '#' )
+            continue;
+
+        // options given on the command line are defaults for all pairs
+        DiffOptions options;
+        CompareArgs args(defaults);
+        std::string file1, file2;
+
+        if ( !parse_batch_line(line, defaults, options, args, file1, file2) )
         {
-            progress->Update
-                      (
-                          page,
-                          wxString::Format
-                          (
-                              "Comparing page %d of %d...",
-                              page+1,
-                              pages_total
-                          )
-                       );
+            printf("error: invalid line %d of %s\t\t\n", line_num, manifest);
+            retval = std::max(retval, 2);
+            continue;
         }
 
-        if ( pdf_output && page != 0 )
+        if ( file1 == "-" || file2 == "-" )
         {
-            double w, h;
-            poppler_page_get_size(poppler_document_get_page(doc1, page), &w, &h);
-            cairo_pdf_surface_set_size(surface_out, w, h);
+            printf("error: standard input can't be compared in batch mode\t%s\t%s\n",
+                   file1.c_str(), file2.c_str());
+            retval = std::max(retval, 2);
+            continue;
         }
 
-        PopplerPage *page1 = page < pages1
-                             ? poppler_document_get_page(doc1, page)
-                             : NULL;
-        PopplerPage *page2 = page < pages2
-                             ? poppler_document_get_page(doc2, page)
-                             : NULL;
-
-        bool page_same;
+        const gint64 load_start = g_get_monotonic_time();
 
-        if ( gutter )
+        // consecutive lines typically compare against the same baseline, so
+        // it is mapped (and hashed) only once and shared by their documents
+        GError *err = NULL;
+        if ( file1 != baseline_file )
         {
-            wxImage thumbnail;
-            page_same = page_compare(page, cr_out, page1, page2,
-                                     &thumbnail, Gutter::WIDTH);
-
-            wxString label1("(null)");
-            wxString label2("(null)");
-
-            if ( page1 )
-            {
-                gchar *label;
-                g_object_get(page1, "label", &label, NULL);
-                label1 = wxString::FromUTF8(label);
-                g_free(label);
-            }
-            if ( page2 )
-            {
-                gchar *label;
-                g_object_get(page2, "label", &label, NULL);
-                label2 = wxString::FromUTF8(label);
-                g_free(label);
-            }
+            if ( baseline )
+                g_bytes_unref(baseline);
+            baseline_file.clear();
+            baseline_hash.clear();
+            baseline = load_document_bytes(file1.c_str(), &err);
+            if ( baseline )
+                baseline_file = file1;
+        }
 
+        PopplerDocument *doc1 =
+            baseline ? open_document_bytes(baseline, file1.c_str(), &err) : NULL;
+        PopplerDocument *doc2 = doc1 ? open_document_file(file2.c_str(), &err) : NULL;
 
-            wxString label;
-            if ( label1 == label2 )
-                label = label1;
-            else
-                label = label1 + " / " + label2;
+        if ( options.stats )
+            options.stats->AddTime(PHASE_LOAD, g_get_monotonic_time() - load_start);
 
-            gutter->AddPage(label, thumbnail);
+        if ( !doc2 )
+        {
+            printf("error: %s\t%s\t%s\n",
+                   err->message, file1.c_str(), file2.c_str());
+            g_error_free(err);
+            if ( doc1 )
+                g_object_unref(doc1);
+            retval = std::max(retval, 3);
+            continue;
         }
-        else
+
+        if ( options.raster_cache )
         {
-            page_same = page_compare(page, cr_out, page1, page2);
+            if ( baseline_hash.empty() )
+                baseline_hash = get_data_hash(baseline);
+            set_document_hash(doc1, baseline_hash);
         }
 
-        if ( differences )
-            differences->push_back(!page_same);
+        const bool same = doc_compare(options, doc1, doc2,
+                                      args.output_diff, NULL, NULL,
+                                      args.report,
+                                      args.output_png_dir,
+                                      args.output_mask_dir);
 
-        if ( !page_same )
-        {
-	    pages_differ ++;
+        printf("%s\t%s\t%s\n",
+               same ? "same" : "different", file1.c_str(), file2.c_str());
+        fflush(stdout);
 
-            if ( g_verbose )
-                printf("page %d differs\n", page);
+        if ( !same )
+            retval = std::max(retval, 1);
 
-            // If we don't need to output all different pages in any
-            // form (including verbose report of differing pages!), then
-            // we can stop comparing the PDFs as soon as we find the first
-            // difference.
-            if ( !g_verbose && !pdf_output && !differences && !gutter )
-                break;
-        }
+        g_object_unref(doc1);
+        g_object_unref(doc2);
     }
 
-    if ( pdf_output )
-    {
-        cairo_destroy(cr_out);
-        cairo_surface_destroy(surface_out);
-    }
+    if ( baseline )
+        g_bytes_unref(baseline);
 
-    if (g_verbose)
-        printf("%d of %d pages differ.\n", pages_differ, pages_total);
+    if ( f != stdin )
+        fclose(f);
 
-    // are doc1 and doc1 the same?
-    return (pages_differ == 0) && (pages1 == pages2);
+    return retval;
 }
 
 
-// ------------------------------------------------------------------------
-// wxWidgets GUI
-// ------------------------------------------------------------------------
-
-const int ID_PREV_PAGE = wxNewId();
-const int ID_NEXT_PAGE = wxNewId();
-const int ID_ZOOM_IN = wxNewId();
-const int ID_ZOOM_OUT = wxNewId();
-const int ID_OFFSET_LEFT = wxNewId();
-const int ID_OFFSET_RIGHT = wxNewId();
-const int ID_OFFSET_UP = wxNewId();
-const int ID_OFFSET_DOWN = wxNewId();
-const int ID_GUTTER = wxNewId();
-const int ID_LEFT_DOC = wxNewId();
-const int ID_RIGHT_DOC = wxNewId();
-const int ID_DIFF_DOC = wxNewId();
-
-#define BMP_ARTPROV(id) wxArtProvider::GetBitmap(id, wxART_TOOLBAR)
-
-#define BMP_PREV_PAGE      BMP_ARTPROV(wxART_GO_BACK)
-#define BMP_NEXT_PAGE      BMP_ARTPROV(wxART_GO_FORWARD)
-
-#define BMP_OFFSET_LEFT    BMP_ARTPROV(wxART_GO_BACK)
-#define BMP_OFFSET_RIGHT   BMP_ARTPROV(wxART_GO_FORWARD)
-#define BMP_OFFSET_UP      BMP_ARTPROV(wxART_GO_UP)
-#define BMP_OFFSET_DOWN    BMP_ARTPROV(wxART_GO_DOWN)
-
-#define BMP_LEFT_DOC       BMP_ARTPROV(wxART_GO_BACK)
-#define BMP_RIGHT_DOC      BMP_ARTPROV(wxART_GO_FORWARD)
-#define BMP_DIFF_DOC       BMP_ARTPROV(wxART_REDO)
-
-#ifdef __WXGTK__
-    #define BMP_ZOOM_IN    BMP_ARTPROV("gtk-zoom-in")
-    #define BMP_ZOOM_OUT   BMP_ARTPROV("gtk-zoom-out")
-#else
-    #include "gtk-zoom-in.xpm"
-    #include "gtk-zoom-out.xpm"
-    #define BMP_ZOOM_IN    wxBitmap(gtk_zoom_in_xpm)
-    #define BMP_ZOOM_OUT   wxBitmap(gtk_zoom_out_xpm)
-#endif
+int main(int argc, char *argv[])
+{
+    DiffOptions options;
+    CompareArgs compare_args(options);
 
-static const float ZOOM_FACTOR_STEP = 1.2f;
+    gboolean verbose = FALSE;
+    gboolean compare_ops = FALSE;
+    gboolean stats = FALSE;
+    gboolean view = FALSE;
+    gint band_height = 0;
+    gint prepass_dpi = 0;
+    gint jobs = 1;
+    gint max_memory = 0;
+    gint cache_size = DEFAULT_CACHE_SIZE;
+    gchar *cache_dir = NULL;
+    gchar *batch_file = NULL;
 
-class DiffFrame : public wxFrame
-{
-public:
-    DiffFrame(const wxString& title)
-        : wxFrame(NULL, wxID_ANY, title)
+    const GOptionEntry entries[] =
     {
-        m_cur_page = -1;
-
-        CreateStatusBar(2);
-        SetStatusBarPane(0);
-        const int stat_widths[] = { -1, 150 };
-        SetStatusWidths(2, stat_widths);
-
-        wxToolBar *toolbar =
-            new wxToolBar
-                (
-                    this, wxID_ANY,
-                    wxDefaultPosition, wxDefaultSize,
-                    wxTB_HORIZONTAL | wxTB_FLAT | wxTB_HORZ_TEXT
-                );
-
-        toolbar->AddTool(ID_PREV_PAGE, "Previous", BMP_PREV_PAGE,
-                         "Go to previous page (PgUp)");
-        toolbar->AddTool(ID_NEXT_PAGE, "Next", BMP_NEXT_PAGE,
-                         "Go to next page (PgDown)");
-        toolbar->AddTool(ID_ZOOM_IN, "Zoom in", BMP_ZOOM_IN,
-                         "Make the page larger (Ctrl +)");
-        toolbar->AddTool(ID_ZOOM_OUT, "Zoom out", BMP_ZOOM_OUT,
-                         "Make the page smaller (Ctrl -)");
-        toolbar->AddTool(ID_OFFSET_LEFT, "", BMP_OFFSET_LEFT,
-                         "Offset one of the pages to the left (Ctrl left)");
-        toolbar->AddTool(ID_OFFSET_RIGHT, "", BMP_OFFSET_RIGHT,
-                         "Offset one of the pages to the right (Ctrl right)");
-        toolbar->AddTool(ID_OFFSET_UP, "", BMP_OFFSET_UP,
-                         "Offset one of the pages up (Ctrl up)");
-        toolbar->AddTool(ID_OFFSET_DOWN, "", BMP_OFFSET_DOWN,
-                         "Offset one of the pages down (Ctrl down)");
-        toolbar->AddTool(ID_LEFT_DOC, "Left document", BMP_LEFT_DOC,
-                         "Show left document (Ctrl+<)");
-        toolbar->AddTool(ID_DIFF_DOC, "Diff document", BMP_DIFF_DOC,
-                         "Show diff document (Ctrl+d)");
-        toolbar->AddTool(ID_RIGHT_DOC, "Right document", BMP_RIGHT_DOC,
-                         "Show right document (Ctrl+>)");
-
-        toolbar->Realize();
-        SetToolBar(toolbar);
-
-        wxAcceleratorEntry accels[11];
-        accels[0].Set(wxACCEL_NORMAL, WXK_PAGEUP, ID_PREV_PAGE);
-        accels[1].Set(wxACCEL_NORMAL, WXK_PAGEDOWN, ID_NEXT_PAGE);
-        accels[2].Set(wxACCEL_CTRL, (int)'=', ID_ZOOM_IN);
-        accels[3].Set(wxACCEL_CTRL, (int)'-', ID_ZOOM_OUT);
-        accels[4].Set(wxACCEL_CTRL, WXK_LEFT, ID_OFFSET_LEFT);
-        accels[5].Set(wxACCEL_CTRL, WXK_RIGHT, ID_OFFSET_RIGHT);
-        accels[6].Set(wxACCEL_CTRL, WXK_UP, ID_OFFSET_UP);
-        accels[7].Set(wxACCEL_CTRL, WXK_DOWN, ID_OFFSET_DOWN);
-        accels[8].Set(wxACCEL_CTRL, (int)',',  ID_LEFT_DOC);
-        accels[9].Set(wxACCEL_CTRL, (int)'.', ID_RIGHT_DOC);
-        accels[10].Set(wxACCEL_CTRL, (int)'d', ID_DIFF_DOC);
-
-        wxAcceleratorTable accel_table(11, accels);
-        SetAcceleratorTable(accel_table);
-
-        m_gutter = new Gutter(this, ID_GUTTER);
-
-        m_viewer = new BitmapViewer(this);
-        m_viewer->AttachGutter(m_gutter);
-        m_viewer->SetFocus();
-
-        wxBoxSizer *sizer = new wxBoxSizer(wxHORIZONTAL);
-        sizer->Add(m_gutter, wxSizerFlags(0).Expand().Border(wxALL, 2));
-        sizer->Add(m_viewer, wxSizerFlags(1).Expand());
-        SetSizer(sizer);
-    }
+        { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+          "be verbose", NULL },
 
-    void SetDocs(PopplerDocument *doc1, PopplerDocument *doc2)
-    {
-        m_doc1 = doc1;
-        m_doc2 = doc2;
+        { "compare-ops", 0, 0, G_OPTION_ARG_NONE, &compare_ops,
+          "don't render pages that consist of identical drawing operations in both files", NULL },
 
-        wxProgressDialog progress("Comparing documents",
-                                  "Comparing documents...",
-                                  wxMax(poppler_document_get_n_pages(m_doc1),
-                                        poppler_document_get_n_pages(m_doc2)),
-                                  this,
-                                  wxPD_SMOOTH | wxPD_REMAINING_TIME);
+        { "band-height", 0, 0, G_OPTION_ARG_INT, &band_height,
+          "render and compare pages in horizontal bands of this many pixels to limit memory use at high resolutions", "N" },
 
+        { "prepass-dpi", 0, 0, G_OPTION_ARG_INT, &prepass_dpi,
+          "when only the exit code is needed, first compare pages at this low resolution and treat pages that differ there as different without rendering them at full resolution (e.g. 36); not used with tolerances or --min-region-size", "N" },
 
-        doc_compare(m_doc1, m_doc2, NULL, &m_pages, &progress, m_gutter);
+        { "cache-dir", 0, 0, G_OPTION_ARG_FILENAME, &cache_dir,
+          "cache rendered pages of file1.pdf in given directory, to speed up repeated comparisons with the same file", "DIR" },
 
-        progress.Pulse();
+        { "cache-size", 0, 0, G_OPTION_ARG_INT, &cache_size,
+          "maximum size of the cache in MB (default: " G_STRINGIFY(DEFAULT_CACHE_SIZE) ")", "N" },
 
-        m_diff_count = 0;
-        for ( std::vector<bool>::const_iterator i = m_pages.begin();
-              i != m_pages.end();
-              ++i )
-        {
-            if ( *i )
-                m_diff_count++;
-        }
+        { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+          "number of pages to compare in parallel (default: 1, 0 = number of CPUs)", "N" },
 
-        GoToPage(0);
+        { "max-memory", 0, 0, G_OPTION_ARG_INT, &max_memory,
+          "limit memory used by rendered pages to this many MB, comparing fewer pages in parallel, in bands or at lower resolution to stay under it (default: no limit outside of containers, half of the container's memory limit in them, without lowering the resolution)", "N" },
 
-        progress.Pulse();
+        { "stats", 0, 0, G_OPTION_ARG_NONE, &stats,
+          "print time spent in every phase of the comparison and memory use at the end", NULL },
 
-        m_viewer->SetBestFitZoom();
-        UpdateStatus();
+        { "view", 0, 0, G_OPTION_ARG_NONE, &view,
+          "view the differences in a window", NULL },
 
-        progress.Hide();
-    }
+        { "batch", 0, 0, G_OPTION_ARG_FILENAME, &batch_file,
+          "compare pairs of files listed in given file (or - for standard input), one \"[options] file1.pdf file2.pdf\" per line, printing one result line per pair; output options may only be given on the lines", "FILE" },
 
-    void GoToPage(int n)
-    {
-        m_cur_page = n;
-        m_gutter->SetSelection(n);
-        DoUpdatePage();
-    }
-
-private:
-    void DoUpdatePage()
-    {
-        wxBusyCursor wait;
-
-        const int pages1 = poppler_document_get_n_pages(m_doc1);
-        const int pages2 = poppler_document_get_n_pages(m_doc2);
-
-        PopplerPage *page1 = m_cur_page < pages1
-                             ? poppler_document_get_page(m_doc1, m_cur_page)
-                             : NULL;
-        PopplerPage *page2 = m_cur_page < pages2
-                             ? poppler_document_get_page(m_doc2, m_cur_page)
-                             : NULL;
-
-        cairo_surface_t *img1 = page1 ? render_page(page1) : NULL;
-        cairo_surface_t *img2 = page2 ? render_page(page2) : NULL;
-
-        wxImage thumbnail;
-        cairo_surface_t *diff = diff_images
-                                (
-                                    m_cur_page,
-                                    img1, img2,
-                                    m_offset.x, m_offset.y,
-                                    &thumbnail, Gutter::WIDTH
-                                );
-        // Render page according to the current display mode
-        switch ( m_display_mode )
-        {
-            case SHOW_LEFT_DOCUMENT:
-                // Try showing the left document; if not available, fall back
-                if ( img1 )
-                    m_viewer->Set(img1);
-                else if ( img2 )
-                    m_viewer->Set(img2);
-                else
-                    m_viewer->Set(NULL);
-                break;
-
-            case SHOW_RIGHT_DOCUMENT:
-                // Try showing the right document; if not available, fall back
-                if ( img2 )
-                    m_viewer->Set(img2);
-                else if ( img1 )
-                    m_viewer->Set(img1);
-                else
-                    m_viewer->Set(NULL);
-                break;
-
-            case SHOW_DIFF_DOCUMENT:
-            default:
-                m_viewer->Set(diff ? diff : img1);
-        }
-
-        // Always update the diff map. It will be all-white if there were
-        // no differences.
-        m_gutter->SetThumbnail(m_cur_page, thumbnail);
-
-        if ( img1 )
-            cairo_surface_destroy(img1);
-        if ( img2 )
-            cairo_surface_destroy(img2);
-        if ( diff )
-            cairo_surface_destroy(diff);
+        { NULL }
+    };
 
-        UpdateStatus();
-    }
+    GOptionContext *context = g_option_context_new("file1.pdf file2.pdf");
+    add_compare_entries(context, compare_args);
+    g_option_context_add_main_entries(context, entries, NULL);
 
-    void UpdateStatus()
+    GError *err = NULL;
+    if ( !g_option_context_parse(context, &argc, &argv, &err) )
     {
-        SetStatusText
-        (
-            wxString::Format
-            (
-                "Page %d of %d; %d of them %s different, this page %s",
-                m_cur_page + 1 /* humans prefer 1-based counting*/,
-                (int)m_pages.size(),
-                m_diff_count,
-                m_diff_count == 1 ? "is" : "are",
-                m_pages[m_cur_page] ? "differs" : "is unchanged"
-            ),
-            0
-        );
-
-        SetStatusText
-        (
-            wxString::Format
-            (
-                "%.1f%% [offset %d,%d]",
-                m_viewer->GetZoom() * 100.0,
-                m_offset.x, m_offset.y
-            ),
-            1
-        );
+        fprintf(stderr, "%s\n", err->message);
+        g_error_free(err);
+        g_option_context_free(context);
+        return 2;
     }
 
-    void OnSetPage(wxCommandEvent& event)
-    {
-        GoToPage(event.GetSelection());
-    }
+    const bool batch = batch_file != NULL;
 
-    void OnPrevPage(wxCommandEvent&)
+    if ( argc - 1 != (batch ? 0 : 2) )
     {
-        if ( m_cur_page > 0 )
-            GoToPage(m_cur_page - 1);
+        fprintf(stderr, batch ? "No files may be given with --batch.\n"
+                              : "Two files to compare must be given.\n");
+        gchar *help = g_option_context_get_help(context, TRUE, NULL);
+        fputs(help, stderr);
+        g_free(help);
+        g_option_context_free(context);
+        return 2;
     }
 
-    void OnNextPage(wxCommandEvent&)
-    {
-        if ( m_cur_page < m_pages.size() - 1 )
-            GoToPage(m_cur_page + 1);
-    }
+    g_option_context_free(context);
 
-    void OnUpdatePrevPage(wxUpdateUIEvent& event)
+    // every pair has its own outputs, given on its line
+    if ( batch &&
+         (compare_args.output_diff || compare_args.report ||
+          compare_args.output_png_dir || compare_args.output_mask_dir || view) )
     {
-        event.Enable(m_cur_page > 0);
+        fprintf(stderr, "--output-diff, --report, --output-png-dir, --output-mask-dir and --view can't be given with --batch, only on its lines.\n");
+        return 2;
     }
 
-    void OnUpdateNextPage(wxUpdateUIEvent& event)
-    {
-        event.Enable(m_cur_page < m_pages.size() - 1);
-    }
+    options.verbose = verbose;
 
-    void OnZoomIn(wxCommandEvent&)
+    if ( compare_ops )
     {
-        wxBusyCursor wait;
-        m_viewer->SetZoom(m_viewer->GetZoom() * ZOOM_FACTOR_STEP);
-        UpdateStatus();
+#if CAIRO_HAS_SCRIPT_SURFACE
+        options.compare_ops = true;
+#else
+        fprintf(stderr, "Warning: --compare-ops is not supported by this cairo build, ignoring it\n");
+#endif
     }
 
-    void OnZoomOut(wxCommandEvent&)
-    {
-        wxBusyCursor wait;
-        m_viewer->SetZoom(m_viewer->GetZoom() / ZOOM_FACTOR_STEP);
-        UpdateStatus();
-    }
+    if ( !apply_compare_args(compare_args, options) )
+        return 2;
 
-    void DoOffset(int x, int y)
-    {
-        m_offset.x += x;
-        m_offset.y += y;
-        DoUpdatePage();
+    options.band_height = band_height;
+    if (options.band_height < 0) {
+        fprintf(stderr, "Invalid band-height: %ld. Must be 0 (no bands) or more\n", options.band_height);
+        return 2;
     }
 
-    void ResetOffset()
-    {
-        m_offset = wxPoint(0, 0);
-        DoUpdatePage();
+    options.prepass_resolution = prepass_dpi;
+    if (options.prepass_resolution < 0 || options.prepass_resolution > options.resolution) {
+        fprintf(stderr, "Invalid prepass-dpi: %ld. Valid range is 1-%ld (0 disables the prepass)\n", options.prepass_resolution, options.resolution);
+        return 2;
     }
 
-    void OnShowLeftDocument(wxCommandEvent&)
-    {
-        m_display_mode = SHOW_LEFT_DOCUMENT;
-        DoUpdatePage();
+    options.jobs = jobs;
+    if (options.jobs < 0) {
+        fprintf(stderr, "Invalid jobs: %ld. Must be 0 or more\n", options.jobs);
+        return 2;
     }
-
-    void OnShowDiffDocument(wxCommandEvent&)
+    if (options.jobs == 0)
     {
-        m_display_mode = SHOW_DIFF_DOCUMENT;
-        DoUpdatePage();
+        options.jobs = g_get_num_processors();
+        const int cpu_limit = get_container_cpu_limit();
+        if ( cpu_limit > 0 && cpu_limit < options.jobs )
+            options.jobs = cpu_limit;
     }
 
-    void OnShowRightDocument(wxCommandEvent&)
+    if ( max_memory < 0 )
     {
-        m_display_mode = SHOW_RIGHT_DOCUMENT;
-        DoUpdatePage();
+        fprintf(stderr, "Invalid max-memory: %d. Must be 0 (no limit) or more\n", max_memory);
+        return 2;
     }
 
-    void OnOffsetLeft(wxCommandEvent&) { DoOffset(-1, 0); }
-    void OnOffsetRight(wxCommandEvent&) { DoOffset(1, 0); }
-    void OnOffsetUp(wxCommandEvent&) { DoOffset(0, -1); }
-    void OnOffsetDown(wxCommandEvent&) { DoOffset(0, 1); }
-
-    DECLARE_EVENT_TABLE()
-
-private:
-    BitmapViewer *m_viewer;
-    Gutter *m_gutter;
-    PopplerDocument *m_doc1, *m_doc2;
-    std::vector<bool> m_pages;
-    int m_diff_count;
-    int m_cur_page;
-    wxPoint m_offset;
-    DisplayMode m_display_mode;
-};
+    // leave the other half of container's memory to poppler, the diff
+    // output and the results kept for it
+    gint64 memory_limit = gint64(max_memory) * 1024 * 1024;
+    const gint64 container_limit = get_container_memory_limit() / 2;
+    if ( container_limit > 0 && (memory_limit == 0 || memory_limit > container_limit) )
+        memory_limit = container_limit;
 
-BEGIN_EVENT_TABLE(DiffFrame, wxFrame)
-    EVT_LISTBOX  (ID_GUTTER,       DiffFrame::OnSetPage)
-    EVT_TOOL     (ID_PREV_PAGE,    DiffFrame::OnPrevPage)
-    EVT_TOOL     (ID_NEXT_PAGE,    DiffFrame::OnNextPage)
-    EVT_UPDATE_UI(ID_PREV_PAGE,    DiffFrame::OnUpdatePrevPage)
-    EVT_UPDATE_UI(ID_NEXT_PAGE,    DiffFrame::OnUpdateNextPage)
-    EVT_TOOL     (ID_ZOOM_IN,      DiffFrame::OnZoomIn)
-    EVT_TOOL     (ID_ZOOM_OUT,     DiffFrame::OnZoomOut)
-    EVT_TOOL     (ID_OFFSET_LEFT,  DiffFrame::OnOffsetLeft)
-    EVT_TOOL     (ID_OFFSET_RIGHT, DiffFrame::OnOffsetRight)
-    EVT_TOOL     (ID_OFFSET_UP,    DiffFrame::OnOffsetUp)
-    EVT_TOOL     (ID_OFFSET_DOWN,  DiffFrame::OnOffsetDown)
-    EVT_TOOL     (ID_LEFT_DOC,     DiffFrame::OnShowLeftDocument)
-    EVT_TOOL     (ID_DIFF_DOC,     DiffFrame::OnShowDiffDocument)
-    EVT_TOOL     (ID_RIGHT_DOC,    DiffFrame::OnShowRightDocument)
-END_EVENT_TABLE()
-
-
-class DiffPdfApp : public wxApp
-{
-public:
-    DiffPdfApp() : m_tlw(NULL) {}
-
-    virtual bool OnInit()
+    MemoryBudget *memory_budget = NULL;
+    if ( memory_limit > 0 )
     {
-        m_tlw = new DiffFrame(m_title);
-
-        // like in LMI, maximize the window
-        m_tlw->Maximize();
-        m_tlw->Show();
-
-        // yield so that size changes above take effect immediately (and so we
-        // can query the window for its size)
-        Yield();
-
-        return true;
+        // only lower the resolution if the user asked for the limit, the
+        // container's one only limits concurrency and band height
+        memory_budget = new MemoryBudget(memory_limit, max_memory > 0);
+        options.memory_budget = memory_budget;
     }
 
-    void SetData(const wxString& file1, PopplerDocument *doc1,
-                 const wxString& file2, PopplerDocument *doc2)
+    RasterCache *raster_cache = NULL;
+    if ( cache_dir )
     {
-        m_title = wxString::Format("Differences between %s and %s", file1.c_str(), file2.c_str());
-        m_doc1 = doc1;
-        m_doc2 = doc2;
-    }
-
-protected:
-    virtual void OnEventLoopEnter(wxEventLoopBase *loop)
-    {
-        wxApp::OnEventLoopEnter(loop);
+        if ( cache_size < 1 )
+        {
+            fprintf(stderr, "Invalid cache-size: %d. Must be 1 or more\n", cache_size);
+            return 2;
+        }
 
-        if ( loop->IsMain() )
-            SetFrameDocs();
+        raster_cache = new RasterCache(cache_dir, guint64(cache_size) * 1024 * 1024);
+        options.raster_cache = raster_cache;
     }
 
-    void SetFrameDocs()
+    RunStats *run_stats = NULL;
+    if ( stats )
     {
-        wxASSERT( m_tlw );
-        wxASSERT( m_doc1 );
-        wxASSERT( m_doc2 );
-
-        m_tlw->SetDocs(m_doc1, m_doc2);
+        run_stats = new RunStats;
+        options.stats = run_stats;
     }
 
-private:
-    DiffFrame *m_tlw;
-    wxString m_title;
-    PopplerDocument *m_doc1, *m_doc2;
-};
-
-IMPLEMENT_APP_NO_MAIN(DiffPdfApp);
-
-
-// ------------------------------------------------------------------------
-// main()
-// ------------------------------------------------------------------------
-
-int main(int argc, char *argv[])
-{
-    wxAppConsole::CheckBuildOptions(WX_BUILD_OPTIONS_SIGNATURE, "diff-pdf");
-    wxInitializer wxinitializer(argc, argv);
+    int retval = 0;
 
-    static const wxCmdLineEntryDesc cmd_line_desc[] =
+    if ( batch )
     {
-        { wxCMD_LINE_SWITCH,
-                  "h", "help", "show this help message",
-                  wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP },
-
-        { wxCMD_LINE_SWITCH,
-                  "v", "verbose", "be verbose" },
-
-        { wxCMD_LINE_SWITCH,
-                  "s", "skip-identical", "only output pages with differences" },
-
-        { wxCMD_LINE_SWITCH,
-                  "m", "mark-differences", "additionally mark differences on left side" },
-
-        { wxCMD_LINE_SWITCH,
-                  "g", "grayscale", "only differences will be in color, unchanged parts will show as gray" },
-
-        { wxCMD_LINE_OPTION,
-                  NULL, "output-diff", "output differences to given PDF file",
-                  wxCMD_LINE_VAL_STRING },
-
-        { wxCMD_LINE_OPTION,
-                  NULL, "channel-tolerance", "consider channel values to be equal if within specified tolerance",
-                  wxCMD_LINE_VAL_NUMBER },
-
-        { wxCMD_LINE_OPTION,
-                  NULL, "per-page-pixel-tolerance", "total number of pixels allowed to be different per page before specifying the page is different",
-                  wxCMD_LINE_VAL_NUMBER },
-
-        { wxCMD_LINE_OPTION,
-                  NULL, "dpi", "rasterization resolution (default: " wxSTRINGIZE(DEFAULT_RESOLUTION) " dpi)",
-                  wxCMD_LINE_VAL_NUMBER },
-
-        { wxCMD_LINE_SWITCH,
-                  NULL, "view", "view the differences in a window" },
-
-        { wxCMD_LINE_PARAM,
-                  NULL, NULL, "file1.pdf", wxCMD_LINE_VAL_STRING },
-        { wxCMD_LINE_PARAM,
-                  NULL, NULL, "file2.pdf", wxCMD_LINE_VAL_STRING },
-
-        { wxCMD_LINE_NONE }
-    };
-
-    wxCmdLineParser parser(cmd_line_desc, argc, argv);
-
-    switch ( parser.Parse() )
+        retval = run_batch(batch_file, options);
+    }
+    else
     {
-        case -1: // --help
-            return 0;
-
-        case 0: // everything is ok; proceed
-            break;
+        const char *file1 = argv[1];
+        const char *file2 = argv[2];
 
-        default: // syntax error
+        if ( strcmp(file1, "-") == 0 && strcmp(file2, "-") == 0 )
+        {
+            fprintf(stderr, "Only one of the files can be read from standard input.\n");
             return 2;
-    }
-
-    if ( parser.Found("verbose") )
-        g_verbose = true;
+        }
 
-    if ( parser.Found("skip-identical") )
-        g_skip_identical = true;
+        const gint64 load_start = g_get_monotonic_time();
 
-    if ( parser.Found("mark-differences") )
-        g_mark_differences = true;
+        PopplerDocument *doc1 = open_document_file(file1, &err);
+        if ( !doc1 )
+        {
+            fprintf(stderr, "Error opening %s: %s\n", file1, err->message);
+            g_error_free(err);
+            return 3;
+        }
 
-    if ( parser.Found("grayscale") )
-        g_grayscale = true;
+        PopplerDocument *doc2 = open_document_file(file2, &err);
+        if ( !doc2 )
+        {
+            fprintf(stderr, "Error opening %s: %s\n", file2, err->message);
+            g_error_free(err);
+            return 3;
+        }
 
-    wxFileName file1(parser.GetParam(0));
-    wxFileName file2(parser.GetParam(1));
-    file1.MakeAbsolute();
-    file2.MakeAbsolute();
-    const wxString url1 = wxFileSystem::FileNameToURL(file1);
-    const wxString url2 = wxFileSystem::FileNameToURL(file2);
+        if ( options.stats )
+            options.stats->AddTime(PHASE_LOAD, g_get_monotonic_time() - load_start);
 
-    GError *err = NULL;
+        cache_document_pages(options, doc1);
 
-    PopplerDocument *doc1 = poppler_document_new_from_file(url1.utf8_str(), NULL, &err);
-    if ( !doc1 )
-    {
-        fprintf(stderr, "Error opening %s: %s\n", (const char*) parser.GetParam(0).c_str(), err->message);
-        g_error_free(err);
-        return 3;
-    }
+        if ( !compare_args.output_diff && !compare_args.report &&
+             !compare_args.output_png_dir && !compare_args.output_mask_dir &&
+             view )
+        {
+#ifdef DIFF_PDF_GUI
+            if ( options.align_pages )
+            {
+                fprintf(stderr, "Warning: --align-pages is not supported by the viewer, ignoring it\n");
+                options.align_pages = false;
+            }
+            retval = run_viewer(argc, argv, options, file1, doc1, file2, doc2);
+#else
+            fprintf(stderr, "This build of diff-pdf doesn't support --view.\n");
+            retval = 2;
+#endif
+        }
+        else
+        {
+            retval = doc_compare(options, doc1, doc2,
+                                 compare_args.output_diff, NULL, NULL,
+                                 compare_args.report,
+                                 compare_args.output_png_dir,
+                                 compare_args.output_mask_dir)
+                     ? 0 : 1;
+        }
 
-    PopplerDocument *doc2 = poppler_document_new_from_file(url2.utf8_str(), NULL, &err);
-    if ( !doc2 )
-    {
-        fprintf(stderr, "Error opening %s: %s\n", (const char*) parser.GetParam(1).c_str(), err->message);
-        g_error_free(err);
-        return 3;
+        g_object_unref(doc1);
+        g_object_unref(doc2);
     }
 
-    if ( parser.Found("per-page-pixel-tolerance", &g_per_page_pixel_tolerance) )
+    if ( raster_cache )
     {
-        if (g_per_page_pixel_tolerance < 0) {
-            fprintf(stderr, "Invalid per-page-pixel-tolerance: %ld. Must be 0 or more\n", g_per_page_pixel_tolerance);
-            return 2;
+        if ( options.verbose )
+        {
+            printf("cache: %d hits, %d misses, %d entries evicted\n",
+                   raster_cache->GetHits(),
+                   raster_cache->GetMisses(),
+                   raster_cache->GetEvictions());
         }
-    }
 
-    if ( parser.Found("channel-tolerance", &g_channel_tolerance) )
-    {
-        if (g_channel_tolerance < 0 || g_channel_tolerance > 255) {
-            fprintf(stderr, "Invalid channel-tolerance: %ld. Valid range is 0(default, exact matching)-255\n", g_channel_tolerance);
-            return 2;
-	}
-    }
-
-	if ( parser.Found("dpi", &g_resolution) )
-    {
-        if (g_resolution < 1 || g_resolution > 2400) {
-            fprintf(stderr, "Invalid dpi: %ld. Valid range is 1-2400 (default: %d)\n", g_resolution, DEFAULT_RESOLUTION);
-            return 2;
-	}
+        delete raster_cache;
     }
 
+    shutdown_worker_pool();
 
-    int retval = 0;
-
-    wxString pdf_file;
-    if ( parser.Found("output-diff", &pdf_file) )
+    if ( memory_budget )
     {
-        retval = doc_compare(doc1, doc2, pdf_file.utf8_str(), NULL) ? 0 : 1;
-    }
-    else if ( parser.Found("view") )
-    {
-        wxGetApp().SetData(parser.GetParam(0), doc1,
-                           parser.GetParam(1), doc2);
-        retval = wxEntry(argc, argv);
+        if ( options.verbose )
+        {
+            printf("memory limit: %" G_GINT64_FORMAT " MB, pages waited for memory %d times\n",
+                   memory_budget->GetLimit() / (1024 * 1024),
+                   memory_budget->GetWaits());
+        }
+
+        delete memory_budget;
     }
-    else
+
+    if ( run_stats )
     {
-        retval = doc_compare(doc1, doc2, NULL, NULL) ? 0 : 1;
+        run_stats->PrintSummary(stderr);
+        delete run_stats;
     }
 
-    g_object_unref(doc1);
-    g_object_unref(doc2);
+    g_free(cache_dir);
+    g_free(batch_file);
 
     // MinGW doesn't reliably flush streams on exit, so flush them explicitly:
     fflush(stdout);
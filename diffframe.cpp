@@ -0,0 +1,769 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "diffframe.h"
+#include "bmpviewer.h"
+#include "gutter.h"
+#include "membudget.h"
+#include "pagestore.h"
+#include "tilerender.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <wx/app.h>
+#include <wx/evtloop.h>
+#include <wx/frame.h>
+#include <wx/sizer.h>
+#include <wx/toolbar.h>
+#include <wx/artprov.h>
+#include <wx/thread.h>
+
+
+enum DisplayMode
+{
+    SHOW_DIFF_DOCUMENT,
+    SHOW_LEFT_DOCUMENT,
+    SHOW_RIGHT_DOCUMENT
+};
+
+
+const int ID_PREV_PAGE = wxNewId();
+const int ID_NEXT_PAGE = wxNewId();
+const int ID_ZOOM_IN = wxNewId();
+const int ID_ZOOM_OUT = wxNewId();
+const int ID_OFFSET_LEFT = wxNewId();
+const int ID_OFFSET_RIGHT = wxNewId();
+const int ID_OFFSET_UP = wxNewId();
+const int ID_OFFSET_DOWN = wxNewId();
+const int ID_GUTTER = wxNewId();
+const int ID_LEFT_DOC = wxNewId();
+const int ID_RIGHT_DOC = wxNewId();
+const int ID_DIFF_DOC = wxNewId();
+const int ID_NEXT_CHANGE = wxNewId();
+
+#define BMP_ARTPROV(id) wxArtProvider::GetBitmap(id, wxART_TOOLBAR)
+
+#define BMP_PREV_PAGE      BMP_ARTPROV(wxART_GO_BACK)
+#define BMP_NEXT_PAGE      BMP_ARTPROV(wxART_GO_FORWARD)
+#define BMP_NEXT_CHANGE    BMP_ARTPROV(wxART_FIND)
+
+#define BMP_OFFSET_LEFT    BMP_ARTPROV(wxART_GO_BACK)
+#define BMP_OFFSET_RIGHT   BMP_ARTPROV(wxART_GO_FORWARD)
+#define BMP_OFFSET_UP      BMP_ARTPROV(wxART_GO_UP)
+#define BMP_OFFSET_DOWN    BMP_ARTPROV(wxART_GO_DOWN)
+
+#define BMP_LEFT_DOC       BMP_ARTPROV(wxART_GO_BACK)
+#define BMP_RIGHT_DOC      BMP_ARTPROV(wxART_GO_FORWARD)
+#define BMP_DIFF_DOC       BMP_ARTPROV(wxART_REDO)
+
+#ifdef __WXGTK__
+    #define BMP_ZOOM_IN    BMP_ARTPROV("gtk-zoom-in")
+    #define BMP_ZOOM_OUT   BMP_ARTPROV("gtk-zoom-out")
+#else
+    #include "gtk-zoom-in.xpm"
+    #include "gtk-zoom-out.xpm"
+    #define BMP_ZOOM_IN    wxBitmap(gtk_zoom_in_xpm)
+    #define BMP_ZOOM_OUT   wxBitmap(gtk_zoom_out_xpm)
+#endif
+
+static const float ZOOM_FACTOR_STEP = 1.2f;
+
+// Maximum size of rendered pages kept in memory by the viewer, in MB; it's
+// limited to half of the memory budget if there is one
+#define VIEWER_PAGE_STORE_SIZE 1024
+
+// Number of threads rendering the visible part of the page
+#define TILE_RENDER_THREADS 2
+
+// Returns the size of the viewer's page store for given options, in bytes.
+static guint64 get_page_store_size(const DiffOptions& options)
+{
+    guint64 size = guint64(VIEWER_PAGE_STORE_SIZE) * 1024 * 1024;
+    if ( options.memory_budget )
+        size = std::min(size, guint64(options.memory_budget->GetLimit() / 2));
+    return size;
+}
+
+// Converts the thumbnail created by compare_images() to wxImage.
+static wxImage thumbnail_to_image(const Thumbnail& thumbnail)
+{
+    if ( !thumbnail.IsOk() )
+        return wxImage();
+
+    wxImage image(thumbnail.width, thumbnail.height, false);
+    memcpy(image.GetData(), &thumbnail.data[0], thumbnail.data.size());
+    return image;
+}
+
+
+// Scales clusters of differences found at a different resolution.
+static void scale_components(std::vector<DiffComponent>& components,
+                             double scale)
+{
+    for ( size_t i = 0; i < components.size(); i++ )
+    {
+        DiffComponent& c = components[i];
+        c.x = int(c.x * scale);
+        c.y = int(c.y * scale);
+        c.width = std::max(1, int(c.width * scale + 0.5));
+        c.height = std::max(1, int(c.height * scale + 0.5));
+    }
+}
+
+
+class DiffFrame;
+
+// Passes results of pages compared by worker threads to the frame.
+class ResultForwarder : public CompareObserver
+{
+public:
+    ResultForwarder(DiffFrame *frame) : m_frame(frame) {}
+
+    virtual bool WantsThumbnails() const { return true; }
+    virtual bool WantsImages() const { return true; }
+    virtual bool WantsComponents() const { return true; }
+
+    virtual void OnPageDone(int page, const PageResult& result);
+
+private:
+    DiffFrame *m_frame;
+};
+
+
+class DiffFrame : public wxFrame
+{
+public:
+    DiffFrame(const wxString& title, const DiffOptions& options)
+        : wxFrame(NULL, wxID_ANY, title),
+          m_options(options),
+          m_store(get_page_store_size(options)),
+          m_forwarder(this),
+          m_comparer(NULL),
+          m_tile_renderer(NULL)
+    {
+        m_cur_page = -1;
+        m_cur_component = -1;
+
+        CreateStatusBar(2);
+        SetStatusBarPane(0);
+        const int stat_widths[] = { -1, 150 };
+        SetStatusWidths(2, stat_widths);
+
+        wxToolBar *toolbar =
+            new wxToolBar
+                (
+                    this, wxID_ANY,
+                    wxDefaultPosition, wxDefaultSize,
+                    wxTB_HORIZONTAL | wxTB_FLAT | wxTB_HORZ_TEXT
+                );
+
+        toolbar->AddTool(ID_PREV_PAGE, "Previous", BMP_PREV_PAGE,
+                         "Go to previous page (PgUp)");
+        toolbar->AddTool(ID_NEXT_PAGE, "Next", BMP_NEXT_PAGE,
+                         "Go to next page (PgDown)");
+        toolbar->AddTool(ID_NEXT_CHANGE, "Next change", BMP_NEXT_CHANGE,
+                         "Go to next cluster of differences (F3)");
+        toolbar->AddTool(ID_ZOOM_IN, "Zoom in", BMP_ZOOM_IN,
+                         "Make the page larger (Ctrl +)");
+        toolbar->AddTool(ID_ZOOM_OUT, "Zoom out", BMP_ZOOM_OUT,
+                         "Make the page smaller (Ctrl -)");
+        toolbar->AddTool(ID_OFFSET_LEFT, "", BMP_OFFSET_LEFT,
+                         "Offset one of the pages to the left (Ctrl left)");
+        toolbar->AddTool(ID_OFFSET_RIGHT, "", BMP_OFFSET_RIGHT,
+                         "Offset one of the pages to the right (Ctrl right)");
+        toolbar->AddTool(ID_OFFSET_UP, "", BMP_OFFSET_UP,
+                         "Offset one of the pages up (Ctrl up)");
+        toolbar->AddTool(ID_OFFSET_DOWN, "", BMP_OFFSET_DOWN,
+                         "Offset one of the pages down (Ctrl down)");
+        toolbar->AddTool(ID_LEFT_DOC, "Left document", BMP_LEFT_DOC,
+                         "Show left document (Ctrl+<)");
+        toolbar->AddTool(ID_DIFF_DOC, "Diff document", BMP_DIFF_DOC,
+                         "Show diff document (Ctrl+d)");
+        toolbar->AddTool(ID_RIGHT_DOC, "Right document", BMP_RIGHT_DOC,
+                         "Show right document (Ctrl+>)");
+
+        toolbar->Realize();
+        SetToolBar(toolbar);
+
+        wxAcceleratorEntry accels[12];
+        accels[0].Set(wxACCEL_NORMAL, WXK_PAGEUP, ID_PREV_PAGE);
+        accels[1].Set(wxACCEL_NORMAL, WXK_PAGEDOWN, ID_NEXT_PAGE);
+        accels[2].Set(wxACCEL_CTRL, (int)'=', ID_ZOOM_IN);
+        accels[3].Set(wxACCEL_CTRL, (int)'-', ID_ZOOM_OUT);
+        accels[4].Set(wxACCEL_CTRL, WXK_LEFT, ID_OFFSET_LEFT);
+        accels[5].Set(wxACCEL_CTRL, WXK_RIGHT, ID_OFFSET_RIGHT);
+        accels[6].Set(wxACCEL_CTRL, WXK_UP, ID_OFFSET_UP);
+        accels[7].Set(wxACCEL_CTRL, WXK_DOWN, ID_OFFSET_DOWN);
+        accels[8].Set(wxACCEL_CTRL, (int)',',  ID_LEFT_DOC);
+        accels[9].Set(wxACCEL_CTRL, (int)'.', ID_RIGHT_DOC);
+        accels[10].Set(wxACCEL_CTRL, (int)'d', ID_DIFF_DOC);
+        accels[11].Set(wxACCEL_NORMAL, WXK_F3, ID_NEXT_CHANGE);
+
+        wxAcceleratorTable accel_table(12, accels);
+        SetAcceleratorTable(accel_table);
+
+        m_gutter = new Gutter(this, ID_GUTTER);
+
+        m_viewer = new BitmapViewer(this);
+        m_viewer->AttachGutter(m_gutter);
+        m_viewer->SetFocus();
+
+        wxBoxSizer *sizer = new wxBoxSizer(wxHORIZONTAL);
+        sizer->Add(m_gutter, wxSizerFlags(0).Expand().Border(wxALL, 2));
+        sizer->Add(m_viewer, wxSizerFlags(1).Expand());
+        SetSizer(sizer);
+    }
+
+    virtual ~DiffFrame()
+    {
+        // waits for the pages and tiles that are being worked on
+        delete m_comparer;
+        delete m_tile_renderer;
+    }
+
+    void SetDocs(PopplerDocument *doc1, PopplerDocument *doc2)
+    {
+        m_doc1 = doc1;
+        m_doc2 = doc2;
+
+        const int pages_total = wxMax(poppler_document_get_n_pages(m_doc1),
+                                      poppler_document_get_n_pages(m_doc2));
+
+        m_pages.assign(pages_total, false);
+        m_compared.assign(pages_total, false);
+        m_differs.assign(pages_total, false);
+        m_diff_known.assign(pages_total, false);
+        m_components.assign(pages_total, std::vector<DiffComponent>());
+        m_compared_count = 0;
+        m_diff_count = 0;
+        m_best_fit_pending = true;
+
+        m_gutter->SetPageCount(pages_total);
+
+        m_tile_renderer = new TileRenderer(m_options, m_doc1, m_doc2,
+                                           m_viewer, TILE_RENDER_THREADS);
+        m_viewer->SetRenderer(m_tile_renderer, m_options.resolution);
+
+        // Compare the documents in the background, so that the user can look
+        // at the pages that are done in the meantime.
+        m_comparer = new BackgroundCompare(m_options, m_doc1, m_doc2,
+                                           &m_forwarder);
+        if ( !m_comparer->Start() )
+        {
+            delete m_comparer;
+            m_comparer = NULL;
+
+            wxBusyCursor wait;
+            doc_compare(m_options, m_doc1, m_doc2, NULL, NULL, &m_forwarder);
+        }
+
+        GoToPage(0);
+    }
+
+    // Called in the main thread when a page is compared.
+    void OnPageCompared(int page, PageResult result)
+    {
+        m_gutter->SetPage(page,
+                          wxString::FromUTF8(result.label.c_str()),
+                          thumbnail_to_image(result.thumbnail),
+                          result.same);
+
+        m_components[page].swap(result.components);
+        // pages that didn't fit into the memory budget were compared at a
+        // lower resolution than the one shown
+        if ( result.resolution )
+            scale_components(m_components[page],
+                             double(m_options.resolution) / result.resolution);
+
+        // images rendered at lower resolution aren't kept, they are
+        // rendered again at the shown one when needed
+        if ( !result.resolution )
+        {
+            m_store.Put(page, PAGE_IMAGE_LEFT, result.image1);
+            m_store.Put(page, PAGE_IMAGE_RIGHT, result.image2);
+        }
+        // the outcome is only valid if the pages were compared at the offset
+        // being shown
+        if ( m_offset == wxPoint(result.offset_x, result.offset_y) )
+        {
+            m_diff_known[page] = true;
+            m_differs[page] = !result.same;
+        }
+
+        result.DestroyImages();
+
+        m_compared[page] = true;
+        m_compared_count++;
+        m_pages[page] = !result.same;
+        if ( !result.same )
+            m_diff_count++;
+
+        if ( page == m_cur_page )
+            DoUpdatePage();
+        else if ( m_cur_page != -1 )
+            UpdateStatus();
+    }
+
+    void GoToPage(int n)
+    {
+        m_cur_page = n;
+        m_cur_component = -1;
+        m_gutter->SetSelection(n);
+        DoUpdatePage();
+    }
+
+private:
+    // Returns rendered page of the document, from the page store if
+    // possible. The returned surface, if any, must be destroyed by the caller.
+    cairo_surface_t *GetPageImage(PopplerDocument *doc, PageImage which)
+    {
+        cairo_surface_t *img;
+        if ( m_store.Get(m_cur_page, which, &img) )
+            return img;
+
+        PopplerPage *page = get_document_page(doc, m_cur_page);
+        img = page ? render_page(m_options, page) : NULL;
+        if ( page )
+            g_object_unref(page);
+
+        m_store.Put(m_cur_page, which, img);
+        return img;
+    }
+
+    // Returns size of the page of the document at the options' resolution
+    // or wxDefaultSize if the document doesn't have the page.
+    wxSize GetPageSize(PopplerDocument *doc)
+    {
+        PopplerPage *page = get_document_page(doc, m_cur_page);
+        if ( !page )
+            return wxDefaultSize;
+
+        wxSize size;
+        get_page_size_px(page, m_options.resolution, &size.x, &size.y);
+        g_object_unref(page);
+        return size;
+    }
+
+    // Shows the current page. The whole pages are only rendered and compared
+    // if their diff isn't in the page store already; the viewer renders the
+    // visible part itself.
+    void DoUpdatePage()
+    {
+        if ( !m_compared[m_cur_page] )
+        {
+            // the page will be shown by OnPageCompared(), get it done first
+            if ( m_comparer )
+                m_comparer->Prioritize(m_cur_page);
+            UpdateStatus();
+            return;
+        }
+
+        // the viewer renders the image of differences itself, only whether
+        // the pages differ at the current offset is needed
+        if ( !m_diff_known[m_cur_page] )
+        {
+            wxBusyCursor wait;
+
+            cairo_surface_t *img1 = GetPageImage(m_doc1, PAGE_IMAGE_LEFT);
+            cairo_surface_t *img2 = GetPageImage(m_doc2, PAGE_IMAGE_RIGHT);
+
+            Thumbnail thumbnail;
+            const bool differs = compare_images
+                                 (
+                                     m_options,
+                                     img1, img2,
+                                     m_offset.x, m_offset.y,
+                                     &thumbnail, Gutter::WIDTH,
+                                     NULL, NULL, NULL, NULL, NULL,
+                                     &m_components[m_cur_page]
+                                 );
+            m_cur_component = -1;
+            m_diff_known[m_cur_page] = true;
+            m_differs[m_cur_page] = differs;
+
+            // Update the diff map whenever the diff changes. It will be
+            // all-white if there were no differences.
+            m_gutter->SetThumbnail(m_cur_page, thumbnail_to_image(thumbnail),
+                                   !differs);
+
+            if ( img1 )
+                cairo_surface_destroy(img1);
+            if ( img2 )
+                cairo_surface_destroy(img2);
+        }
+
+        const bool differs = m_differs[m_cur_page];
+
+        const wxSize size1 = GetPageSize(m_doc1);
+        const wxSize size2 = GetPageSize(m_doc2);
+
+        // Show page according to the current display mode; if the page is
+        // missing in the document, the renderer falls back to the other one
+        switch ( m_display_mode )
+        {
+            case SHOW_LEFT_DOCUMENT:
+                m_viewer->SetPage(m_cur_page, PAGE_IMAGE_LEFT,
+                                  size1 != wxDefaultSize ? size1 : size2,
+                                  m_offset);
+                break;
+
+            case SHOW_RIGHT_DOCUMENT:
+                m_viewer->SetPage(m_cur_page, PAGE_IMAGE_RIGHT,
+                                  size2 != wxDefaultSize ? size2 : size1,
+                                  m_offset);
+                break;
+
+            case SHOW_DIFF_DOCUMENT:
+            default:
+                m_viewer->SetPage(m_cur_page,
+                                  differs ? PAGE_IMAGE_DIFF : PAGE_IMAGE_LEFT,
+                                  wxSize(wxMax(size1.x, size2.x),
+                                         wxMax(size1.y, size2.y)),
+                                  m_offset);
+        }
+
+        if ( m_best_fit_pending )
+        {
+            m_viewer->SetBestFitZoom();
+            m_best_fit_pending = false;
+        }
+
+        UpdateStatus();
+    }
+
+    void UpdateStatus()
+    {
+        wxString status = wxString::Format
+                          (
+                              "Page %d of %d; ",
+                              m_cur_page + 1 /* humans prefer 1-based counting*/,
+                              (int)m_pages.size()
+                          );
+
+        if ( m_compared_count < (int)m_pages.size() )
+        {
+            status += wxString::Format
+                      (
+                          "%d compared so far, %d of them %s different",
+                          m_compared_count,
+                          m_diff_count,
+                          m_diff_count == 1 ? "is" : "are"
+                      );
+        }
+        else
+        {
+            status += wxString::Format
+                      (
+                          "%d of them %s different",
+                          m_diff_count,
+                          m_diff_count == 1 ? "is" : "are"
+                      );
+        }
+
+        if ( !m_compared[m_cur_page] )
+            status += ", this page is being compared";
+        else if ( m_pages[m_cur_page] )
+            status += ", this page differs";
+        else
+            status += ", this page is unchanged";
+
+        if ( m_cur_component != -1 )
+        {
+            status += wxString::Format
+                      (
+                          " (change %d of %d)",
+                          m_cur_component + 1,
+                          (int)m_components[m_cur_page].size()
+                      );
+        }
+
+        SetStatusText(status, 0);
+
+        SetStatusText
+        (
+            wxString::Format
+            (
+                "%.1f%% [offset %d,%d]",
+                m_viewer->GetZoom() * 100.0,
+                m_offset.x, m_offset.y
+            ),
+            1
+        );
+    }
+
+    void OnSetPage(wxCommandEvent& event)
+    {
+        GoToPage(event.GetSelection());
+    }
+
+    void OnPrevPage(wxCommandEvent&)
+    {
+        if ( m_cur_page > 0 )
+            GoToPage(m_cur_page - 1);
+    }
+
+    void OnNextPage(wxCommandEvent&)
+    {
+        if ( m_cur_page < m_pages.size() - 1 )
+            GoToPage(m_cur_page + 1);
+    }
+
+    // Shows the next cluster of differences of the current page or the first
+    // one of the next compared page that has any.
+    void OnNextChange(wxCommandEvent&)
+    {
+        if ( m_cur_component + 1 < (int)m_components[m_cur_page].size() )
+        {
+            ShowComponent(m_cur_component + 1);
+            return;
+        }
+
+        for ( int page = m_cur_page + 1; page < (int)m_pages.size(); page++ )
+        {
+            if ( m_compared[page] && !m_components[page].empty() )
+            {
+                GoToPage(page);
+                // showing the page may have compared it again
+                if ( !m_components[page].empty() )
+                    ShowComponent(0);
+                return;
+            }
+        }
+    }
+
+    void ShowComponent(int n)
+    {
+        const DiffComponent& c = m_components[m_cur_page][n];
+        m_cur_component = n;
+        m_viewer->ScrollToRect(wxRect(c.x, c.y, c.width, c.height));
+        UpdateStatus();
+    }
+
+    void OnUpdatePrevPage(wxUpdateUIEvent& event)
+    {
+        event.Enable(m_cur_page > 0);
+    }
+
+    void OnUpdateNextPage(wxUpdateUIEvent& event)
+    {
+        event.Enable(m_cur_page < m_pages.size() - 1);
+    }
+
+    void OnZoomIn(wxCommandEvent&)
+    {
+        m_viewer->SetZoom(m_viewer->GetZoom() * ZOOM_FACTOR_STEP);
+        UpdateStatus();
+    }
+
+    void OnZoomOut(wxCommandEvent&)
+    {
+        m_viewer->SetZoom(m_viewer->GetZoom() / ZOOM_FACTOR_STEP);
+        UpdateStatus();
+    }
+
+    void DoOffset(int x, int y)
+    {
+        m_offset.x += x;
+        m_offset.y += y;
+
+        // all pages were compared at the old offset
+        m_diff_known.assign(m_diff_known.size(), false);
+        DoUpdatePage();
+    }
+
+    void ResetOffset()
+    {
+        m_offset = wxPoint(0, 0);
+        m_diff_known.assign(m_diff_known.size(), false);
+        DoUpdatePage();
+    }
+
+    void OnShowLeftDocument(wxCommandEvent&)
+    {
+        m_display_mode = SHOW_LEFT_DOCUMENT;
+        DoUpdatePage();
+    }
+
+    void OnShowDiffDocument(wxCommandEvent&)
+    {
+        m_display_mode = SHOW_DIFF_DOCUMENT;
+        DoUpdatePage();
+    }
+
+    void OnShowRightDocument(wxCommandEvent&)
+    {
+        m_display_mode = SHOW_RIGHT_DOCUMENT;
+        DoUpdatePage();
+    }
+
+    void OnOffsetLeft(wxCommandEvent&) { DoOffset(-1, 0); }
+    void OnOffsetRight(wxCommandEvent&) { DoOffset(1, 0); }
+    void OnOffsetUp(wxCommandEvent&) { DoOffset(0, -1); }
+    void OnOffsetDown(wxCommandEvent&) { DoOffset(0, 1); }
+
+    // Compresses the stored pages when there's nothing else to do, one at a
+    // time, so that the viewer stays responsive while pages are compared.
+    void OnIdle(wxIdleEvent& event)
+    {
+        if ( m_store.Trim(m_cur_page) )
+            event.RequestMore();
+    }
+
+    DECLARE_EVENT_TABLE()
+
+private:
+    const DiffOptions m_options;
+    BitmapViewer *m_viewer;
+    Gutter *m_gutter;
+    PopplerDocument *m_doc1, *m_doc2;
+    // rendered pages
+    PageStore m_store;
+    ResultForwarder m_forwarder;
+    // comparison running in the background, NULL when not used
+    BackgroundCompare *m_comparer;
+    TileRenderer *m_tile_renderer;
+    // which pages differ, valid for compared pages only
+    std::vector<bool> m_pages;
+    std::vector<bool> m_compared;
+    // which pages differ at the current offset, valid if m_diff_known is set
+    std::vector<bool> m_differs;
+    std::vector<bool> m_diff_known;
+    // clusters of differences of every compared page and the one shown
+    // last on the current page, or -1
+    std::vector< std::vector<DiffComponent> > m_components;
+    int m_cur_component;
+    int m_compared_count;
+    int m_diff_count;
+    // zoom to fit the first page when it's shown
+    bool m_best_fit_pending;
+    int m_cur_page;
+    wxPoint m_offset;
+    DisplayMode m_display_mode;
+};
+
+BEGIN_EVENT_TABLE(DiffFrame, wxFrame)
+    EVT_LISTBOX  (ID_GUTTER,       DiffFrame::OnSetPage)
+    EVT_TOOL     (ID_PREV_PAGE,    DiffFrame::OnPrevPage)
+    EVT_TOOL     (ID_NEXT_PAGE,    DiffFrame::OnNextPage)
+    EVT_UPDATE_UI(ID_PREV_PAGE,    DiffFrame::OnUpdatePrevPage)
+    EVT_UPDATE_UI(ID_NEXT_PAGE,    DiffFrame::OnUpdateNextPage)
+    EVT_TOOL     (ID_NEXT_CHANGE,  DiffFrame::OnNextChange)
+    EVT_TOOL     (ID_ZOOM_IN,      DiffFrame::OnZoomIn)
+    EVT_TOOL     (ID_ZOOM_OUT,     DiffFrame::OnZoomOut)
+    EVT_TOOL     (ID_OFFSET_LEFT,  DiffFrame::OnOffsetLeft)
+    EVT_TOOL     (ID_OFFSET_RIGHT, DiffFrame::OnOffsetRight)
+    EVT_TOOL     (ID_OFFSET_UP,    DiffFrame::OnOffsetUp)
+    EVT_TOOL     (ID_OFFSET_DOWN,  DiffFrame::OnOffsetDown)
+    EVT_TOOL     (ID_LEFT_DOC,     DiffFrame::OnShowLeftDocument)
+    EVT_TOOL     (ID_DIFF_DOC,     DiffFrame::OnShowDiffDocument)
+    EVT_TOOL     (ID_RIGHT_DOC,    DiffFrame::OnShowRightDocument)
+    EVT_IDLE     (DiffFrame::OnIdle)
+END_EVENT_TABLE()
+
+
+class DiffPdfApp : public wxApp
+{
+public:
+    DiffPdfApp() : m_tlw(NULL) {}
+
+    virtual bool OnInit()
+    {
+        m_tlw = new DiffFrame(m_title, m_options);
+
+        // like in LMI, maximize the window
+        m_tlw->Maximize();
+        m_tlw->Show();
+
+        // yield so that size changes above take effect immediately (and so we
+        // can query the window for its size)
+        Yield();
+
+        return true;
+    }
+
+    void SetData(const DiffOptions& options,
+                 const wxString& file1, PopplerDocument *doc1,
+                 const wxString& file2, PopplerDocument *doc2)
+    {
+        m_options = options;
+        m_title = wxString::Format("Differences between %s and %s", file1.c_str(), file2.c_str());
+        m_doc1 = doc1;
+        m_doc2 = doc2;
+    }
+
+protected:
+    virtual void OnEventLoopEnter(wxEventLoopBase *loop)
+    {
+        wxApp::OnEventLoopEnter(loop);
+
+        if ( loop->IsMain() )
+            SetFrameDocs();
+    }
+
+    void SetFrameDocs()
+    {
+        wxASSERT( m_tlw );
+        wxASSERT( m_doc1 );
+        wxASSERT( m_doc2 );
+
+        m_tlw->SetDocs(m_doc1, m_doc2);
+    }
+
+private:
+    DiffFrame *m_tlw;
+    DiffOptions m_options;
+    wxString m_title;
+    PopplerDocument *m_doc1, *m_doc2;
+};
+
+IMPLEMENT_APP_NO_MAIN(DiffPdfApp);
+
+
+void ResultForwarder::OnPageDone(int page, const PageResult& result)
+{
+    // the result's images are destroyed when this function returns, so the
+    // frame gets its own references to them
+    PageResult copy(result);
+    if ( copy.diff )
+        cairo_surface_reference(copy.diff);
+    if ( copy.image1 )
+        cairo_surface_reference(copy.image1);
+    if ( copy.image2 )
+        cairo_surface_reference(copy.image2);
+
+    if ( wxIsMainThread() )
+        m_frame->OnPageCompared(page, copy);
+    else
+        m_frame->CallAfter(&DiffFrame::OnPageCompared, page, copy);
+}
+
+
+int run_viewer(int argc, char *argv[], const DiffOptions& options,
+               const char *file1, PopplerDocument *doc1,
+               const char *file2, PopplerDocument *doc2)
+{
+    wxAppConsole::CheckBuildOptions(WX_BUILD_OPTIONS_SIGNATURE, "diff-pdf");
+    wxInitializer wxinitializer(argc, argv);
+
+    wxGetApp().SetData(options, file1, doc1, file2, doc2);
+    return wxEntry(argc, argv);
+}
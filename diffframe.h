@@ -0,0 +1,31 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _diffframe_h_
+#define _diffframe_h_
+
+#include "diffpdf.h"
+
+// Shows differences between the two documents in a window and returns when
+// it is closed. Returns the program's exit code.
+int run_viewer(int argc, char *argv[], const DiffOptions& options,
+               const char *file1, PopplerDocument *doc1,
+               const char *file2, PopplerDocument *doc2);
+
+#endif // _diffframe_h_
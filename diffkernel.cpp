@@ -0,0 +1,394 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "diffkernel.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+// The vectorized kernels are compiled with per-function target attributes,
+// so that the rest of the program doesn't need to be built for a newer CPU,
+// and chosen at runtime.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define HAVE_X86_KERNELS
+    #include <immintrin.h>
+#endif
+
+
+DiffStats::DiffStats()
+{
+    memset(histogram, 0, sizeof(histogram));
+    max_delta = 0;
+    x1 = y1 = 0;
+    x2 = y2 = -1;
+}
+
+
+static inline int channel_delta(unsigned char a, unsigned char b)
+{
+    return a > b ? a - b : b - a;
+}
+
+
+// Extends the bounding box of differences by pixels x1..x2 of row y.
+static inline void add_to_bounding_box(DiffStats& stats, int x1, int x2, int y)
+{
+    if ( !stats.HasBoundingBox() )
+    {
+        stats.x1 = x1;
+        stats.x2 = x2;
+        stats.y1 = stats.y2 = y;
+        return;
+    }
+
+    if ( x1 < stats.x1 )
+        stats.x1 = x1;
+    if ( x2 > stats.x2 )
+        stats.x2 = x2;
+    if ( y < stats.y1 )
+        stats.y1 = y;
+    if ( y > stats.y2 )
+        stats.y2 = y;
+}
+
+
+// Plain C++ implementation of all kernels, also used for the pixels left
+// over by the vectorized ones. If stats is not NULL, the row's differences
+// are added to it; x0 and y are the coordinates of the row's first pixel.
+static long diff_row_generic(unsigned char *row1, const unsigned char *row2,
+                             int width, int tolerance, bool copy_channel,
+                             DiffStats *stats, int x0, int y)
+{
+    long count = 0;
+    int first = -1, last = -1;
+
+    for ( int x = 0; x < width; x++ )
+    {
+        unsigned char *p1 = row1 + 4 * x;
+        const unsigned char *p2 = row2 + 4 * x;
+
+        if ( diff_pixel(p1, p2, tolerance) )
+        {
+            count++;
+            if ( first == -1 )
+                first = x;
+            last = x;
+        }
+
+        if ( stats )
+        {
+            for ( int c = 0; c < 3; c++ )
+            {
+                const int d = channel_delta(p1[c], p2[c]);
+                stats->histogram[d]++;
+                if ( d > stats->max_delta )
+                    stats->max_delta = d;
+            }
+        }
+
+        if ( copy_channel )
+            p1[2] = p2[2];
+    }
+
+    if ( stats && first != -1 )
+        add_to_bounding_box(*stats, x0 + first, x0 + last, y);
+
+    return count;
+}
+
+
+long diff_row_scalar(unsigned char *row1, const unsigned char *row2, int width,
+                     int tolerance, bool copy_channel)
+{
+    return diff_row_generic(row1, row2, width, tolerance, copy_channel,
+                            NULL, 0, 0);
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+// Channel differences are computed as saturated |a-b| = (a -sat b) | (b -sat a)
+// and compared with the tolerance by subtracting it, again with saturation:
+// the result is non-zero only for channels that differ by more than that.
+// The unused 4th byte gets tolerance of 255, so it never counts.
+//
+// Statistics are collected in the same pass: blocks of pixels that are
+// identical only add to the histogram's first bin, the channel differences
+// of the others are added to it one by one, and the positions of differing
+// pixels come from the mask of pixels that are the same.
+static inline int tolerance_mask(int tolerance)
+{
+    return int(0xFF000000u | (unsigned(tolerance) * 0x010101u));
+}
+
+static inline int max_byte(const unsigned char *bytes, int n)
+{
+    int max = 0;
+    for ( int i = 0; i < n; i++ )
+    {
+        if ( bytes[i] > max )
+            max = bytes[i];
+    }
+    return max;
+}
+
+// Adds channel differences of n pixels, stored in 'bytes', to the histogram.
+static inline void add_to_histogram(DiffStats& stats,
+                                    const unsigned char *bytes, int n)
+{
+    for ( int i = 0; i < 4 * n; i += 4 )
+    {
+        stats.histogram[bytes[i + 0]]++;
+        stats.histogram[bytes[i + 1]]++;
+        stats.histogram[bytes[i + 2]]++;
+    }
+}
+
+__attribute__((target("sse2")))
+static long diff_row_sse2(unsigned char *row1, const unsigned char *row2,
+                          int width, int tolerance, bool copy_channel,
+                          DiffStats *stats, int x0, int y)
+{
+    const __m128i tol = _mm_set1_epi32(tolerance_mask(tolerance));
+    const __m128i channel = _mm_set1_epi32(0x00FF0000);
+    const __m128i colors = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i max = zero;
+
+    long count = 0;
+    int first = -1, last = -1;
+    int x = 0;
+
+    for ( ; x + 4 <= width; x += 4 )
+    {
+        __m128i *p1 = (__m128i*)(row1 + 4 * x);
+        const __m128i a = _mm_loadu_si128(p1);
+        const __m128i b = _mm_loadu_si128((const __m128i*)(row2 + 4 * x));
+
+        __m128i d = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+        if ( stats )
+        {
+            const __m128i cd = _mm_and_si128(d, colors);
+            max = _mm_max_epu8(max, cd);
+            if ( _mm_movemask_epi8(_mm_cmpeq_epi8(cd, zero)) == 0xFFFF )
+            {
+                stats->histogram[0] += 3 * 4;
+            }
+            else
+            {
+                unsigned char bytes[16];
+                _mm_storeu_si128((__m128i*)bytes, cd);
+                add_to_histogram(*stats, bytes, 4);
+            }
+        }
+        d = _mm_subs_epu8(d, tol);
+
+        // 1 bit for every pixel that is the same
+        const int same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(d, zero)));
+        count += 4 - __builtin_popcount(same);
+
+        if ( stats && same != 0xF )
+        {
+            const int differ = ~same & 0xF;
+            if ( first == -1 )
+                first = x + __builtin_ctz(differ);
+            last = x + 31 - __builtin_clz(differ);
+        }
+
+        if ( copy_channel )
+        {
+            _mm_storeu_si128(p1, _mm_or_si128(_mm_andnot_si128(channel, a),
+                                              _mm_and_si128(channel, b)));
+        }
+    }
+
+    count += diff_row_generic(row1 + 4 * x, row2 + 4 * x, width - x,
+                              tolerance, copy_channel, stats, x0 + x, y);
+
+    if ( stats )
+    {
+        unsigned char bytes[16];
+        _mm_storeu_si128((__m128i*)bytes, max);
+        stats->max_delta = std::max(stats->max_delta, max_byte(bytes, 16));
+
+        if ( first != -1 )
+            add_to_bounding_box(*stats, x0 + first, x0 + last, y);
+    }
+
+    return count;
+}
+
+__attribute__((target("avx2")))
+static long diff_row_avx2(unsigned char *row1, const unsigned char *row2,
+                          int width, int tolerance, bool copy_channel,
+                          DiffStats *stats, int x0, int y)
+{
+    const __m256i tol = _mm256_set1_epi32(tolerance_mask(tolerance));
+    const __m256i channel = _mm256_set1_epi32(0x00FF0000);
+    const __m256i colors = _mm256_set1_epi32(0x00FFFFFF);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i max = zero;
+
+    long count = 0;
+    int first = -1, last = -1;
+    int x = 0;
+
+    for ( ; x + 8 <= width; x += 8 )
+    {
+        __m256i *p1 = (__m256i*)(row1 + 4 * x);
+        const __m256i a = _mm256_loadu_si256(p1);
+        const __m256i b = _mm256_loadu_si256((const __m256i*)(row2 + 4 * x));
+
+        __m256i d = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+        if ( stats )
+        {
+            const __m256i cd = _mm256_and_si256(d, colors);
+            max = _mm256_max_epu8(max, cd);
+            if ( _mm256_testz_si256(cd, cd) )
+            {
+                stats->histogram[0] += 3 * 8;
+            }
+            else
+            {
+                unsigned char bytes[32];
+                _mm256_storeu_si256((__m256i*)bytes, cd);
+                add_to_histogram(*stats, bytes, 8);
+            }
+        }
+        d = _mm256_subs_epu8(d, tol);
+
+        const int same = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(d, zero)));
+        count += 8 - __builtin_popcount(same);
+
+        if ( stats && same != 0xFF )
+        {
+            const int differ = ~same & 0xFF;
+            if ( first == -1 )
+                first = x + __builtin_ctz(differ);
+            last = x + 31 - __builtin_clz(differ);
+        }
+
+        if ( copy_channel )
+            _mm256_storeu_si256(p1, _mm256_blendv_epi8(a, b, channel));
+    }
+
+    count += diff_row_sse2(row1 + 4 * x, row2 + 4 * x, width - x,
+                           tolerance, copy_channel, stats, x0 + x, y);
+
+    if ( stats )
+    {
+        unsigned char bytes[32];
+        _mm256_storeu_si256((__m256i*)bytes, max);
+        stats->max_delta = std::max(stats->max_delta, max_byte(bytes, 32));
+
+        if ( first != -1 )
+            add_to_bounding_box(*stats, x0 + first, x0 + last, y);
+    }
+
+    return count;
+}
+
+#endif // HAVE_X86_KERNELS
+
+
+typedef long (*diff_row_func)(unsigned char*, const unsigned char*, int, int, bool,
+                              DiffStats*, int, int);
+
+struct DiffKernel
+{
+    diff_row_func func;
+    const char *name;
+};
+
+// Returns all kernels supported by the CPU, from the slowest to the fastest.
+static std::vector<DiffKernel> find_kernels()
+{
+    std::vector<DiffKernel> kernels;
+
+    DiffKernel k = { diff_row_generic, "scalar" };
+    kernels.push_back(k);
+
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("sse2") )
+    {
+        k.func = diff_row_sse2;
+        k.name = "sse2";
+        kernels.push_back(k);
+    }
+    if ( __builtin_cpu_supports("avx2") )
+    {
+        k.func = diff_row_avx2;
+        k.name = "avx2";
+        kernels.push_back(k);
+    }
+#endif
+
+    return kernels;
+}
+
+static const std::vector<DiffKernel>& get_kernels()
+{
+    static const std::vector<DiffKernel> kernels = find_kernels();
+    return kernels;
+}
+
+static const DiffKernel& get_kernel()
+{
+    return get_kernels().back();
+}
+
+
+long diff_row(unsigned char *row1, const unsigned char *row2, int width,
+              int tolerance, bool copy_channel,
+              DiffStats *stats, int x, int y)
+{
+    return get_kernel().func(row1, row2, width, tolerance, copy_channel,
+                             stats, x, y);
+}
+
+
+const char *diff_row_kernel_name()
+{
+    return get_kernel().name;
+}
+
+
+int diff_row_kernel_count()
+{
+    return (int)get_kernels().size();
+}
+
+
+const char *diff_row_kernel_name_at(int kernel)
+{
+    return get_kernels()[kernel].name;
+}
+
+
+long diff_row_with_kernel(int kernel,
+                          unsigned char *row1, const unsigned char *row2,
+                          int width, int tolerance, bool copy_channel,
+                          DiffStats *stats, int x, int y)
+{
+    return get_kernels()[kernel].func(row1, row2, width, tolerance,
+                                      copy_channel, stats, x, y);
+}
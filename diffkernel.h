@@ -0,0 +1,92 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _diffkernel_h_
+#define _diffkernel_h_
+
+#include <stddef.h>
+
+// Low-level pixel comparison routines used by diff_images(). They operate on
+// rows of CAIRO_FORMAT_RGB24 pixels, i.e. 4 bytes per pixel, the 4th of
+// which is unused.
+
+// Returns true if any color channel of the two pixels differs by more than
+// 'tolerance'.
+inline bool diff_pixel(const unsigned char *p1, const unsigned char *p2,
+                       int tolerance)
+{
+    return p1[0] > p2[0] + tolerance || p1[0] < p2[0] - tolerance
+        || p1[1] > p2[1] + tolerance || p1[1] < p2[1] - tolerance
+        || p1[2] > p2[2] + tolerance || p1[2] < p2[2] - tolerance;
+}
+
+// Statistics about differences between two images, collected by diff_row().
+struct DiffStats
+{
+    DiffStats();
+
+    // number of color channel values with given absolute difference
+    long histogram[256];
+
+    // largest absolute difference of a channel
+    int max_delta;
+
+    // bounding box of differing pixels, inclusive; x2 < x1 if there are none
+    int x1, y1, x2, y2;
+
+    bool HasBoundingBox() const { return x2 >= x1; }
+};
+
+// Compares 'width' pixels of row1 and row2 and returns the number of pixels
+// that differ (see diff_pixel()). If copy_channel is true, the 3rd byte of
+// every pixel in row1 is replaced with the one from row2 (this is how the
+// diff image visualizes differences).
+//
+// If stats is not NULL, the row's differences are added to it; x and y are
+// the coordinates of the row's first pixel in the image.
+//
+// The fastest implementation supported by the CPU is used; all of them give
+// identical results, which bench/diff-kernel-bench checks.
+long diff_row(unsigned char *row1, const unsigned char *row2, int width,
+              int tolerance, bool copy_channel,
+              DiffStats *stats = NULL, int x = 0, int y = 0);
+
+// Plain C++ implementation of diff_row() without statistics, used as the
+// reference.
+long diff_row_scalar(unsigned char *row1, const unsigned char *row2, int width,
+                     int tolerance, bool copy_channel);
+
+// Returns the name of the implementation used by diff_row().
+const char *diff_row_kernel_name();
+
+// Returns the number of implementations of diff_row() supported by the CPU,
+// which can be checked against each other. The first one is the plain C++
+// one, the last one is used by diff_row().
+int diff_row_kernel_count();
+
+// Returns the name of given implementation.
+const char *diff_row_kernel_name_at(int kernel);
+
+// Calls diff_row() with given implementation.
+long diff_row_with_kernel(int kernel,
+                          unsigned char *row1, const unsigned char *row2,
+                          int width, int tolerance, bool copy_channel,
+                          DiffStats *stats = NULL, int x = 0, int y = 0);
+
+#endif // _diffkernel_h_
@@ -0,0 +1,119 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "diffmask.h"
+
+
+// Sets pixel x of a row of CAIRO_FORMAT_A1 image.
+static inline void set_mask_pixel(unsigned char *row, int x)
+{
+    // pixels are stored in 32-bit words, starting with their least
+    // significant bit on little endian machines and the most significant
+    // one on big endian ones
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+    row[x / 8] |= 1 << (x % 8);
+#else
+    row[x / 8] |= 0x80 >> (x % 8);
+#endif
+}
+
+
+void DiffMask::Create(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+    m_rows.assign(height + 1, 0);
+    m_runs.clear();
+    m_last_row = -1;
+    m_pixel_count = 0;
+}
+
+
+void DiffMask::AddRun(int x, int y, int length)
+{
+    if ( y != m_last_row )
+    {
+        // rows in between don't have any runs
+        for ( int row = m_last_row + 1; row <= y; row++ )
+            m_rows[row] = (guint32)m_runs.size();
+        m_last_row = y;
+    }
+    else if ( m_runs[m_runs.size() - 2] + m_runs.back() == x )
+    {
+        // adjacent runs are merged
+        m_runs.back() += length;
+        m_pixel_count += length;
+        return;
+    }
+
+    m_runs.push_back(x);
+    m_runs.push_back(length);
+    m_pixel_count += length;
+}
+
+
+void DiffMask::Finish()
+{
+    for ( int row = m_last_row + 1; row <= m_height; row++ )
+        m_rows[row] = (guint32)m_runs.size();
+    m_last_row = m_height;
+}
+
+
+bool DiffMask::RowHasPixels(int y, int x1, int x2) const
+{
+    if ( x1 >= x2 )
+        return false;
+
+    for ( guint32 i = m_rows[y]; i < m_rows[y + 1]; i += 2 )
+    {
+        const int start = m_runs[i];
+        const int end = start + m_runs[i + 1];
+        if ( start < x2 && end > x1 )
+            return true;
+    }
+
+    return false;
+}
+
+
+cairo_surface_t *DiffMask::CreateSurface() const
+{
+    cairo_surface_t *surface =
+        cairo_image_surface_create(CAIRO_FORMAT_A1, m_width, m_height);
+    cairo_surface_flush(surface);
+
+    unsigned char *data = cairo_image_surface_get_data(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+
+    for ( int y = 0; y < m_height; y++ )
+    {
+        unsigned char *row = data + y * stride;
+        for ( guint32 i = m_rows[y]; i < m_rows[y + 1]; i += 2 )
+        {
+            const int end = m_runs[i] + m_runs[i + 1];
+            for ( int x = m_runs[i]; x < end; x++ )
+                set_mask_pixel(row, x);
+        }
+    }
+
+    cairo_surface_mark_dirty(surface);
+    return surface;
+}
+
@@ -0,0 +1,88 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _diffmask_h_
+#define _diffmask_h_
+
+#include <vector>
+
+#include <glib.h>
+#include <cairo/cairo.h>
+
+// Mask of the differing pixels of a page, stored as runs of differing pixels
+// in every row. Pages usually differ in a small fraction of their pixels, so
+// this takes kilobytes where a bitmap of the page would take megabytes; the
+// image of differences can be composed from it and the rendered pages when
+// it is needed (see compose_diff_image()).
+class DiffMask
+{
+public:
+    DiffMask() : m_width(0), m_height(0), m_last_row(-1), m_pixel_count(0) {}
+
+    // Starts a new, empty mask of given size.
+    void Create(int width, int height);
+
+    // Marks 'length' pixels of row y starting at x as differing. Runs must be
+    // added in row-major order and must not overlap.
+    void AddRun(int x, int y, int length);
+
+    // Marks pixel (x, y) as differing, see AddRun().
+    void AddPixel(int x, int y)
+    {
+        // most differing pixels extend the previous run
+        if ( y == m_last_row &&
+             m_runs[m_runs.size() - 2] + m_runs.back() == x )
+        {
+            m_runs.back()++;
+            m_pixel_count++;
+        }
+        else
+        {
+            AddRun(x, y, 1);
+        }
+    }
+
+    // Must be called after the last run is added.
+    void Finish();
+
+    bool IsOk() const { return m_width > 0; }
+    int GetWidth() const { return m_width; }
+    int GetHeight() const { return m_height; }
+
+    // Returns the number of differing pixels.
+    long GetPixelCount() const { return m_pixel_count; }
+
+    // Returns true if any of pixels x1..x2-1 of row y differ.
+    bool RowHasPixels(int y, int x1, int x2) const;
+
+    // Creates CAIRO_FORMAT_A1 image of the mask, with differing pixels set.
+    cairo_surface_t *CreateSurface() const;
+
+private:
+    int m_width, m_height;
+    // index into m_runs of the first run of every row and of the end
+    std::vector<guint32> m_rows;
+    // pairs of starting column and length of runs
+    std::vector<gint32> m_runs;
+    // the row the last run was added to
+    int m_last_row;
+    long m_pixel_count;
+};
+
+#endif // _diffmask_h_
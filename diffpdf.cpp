@@ -0,0 +1,2778 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "diffpdf.h"
+#include "imagewriter.h"
+#include "membudget.h"
+#include "rastercache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include <algorithm>
+#include <map>
+
+#include <glib/gstdio.h>
+#include <cairo/cairo-pdf.h>
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#endif
+#if CAIRO_HAS_SCRIPT_SURFACE
+    #include <cairo/cairo-script.h>
+#endif
+
+
+static inline unsigned char to_grayscale(unsigned char r, unsigned char g, unsigned char b)
+{
+    return (unsigned char)(0.2126 * r + 0.7152 * g + 0.0722 * b);
+}
+
+
+DiffOptions::DiffOptions()
+    : verbose(false),
+      skip_identical(false),
+      mark_differences(false),
+      channel_tolerance(0),
+      per_page_pixel_tolerance(0),
+      grayscale(false),
+      resolution(DEFAULT_RESOLUTION),
+      jobs(1),
+      prepass_resolution(0),
+      band_height(0),
+      compare_ops(false),
+      auto_align(false),
+      max_align_offset(DEFAULT_MAX_ALIGN_OFFSET),
+      align_pages(false),
+      patch_output(false),
+      highlight_changes(false),
+      min_region_size(0),
+      raster_cache(NULL),
+      stats(NULL),
+      memory_budget(NULL)
+{
+}
+
+
+void PageResult::DestroyImages()
+{
+    if ( diff )
+        cairo_surface_destroy(diff);
+    if ( image1 )
+        cairo_surface_destroy(image1);
+    if ( image2 )
+        cairo_surface_destroy(image2);
+
+    diff = image1 = image2 = NULL;
+}
+
+
+void PageResult::Swap(PageResult& other)
+{
+    std::swap(diff, other.diff);
+    regions.swap(other.regions);
+    std::swap(mask, other.mask);
+    std::swap(image1, other.image1);
+    std::swap(image2, other.image2);
+    std::swap(banded, other.banded);
+    std::swap(same_ops, other.same_ops);
+    std::swap(pixel_diff_count, other.pixel_diff_count);
+    std::swap(same, other.same);
+    std::swap(offset_x, other.offset_x);
+    std::swap(offset_y, other.offset_y);
+    std::swap(resolution, other.resolution);
+    std::swap(band_height, other.band_height);
+    components.swap(other.components);
+    std::swap(has_components, other.has_components);
+    std::swap(stats, other.stats);
+    std::swap(has_stats, other.has_stats);
+    std::swap(times, other.times);
+    std::swap(thumbnail.width, other.thumbnail.width);
+    std::swap(thumbnail.height, other.thumbnail.height);
+    thumbnail.data.swap(other.thumbnail.data);
+    label.swap(other.label);
+}
+
+
+void Thumbnail::Create(int w, int h)
+{
+    width = w;
+    height = h;
+    // initalize the thumbnail with white color
+    data.assign(3 * w * h, 255);
+}
+
+
+// Rectangle of pixels, used to place the compared images.
+struct PixelRect
+{
+    PixelRect() : x(0), y(0), width(0), height(0) {}
+    PixelRect(int x_, int y_, int width_, int height_)
+        : x(x_), y(y_), width(width_), height(height_) {}
+
+    bool IsEmpty() const { return width <= 0 || height <= 0; }
+
+    void Offset(int dx, int dy) { x += dx; y += dy; }
+
+    // Extends the rectangle to contain 'r' as well
+    void Union(const PixelRect& r)
+    {
+        if ( r.IsEmpty() )
+            return;
+        if ( IsEmpty() )
+        {
+            *this = r;
+            return;
+        }
+
+        const int x2 = std::max(x + width, r.x + r.width);
+        const int y2 = std::max(y + height, r.y + r.height);
+        x = std::min(x, r.x);
+        y = std::min(y, r.y);
+        width = x2 - x;
+        height = y2 - y;
+    }
+
+    bool operator==(const PixelRect& r) const
+    {
+        return x == r.x && y == r.y && width == r.width && height == r.height;
+    }
+
+    bool operator!=(const PixelRect& r) const { return !(*this == r); }
+
+    int x, y, width, height;
+};
+
+
+// Builds thumbnail of the diff image while the image is being created: rows
+// of the image are averaged into the thumbnail's pixels as they are finished
+// (i.e. box-filtered) and places with differences are marked with red.
+class ThumbnailBuilder
+{
+public:
+    ThumbnailBuilder(Thumbnail& thumbnail, int thumbnail_width,
+                     int image_width, int image_height)
+        : m_thumbnail(thumbnail),
+          m_scale(float(thumbnail_width) / float(image_width)),
+          m_row(0)
+    {
+        const int thumbnail_height = int(image_height * m_scale);
+        thumbnail.Create(thumbnail_width, thumbnail_height);
+
+        // Limit the coordinates to the thumbnail size (may be off slightly
+        // due to rounding errors).
+        // See https://github.com/vslavik/diff-pdf/pull/58
+        m_column.resize(image_width);
+        for ( int x = 0; x < image_width; x++ )
+            m_column[x] = std::min(int(x * m_scale), thumbnail_width - 1);
+
+        m_sums.resize(3 * thumbnail_width, 0);
+        m_counts.resize(thumbnail_width, 0);
+        m_marked.resize(thumbnail_width * thumbnail_height, false);
+    }
+
+    // Marks pixel (x, y) of the image as different.
+    void Mark(int x, int y)
+    {
+        if ( m_thumbnail.height == 0 )
+            return;
+        m_marked[GetRow(y) * m_thumbnail.width + m_column[x]] = true;
+    }
+
+    // Adds row y of the diff image to the thumbnail. Rows must be added in
+    // order.
+    void AddRow(const unsigned char *row, int y)
+    {
+        const int ty = GetRow(y);
+        if ( ty != m_row )
+            FlushRows(ty);
+
+        const int width = (int)m_column.size();
+        for ( int x = 0; x < width; x++, row += 4 )
+        {
+            // cairo_surface_t uses BGR order, thumbnails have RGB
+            guint32 *sum = &m_sums[3 * m_column[x]];
+            sum[0] += row[2];
+            sum[1] += row[1];
+            sum[2] += row[0];
+            m_counts[m_column[x]]++;
+        }
+    }
+
+    // Writes out the rest of the thumbnail after all rows were added. If
+    // there were no changes, the thumbnail is tinted green, otherwise the
+    // marked pixels are highlighted. Pixels may be marked until then.
+    void Finish(bool changes)
+    {
+        FlushRows(m_thumbnail.height);
+
+        // mark changes with red, as visible as possible
+        if ( changes && !m_thumbnail.data.empty() )
+        {
+            unsigned char *out = &m_thumbnail.data[0];
+            for ( size_t i = 0; i < m_marked.size(); i++, out += 3 )
+            {
+                if ( m_marked[i] )
+                {
+                    out[0] = 255;
+                    out[1] = 0;
+                    out[2] = 0;
+                }
+            }
+        }
+
+        // If there were no changes, indicate it by using green
+        // (170,230,130) color for the thumbnail in gutter control:
+        if ( !changes && !m_thumbnail.data.empty() )
+        {
+            unsigned char *out = &m_thumbnail.data[0];
+            for ( int i = m_thumbnail.width * m_thumbnail.height;
+                  i > 0;
+                  i--, out += 3 )
+            {
+                out[0] = 170/2 + out[0] / 2;
+                out[1] = 230/2 + out[1] / 2;
+                out[2] = 130/2 + out[2] / 2;
+            }
+        }
+    }
+
+private:
+    int GetRow(int y) const
+    {
+        return std::min(int(y * m_scale), m_thumbnail.height - 1);
+    }
+
+    // Writes the accumulated pixels into the thumbnail rows up to
+    // 'next_row'; rows that no image row maps to (if the thumbnail is
+    // larger than the image) repeat the current one.
+    void FlushRows(int next_row)
+    {
+        for ( ; m_row < next_row; m_row++ )
+        {
+            unsigned char *out = m_thumbnail.GetPixel(0, m_row);
+            // column to take the pixel from; columns that no image column
+            // maps to repeat the previous one
+            int src = 0;
+            for ( int x = 0; x < m_thumbnail.width; x++, out += 3 )
+            {
+                if ( m_counts[x] )
+                    src = x;
+
+                if ( m_counts[src] )
+                {
+                    // merge in lighter background image
+                    out[0] = 128 + m_sums[3 * src + 0] / m_counts[src] / 2;
+                    out[1] = 128 + m_sums[3 * src + 1] / m_counts[src] / 2;
+                    out[2] = 128 + m_sums[3 * src + 2] / m_counts[src] / 2;
+                }
+            }
+        }
+
+        std::fill(m_sums.begin(), m_sums.end(), 0);
+        std::fill(m_counts.begin(), m_counts.end(), 0);
+    }
+
+private:
+    Thumbnail& m_thumbnail;
+    float m_scale;
+    // thumbnail column of every image column
+    std::vector<int> m_column;
+    // sums of channels and numbers of image pixels of thumbnail pixels in
+    // the current row
+    std::vector<guint32> m_sums;
+    std::vector<guint32> m_counts;
+    std::vector<bool> m_marked;
+    // the thumbnail row being accumulated
+    int m_row;
+};
+
+
+// Size of the squares that changed regions of the diff image consist of, in
+// pixels
+#define REGION_TILE_SIZE 32
+
+// Collects squares of the diff image that contain differences and joins them
+// into larger rectangles.
+class ChangedTiles
+{
+public:
+    ChangedTiles(int width, int height)
+        : m_width(width), m_height(height),
+          m_cols((width + REGION_TILE_SIZE - 1) / REGION_TILE_SIZE),
+          m_rows((height + REGION_TILE_SIZE - 1) / REGION_TILE_SIZE),
+          m_tiles(m_cols * m_rows, false)
+    {}
+
+    // Marks pixel (x, y) as different.
+    void Mark(int x, int y)
+    {
+        m_tiles[(y / REGION_TILE_SIZE) * m_cols + x / REGION_TILE_SIZE] = true;
+    }
+
+    // Marks the whole image as different.
+    void MarkAll()
+    {
+        m_tiles.assign(m_tiles.size(), true);
+    }
+
+    // Stores rectangles covering the marked tiles into 'regions'.
+    void GetRegions(std::vector<DiffRegion>& regions) const
+    {
+        regions.clear();
+
+        // runs of marked tiles in rows of tiles, joined with the same runs
+        // in the rows below them
+        std::vector<bool> done(m_tiles.size(), false);
+        for ( int row = 0; row < m_rows; row++ )
+        {
+            for ( int col = 0; col < m_cols; col++ )
+            {
+                if ( !m_tiles[row * m_cols + col] || done[row * m_cols + col] )
+                    continue;
+
+                int end = col;
+                while ( end < m_cols && m_tiles[row * m_cols + end] )
+                    end++;
+
+                int bottom = row + 1;
+                while ( bottom < m_rows && IsRun(bottom, col, end, done) )
+                    bottom++;
+
+                for ( int r = row; r < bottom; r++ )
+                    for ( int c = col; c < end; c++ )
+                        done[r * m_cols + c] = true;
+
+                const int x = col * REGION_TILE_SIZE;
+                const int y = row * REGION_TILE_SIZE;
+                regions.push_back(
+                    DiffRegion(x, y,
+                               std::min(end * REGION_TILE_SIZE, m_width) - x,
+                               std::min(bottom * REGION_TILE_SIZE, m_height) - y));
+
+                col = end;
+            }
+        }
+    }
+
+private:
+    // Are tiles col..end-1 of the row marked and not used yet, with the
+    // tiles next to them not marked?
+    bool IsRun(int row, int col, int end, const std::vector<bool>& done) const
+    {
+        if ( col > 0 && m_tiles[row * m_cols + col - 1] )
+            return false;
+        if ( end < m_cols && m_tiles[row * m_cols + end] )
+            return false;
+        for ( int c = col; c < end; c++ )
+        {
+            if ( !m_tiles[row * m_cols + c] || done[row * m_cols + c] )
+                return false;
+        }
+        return true;
+    }
+
+    int m_width, m_height;
+    int m_cols, m_rows;
+    std::vector<bool> m_tiles;
+};
+
+
+// Creates RGB24 image surface, accounting for its memory in options' stats.
+cairo_surface_t *create_image_surface(const DiffOptions& options,
+                                      int width, int height)
+{
+    cairo_surface_t *surface =
+        cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+
+    if ( options.stats )
+        options.stats->TrackSurface(surface);
+
+    return surface;
+}
+
+
+void get_page_size_px(PopplerPage *page, long resolution, int *w_px, int *h_px)
+{
+    double w, h;
+    poppler_page_get_size(page, &w, &h);
+
+    *w_px = int((int)resolution * w / 72.0);
+    *h_px = int((int)resolution * h / 72.0);
+}
+
+
+cairo_surface_t *render_page_rect(const DiffOptions& options,
+                                  PopplerPage *page, double resolution,
+                                  int x, int y, int width, int height)
+{
+    cairo_surface_t *surface = create_image_surface(options, width, height);
+
+    cairo_t *cr = cairo_create(surface);
+
+    // clear the surface to white background:
+    cairo_save(cr);
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    cairo_rectangle(cr, 0, 0, width, height);
+    cairo_fill(cr);
+    cairo_restore(cr);
+
+    // move the rectangle's top left corner to the surface's origin
+    cairo_translate(cr, -x, -y);
+
+    // Scale so that PDF output covers the whole surface. Image surface is
+    // created with transformation set up so that 1 coordinate unit is 1 pixel;
+    // Poppler assumes 1 unit = 1 point.
+    cairo_scale(cr, resolution / 72.0, resolution / 72.0);
+
+    poppler_page_render(page, cr);
+
+    cairo_show_page(cr);
+
+    cairo_destroy(cr);
+
+    return surface;
+}
+
+
+// Renders horizontal band of the page, consisting of 'height' rows of pixels
+// starting with row 'y'.
+cairo_surface_t *render_page_band(const DiffOptions& options,
+                                  PopplerPage *page, int y, int height,
+                                  long resolution)
+{
+    int w_px, h_px;
+    get_page_size_px(page, resolution, &w_px, &h_px);
+
+    return render_page_rect(options, page, (int)resolution,
+                            0, y, w_px, height);
+}
+
+
+// Renders the whole page at given resolution, using the raster cache if
+// possible.
+cairo_surface_t *render_page_at(const DiffOptions& options,
+                                PopplerPage *page, long resolution)
+{
+    int w_px, h_px;
+    get_page_size_px(page, resolution, &w_px, &h_px);
+
+    const char *doc_hash =
+        (const char*)g_object_get_data(G_OBJECT(page), "diff-pdf-hash");
+
+    std::string cache_key;
+    if ( options.raster_cache && doc_hash )
+    {
+        cache_key = RasterCache::MakeKey(doc_hash,
+                                         poppler_page_get_index(page),
+                                         resolution);
+        cairo_surface_t *cached = options.raster_cache->Load(cache_key, w_px, h_px);
+        if ( cached )
+        {
+            if ( options.stats )
+                options.stats->TrackSurface(cached);
+            return cached;
+        }
+    }
+
+    cairo_surface_t *surface =
+        render_page_band(options, page, 0, h_px, resolution);
+
+    if ( !cache_key.empty() )
+        options.raster_cache->Store(cache_key, surface);
+
+    return surface;
+}
+
+
+cairo_surface_t *render_page(const DiffOptions& options, PopplerPage *page)
+{
+    return render_page_at(options, page, options.resolution);
+}
+
+
+// Returns true if the page is considered different, given whether there
+// were any changes at all and how many pixels differ.
+bool exceeds_tolerance(const DiffOptions& options,
+                       bool changes, long pixel_diff_count)
+{
+    // If we specified a tolerance, then return if we have exceeded that for this page
+    return options.per_page_pixel_tolerance == 0
+           ? changes
+           : pixel_diff_count > options.per_page_pixel_tolerance;
+}
+
+
+// Computes rectangles of s1, s2 displaced by the offset and of their union,
+// which is the diff image, all relative to the union's top left corner.
+static void get_diff_rects(cairo_surface_t *s1, cairo_surface_t *s2,
+                           int offset_x, int offset_y,
+                           PixelRect& r1, PixelRect& r2, PixelRect& rdiff)
+{
+    if ( s1 )
+    {
+        r1 = PixelRect(0, 0,
+                    cairo_image_surface_get_width(s1),
+                    cairo_image_surface_get_height(s1));
+    }
+    if ( s2 )
+    {
+        r2 = PixelRect(offset_x, offset_y,
+                    cairo_image_surface_get_width(s2),
+                    cairo_image_surface_get_height(s2));
+    }
+
+    // compute union rectangle starting at [0,0] position
+    rdiff = r1;
+    rdiff.Union(r2);
+    r1.Offset(-rdiff.x, -rdiff.y);
+    r2.Offset(-rdiff.x, -rdiff.y);
+    rdiff.Offset(-rdiff.x, -rdiff.y);
+}
+
+
+// Marks the runs of differing pixels of the clusters that weren't ignored
+// by make_diff_image() in the thumbnail builder, changed tiles, mask and
+// bounding box of differences, whichever is not NULL. r2 is the rectangle of
+// s2 in the diff image rdiff, or NULL if there's none; pixels outside of it
+// differ too, but they aren't included in the bounding box.
+static void mark_runs(const std::vector<PixelRun>& runs,
+                      const PixelRect& rdiff, const PixelRect *r2,
+                      ThumbnailBuilder *builder, ChangedTiles *changed,
+                      DiffMask *mask, DiffStats *box)
+{
+    size_t i = 0;
+    for ( int y = 0; y < rdiff.height; y++ )
+    {
+        if ( !r2 || y < r2->y || y >= r2->y + r2->height )
+        {
+            if ( mask )
+                mask->AddRun(0, y, rdiff.width);
+            continue;
+        }
+
+        if ( mask && r2->x > 0 )
+            mask->AddRun(0, y, r2->x);
+
+        for ( ; i < runs.size() && runs[i].y == y; i++ )
+        {
+            const PixelRun& run = runs[i];
+            for ( int x = run.x; x < run.x + run.length; x++ )
+            {
+                if ( builder )
+                    builder->Mark(x, y);
+                if ( changed )
+                    changed->Mark(x, y);
+            }
+
+            if ( mask )
+                mask->AddRun(run.x, y, run.length);
+
+            if ( !box )
+                continue;
+
+            if ( box->HasBoundingBox() )
+            {
+                box->x1 = std::min(box->x1, run.x);
+                box->y1 = std::min(box->y1, y);
+                box->x2 = std::max(box->x2, run.x + run.length - 1);
+                box->y2 = std::max(box->y2, y);
+            }
+            else
+            {
+                box->x1 = run.x;
+                box->y1 = y;
+                box->x2 = run.x + run.length - 1;
+                box->y2 = y;
+            }
+        }
+
+        if ( mask && r2->x + r2->width < rdiff.width )
+            mask->AddRun(r2->x + r2->width, y, rdiff.width - r2->x - r2->width);
+    }
+}
+
+
+// Compares s1 and s2. If the offset is specified, then s2 is displaced by
+// it. If diff_out is not NULL, the image of differences is created and
+// stored into it. If thumbnail and thumbnail_width are specified, then a
+// thumbnail with highlighted differences is created too. The number of
+// differing pixels is stored into pixel_diff_count_out and changes_out is
+// set if the images differ at all (including their sizes). If stats is not
+// NULL, statistics of the overlapping part of the images are added to it. If
+// times is not NULL, time spent comparing the images and creating the
+// thumbnail is added to it. If regions is not NULL, rectangles covering the
+// differences are stored into it. If mask is not NULL, the differing pixels
+// are stored into it. If components is not NULL, connected clusters of the
+// differing pixels are stored into it; pixels of clusters smaller than
+// options' min_region_size aren't counted, nor marked in the thumbnail,
+// regions, mask or statistics' bounding box.
+void make_diff_image(const DiffOptions& options,
+                     cairo_surface_t *s1, cairo_surface_t *s2,
+                     int offset_x, int offset_y,
+                     cairo_surface_t **diff_out,
+                     Thumbnail *thumbnail, int thumbnail_width,
+                     long *pixel_diff_count_out, bool *changes_out,
+                     DiffStats *stats = NULL,
+                     PhaseTimes *times = NULL,
+                     std::vector<DiffRegion> *regions = NULL,
+                     DiffMask *mask = NULL,
+                     std::vector<DiffComponent> *components = NULL)
+{
+    assert( s1 || s2 );
+
+    const gint64 start_time = g_get_monotonic_time();
+    gint64 thumbnail_time = 0;
+
+    long pixel_diff_count = 0;
+    PixelRect r1, r2, rdiff;
+    get_diff_rects(s1, s2, offset_x, offset_y, r1, r2, rdiff);
+
+    // the images differ everywhere outside of s2 if they don't fully overlap
+    const bool overlap = r1 == r2;
+    bool changes = !overlap;
+
+    cairo_surface_t *diff = NULL;
+    if ( diff_out )
+        diff = create_image_surface(options, rdiff.width, rdiff.height);
+
+    // the thumbnail is built from the rows of the diff image as they are
+    // finished, so that it doesn't need another pass over the image
+    ThumbnailBuilder *builder = NULL;
+    if ( thumbnail )
+    {
+        builder = new ThumbnailBuilder(*thumbnail, thumbnail_width,
+                                       rdiff.width, rdiff.height);
+    }
+
+    ChangedTiles *changed = NULL;
+    if ( regions )
+    {
+        changed = new ChangedTiles(rdiff.width, rdiff.height);
+
+        // the images differ everywhere, as far as regions are concerned
+        if ( !overlap )
+            changed->MarkAll();
+    }
+
+    // clusters are needed to filter out the small ones even if they aren't
+    // wanted themselves; the pixels of the others are only marked once
+    // they are known
+    const bool filter = options.min_region_size > 0;
+    ComponentLabeler *labeler = NULL;
+    if ( components || filter )
+        labeler = new ComponentLabeler(filter);
+
+    if ( mask )
+        mask->Create(rdiff.width, rdiff.height);
+
+    // the bounding box of differences is found again without the ignored
+    // clusters, starting with the one of the previously added images
+    DiffStats stats_box;
+    if ( stats && filter )
+    {
+        stats_box.x1 = stats->x1;
+        stats_box.y1 = stats->y1;
+        stats_box.x2 = stats->x2;
+        stats_box.y2 = stats->y2;
+    }
+
+    // Rows of the diff image are composed in the image, if it's wanted, or
+    // in a scratch row if only the thumbnail needs them. If neither does and
+    // the images overlap exactly, s2 is compared with s1 directly.
+    const bool compose = diff || builder;
+    const bool in_place = !compose && overlap;
+    std::vector<unsigned char> scratch;
+    if ( !diff && !in_place )
+        scratch.resize(4 * rdiff.width);
+
+    // thumbnail markers, changed regions, the mask and clusters need
+    // per-pixel processing of differing rows
+    const bool mark_pixels = builder || changed || mask || labeler;
+
+    // The common case is handled entirely by the vectorized kernel; marking
+    // pixels and grayscale output need per-pixel processing, which is only
+    // done if needed.
+    const bool simple = compose && !mark_pixels && !options.grayscale;
+
+    const int stride1 = s1 ? cairo_image_surface_get_stride(s1) : 0;
+    const int stride2 = s2 ? cairo_image_surface_get_stride(s2) : 0;
+    const int stridediff = diff ? cairo_image_surface_get_stride(diff) : 0;
+
+    unsigned char *data1 = s1 ? cairo_image_surface_get_data(s1) : NULL;
+    const unsigned char *data2 = s2 ? cairo_image_surface_get_data(s2) : NULL;
+    unsigned char *datadiff = diff ? cairo_image_surface_get_data(diff) : NULL;
+
+    for ( int y = 0; y < rdiff.height; y++ )
+    {
+        unsigned char *row1 = s1 && y >= r1.y && y < r1.y + r1.height
+                              ? data1 + (y - r1.y) * stride1
+                              : NULL;
+        const unsigned char *row2 = s2 && y >= r2.y && y < r2.y + r2.height
+                                    ? data2 + (y - r2.y) * stride2
+                                    : NULL;
+
+        // we visualize the differences by taking one channel from s1
+        // and the other two channels from s2:
+
+        // first, copy s1 over, on white background if the merged images
+        // don't fully overlap
+        unsigned char *out;
+        if ( in_place )
+        {
+            // only read, as the row isn't composed
+            out = row1;
+        }
+        else
+        {
+            out = diff ? datadiff + y * stridediff : &scratch[0];
+            if ( !overlap )
+                memset(out, 0xff, 4 * rdiff.width);
+            if ( row1 )
+                memcpy(out + 4 * r1.x, row1, 4 * r1.width);
+        }
+
+        if ( !row2 )
+        {
+            if ( mask && !filter )
+                mask->AddRun(0, y, rdiff.width);
+        }
+        else
+        {
+            if ( mask && !filter && r2.x > 0 )
+                mask->AddRun(0, y, r2.x);
+
+            // then, copy B channel from s2 over it; also compare the two
+            // versions to see if there are any differences:
+            unsigned char *out2 = out + 4 * r2.x;
+
+            const long line_diff_count =
+                diff_row(out2, row2, r2.width, options.channel_tolerance, simple,
+                         stats, r2.x, y);
+            const bool linediff = line_diff_count > 0;
+
+            if ( linediff )
+            {
+                pixel_diff_count += line_diff_count;
+                changes = true;
+            }
+
+            // Identical rows only need the per-pixel pass if the kernel
+            // didn't produce the output (grayscale, or tolerance hiding
+            // differences in the B channel).
+            if ( (mark_pixels && linediff) ||
+                 (compose && !simple &&
+                  (linediff || options.grayscale || options.channel_tolerance > 0)) )
+            {
+                for ( int x = 0; x < r2.width * 4; x += 4 )
+                {
+                    unsigned char cr1 = *(out2 + x + 0);
+                    unsigned char cg1 = *(out2 + x + 1);
+                    unsigned char cb1 = *(out2 + x + 2);
+
+                    unsigned char cr2 = *(row2 + x + 0);
+                    unsigned char cg2 = *(row2 + x + 1);
+                    unsigned char cb2 = *(row2 + x + 2);
+
+                    if ( mark_pixels && linediff &&
+                         diff_pixel(out2 + x, row2 + x, options.channel_tolerance) )
+                    {
+                        if ( builder && !filter )
+                            builder->Mark(r2.x + x/4, y);
+                        if ( changed && !filter )
+                            changed->Mark(r2.x + x/4, y);
+                        if ( mask && !filter )
+                            mask->AddPixel(r2.x + x/4, y);
+                        if ( labeler )
+                            labeler->AddPixel(r2.x + x/4, y);
+                    }
+
+                    if ( !compose )
+                        continue;
+
+                    if (options.grayscale)
+                    {
+                        // convert both images to grayscale, use blue for s1, red for s2
+                        unsigned char gray1 = to_grayscale(cr1, cg1, cb1);
+                        unsigned char gray2 = to_grayscale(cr2, cg2, cb2);
+                        *(out2 + x + 0) = gray2;
+                        *(out2 + x + 1) = (gray1 + gray2) / 2;
+                        *(out2 + x + 2) = gray1;
+                    }
+                    else
+                    {
+                        // change the B channel to be from s2; RG will be s1
+                        *(out2 + x + 2) = cb2;
+                    }
+                }
+            }
+
+            if ( mask && !filter && r2.x + r2.width < rdiff.width )
+                mask->AddRun(r2.x + r2.width, y, rdiff.width - r2.x - r2.width);
+
+            if (compose && options.mark_differences && linediff)
+            {
+                for (int x = 0; x < (10 < r2.width ? 10 : r2.width) * 4; x+=4)
+                {
+                   *(out2 + x + 0) = 0;
+                   *(out2 + x + 1) = 0;
+                   *(out2 + x + 2) = 255;
+                }
+            }
+        }
+
+        if ( builder )
+        {
+            const gint64 thumbnail_start = g_get_monotonic_time();
+            builder->AddRow(out, y);
+            thumbnail_time += g_get_monotonic_time() - thumbnail_start;
+        }
+    }
+
+    // the clusters to ignore must be known before anything is finished
+    if ( labeler )
+    {
+        std::vector<DiffComponent> found;
+        const long ignored =
+            labeler->GetComponents(found, options.min_region_size);
+
+        pixel_diff_count -= ignored;
+        // differences outside of the overlap are never ignored
+        if ( pixel_diff_count == 0 && overlap )
+            changes = false;
+
+        if ( filter )
+        {
+            std::vector<PixelRun> runs;
+            labeler->GetRuns(runs, options.min_region_size);
+            mark_runs(runs, rdiff, s2 ? &r2 : NULL,
+                      builder, changed, mask, stats ? &stats_box : NULL);
+            if ( stats )
+            {
+                stats->x1 = stats_box.x1;
+                stats->y1 = stats_box.y1;
+                stats->x2 = stats_box.x2;
+                stats->y2 = stats_box.y2;
+            }
+        }
+
+        delete labeler;
+
+        if ( components )
+            components->swap(found);
+    }
+
+    if ( builder )
+    {
+        const gint64 thumbnail_start = g_get_monotonic_time();
+        builder->Finish(changes);
+        delete builder;
+        thumbnail_time += g_get_monotonic_time() - thumbnail_start;
+    }
+
+    if ( changed )
+    {
+        changed->GetRegions(*regions);
+        delete changed;
+    }
+
+    if ( mask )
+        mask->Finish();
+
+    *pixel_diff_count_out = pixel_diff_count;
+    *changes_out = changes;
+
+    if ( diff )
+        *diff_out = diff;
+
+    if ( times )
+    {
+        times->times[PHASE_DIFF] +=
+            g_get_monotonic_time() - start_time - thumbnail_time;
+        times->times[PHASE_THUMBNAIL] += thumbnail_time;
+    }
+}
+
+
+cairo_surface_t *diff_images(const DiffOptions& options,
+                             cairo_surface_t *s1, cairo_surface_t *s2,
+                             int offset_x, int offset_y,
+                             Thumbnail *thumbnail, int thumbnail_width,
+                             long *pixel_diff_count_out,
+                             DiffStats *stats,
+                             PhaseTimes *times,
+                             std::vector<DiffRegion> *regions,
+                             DiffMask *mask,
+                             std::vector<DiffComponent> *components)
+{
+    long pixel_diff_count;
+    bool changes;
+    cairo_surface_t *diff = NULL;
+    make_diff_image(options, s1, s2, offset_x, offset_y, &diff,
+                    thumbnail, thumbnail_width,
+                    &pixel_diff_count, &changes,
+                    stats, times, regions, mask, components);
+
+    if ( pixel_diff_count_out )
+        *pixel_diff_count_out = pixel_diff_count;
+
+    if ( exceeds_tolerance(options, changes, pixel_diff_count) )
+        return diff;
+
+    cairo_surface_destroy(diff);
+    return NULL;
+}
+
+
+bool compare_images(const DiffOptions& options,
+                    cairo_surface_t *s1, cairo_surface_t *s2,
+                    int offset_x, int offset_y,
+                    Thumbnail *thumbnail, int thumbnail_width,
+                    long *pixel_diff_count_out,
+                    DiffStats *stats,
+                    PhaseTimes *times,
+                    std::vector<DiffRegion> *regions,
+                    DiffMask *mask,
+                    std::vector<DiffComponent> *components)
+{
+    long pixel_diff_count;
+    bool changes;
+    make_diff_image(options, s1, s2, offset_x, offset_y, NULL,
+                    thumbnail, thumbnail_width,
+                    &pixel_diff_count, &changes,
+                    stats, times, regions, mask, components);
+
+    if ( pixel_diff_count_out )
+        *pixel_diff_count_out = pixel_diff_count;
+
+    return exceeds_tolerance(options, changes, pixel_diff_count);
+}
+
+
+cairo_surface_t *compose_diff_image(const DiffOptions& options,
+                                    cairo_surface_t *s1, cairo_surface_t *s2,
+                                    int offset_x, int offset_y,
+                                    const DiffMask& mask)
+{
+    assert( s1 || s2 );
+
+    PixelRect r1, r2, rdiff;
+    get_diff_rects(s1, s2, offset_x, offset_y, r1, r2, rdiff);
+
+    cairo_surface_t *diff =
+        create_image_surface(options, rdiff.width, rdiff.height);
+
+    const int stride1 = s1 ? cairo_image_surface_get_stride(s1) : 0;
+    const int stride2 = s2 ? cairo_image_surface_get_stride(s2) : 0;
+    const int stridediff = cairo_image_surface_get_stride(diff);
+
+    const unsigned char *data1 = s1 ? cairo_image_surface_get_data(s1) : NULL;
+    const unsigned char *data2 = s2 ? cairo_image_surface_get_data(s2) : NULL;
+    unsigned char *datadiff = cairo_image_surface_get_data(diff);
+
+    // the same composition as done by make_diff_image(), except that the
+    // differing rows are known from the mask
+    for ( int y = 0; y < rdiff.height; y++ )
+    {
+        unsigned char *out = datadiff + y * stridediff;
+
+        if ( r1 != r2 )
+            memset(out, 0xff, 4 * rdiff.width);
+        if ( s1 && y >= r1.y && y < r1.y + r1.height )
+            memcpy(out + 4 * r1.x, data1 + (y - r1.y) * stride1, 4 * r1.width);
+
+        if ( !s2 || y < r2.y || y >= r2.y + r2.height )
+            continue;
+
+        const unsigned char *row2 = data2 + (y - r2.y) * stride2;
+        unsigned char *out2 = out + 4 * r2.x;
+
+        if ( options.grayscale )
+        {
+            for ( int x = 0; x < r2.width * 4; x += 4 )
+            {
+                unsigned char gray1 = to_grayscale(out2[x], out2[x + 1], out2[x + 2]);
+                unsigned char gray2 = to_grayscale(row2[x], row2[x + 1], row2[x + 2]);
+                out2[x + 0] = gray2;
+                out2[x + 1] = (gray1 + gray2) / 2;
+                out2[x + 2] = gray1;
+            }
+        }
+        else
+        {
+            // the kernel copies the B channel fastest; the count isn't
+            // needed
+            diff_row(out2, row2, r2.width, options.channel_tolerance, true);
+        }
+
+        if ( options.mark_differences &&
+             mask.RowHasPixels(y, r2.x, r2.x + r2.width) )
+        {
+            for (int x = 0; x < (10 < r2.width ? 10 : r2.width) * 4; x+=4)
+            {
+               out2[x + 0] = 0;
+               out2[x + 1] = 0;
+               out2[x + 2] = 255;
+            }
+        }
+    }
+
+    return diff;
+}
+
+
+cairo_surface_t *diff_image_region(const DiffOptions& options,
+                                   cairo_surface_t *s1, cairo_surface_t *s2,
+                                   int x)
+{
+    // the markers would repeat at the left edge of every part otherwise
+    DiffOptions region_options(options);
+    if ( x != 0 )
+        region_options.mark_differences = false;
+
+    long pixel_diff_count;
+    bool changes;
+    cairo_surface_t *diff = NULL;
+    make_diff_image(region_options, s1, s2, 0, 0, &diff, NULL, -1,
+                    &pixel_diff_count, &changes);
+    return diff;
+}
+
+
+GBytes *load_document_bytes(const char *filename, GError **err)
+{
+    if ( strcmp(filename, "-") == 0 )
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        GByteArray *data = g_byte_array_new();
+        guint8 buf[65536];
+        size_t len;
+        while ( (len = fread(buf, 1, sizeof(buf), stdin)) > 0 )
+            g_byte_array_append(data, buf, (guint)len);
+
+        if ( ferror(stdin) )
+        {
+            g_set_error(err, G_FILE_ERROR, G_FILE_ERROR_IO,
+                        "Error reading standard input");
+            g_byte_array_unref(data);
+            return NULL;
+        }
+
+        return g_byte_array_free_to_bytes(data);
+    }
+
+    GMappedFile *file = g_mapped_file_new(filename, FALSE, err);
+    if ( !file )
+        return NULL;
+
+    // the bytes keep the file mapped as long as they are used
+    GBytes *bytes = g_mapped_file_get_bytes(file);
+    g_mapped_file_unref(file);
+    return bytes;
+}
+
+
+PopplerDocument *open_document_bytes(GBytes *bytes, const char *name,
+                                     GError **err)
+{
+#if POPPLER_CHECK_VERSION(0, 82, 0)
+    PopplerDocument *doc = poppler_document_new_from_bytes(bytes, NULL, err);
+#else
+    gsize size;
+    const char *data = (const char*)g_bytes_get_data(bytes, &size);
+    PopplerDocument *doc =
+        poppler_document_new_from_data(const_cast<char*>(data), (int)size,
+                                       NULL, err);
+#endif
+    if ( doc )
+    {
+        // keeps the data alive for the document as well as for its copies
+        g_object_set_data_full(G_OBJECT(doc), "diff-pdf-bytes",
+                               g_bytes_ref(bytes),
+                               (GDestroyNotify)g_bytes_unref);
+        g_object_set_data_full(G_OBJECT(doc), "diff-pdf-name",
+                               g_strdup(name), g_free);
+    }
+    return doc;
+}
+
+
+PopplerDocument *open_document_file(const char *filename, GError **err)
+{
+    GBytes *bytes = load_document_bytes(filename, err);
+    if ( !bytes )
+        return NULL;
+
+    PopplerDocument *doc = open_document_bytes(bytes, filename, err);
+    g_bytes_unref(bytes);
+    return doc;
+}
+
+
+void cache_document_pages(const DiffOptions& options, PopplerDocument *doc)
+{
+    if ( !options.raster_cache )
+        return;
+
+    GBytes *bytes =
+        (GBytes*)g_object_get_data(G_OBJECT(doc), "diff-pdf-bytes");
+    if ( bytes )
+        set_document_hash(doc, get_data_hash(bytes));
+}
+
+
+void set_document_hash(PopplerDocument *doc, const std::string& hash)
+{
+    g_object_set_data_full(G_OBJECT(doc), "diff-pdf-hash",
+                           g_strdup(hash.c_str()), g_free);
+}
+
+
+PopplerDocument *open_document_copy(PopplerDocument *doc, GError **err)
+{
+    GBytes *bytes =
+        (GBytes*)g_object_get_data(G_OBJECT(doc), "diff-pdf-bytes");
+    const char *name =
+        (const char*)g_object_get_data(G_OBJECT(doc), "diff-pdf-name");
+    assert( bytes && name );
+
+    // the copy shares the data, the file isn't read again
+    PopplerDocument *copy = open_document_bytes(bytes, name, err);
+
+    const char *hash =
+        (const char*)g_object_get_data(G_OBJECT(doc), "diff-pdf-hash");
+    if ( copy && hash )
+        set_document_hash(copy, hash);
+
+    return copy;
+}
+
+
+PopplerPage *get_document_page(PopplerDocument *doc, int index)
+{
+    if ( index < 0 || index >= poppler_document_get_n_pages(doc) )
+        return NULL;
+
+    PopplerPage *page = poppler_document_get_page(doc, index);
+
+    // let render_page() know which document the page belongs to
+    const char *hash =
+        (const char*)g_object_get_data(G_OBJECT(doc), "diff-pdf-hash");
+    if ( page && hash )
+    {
+        g_object_set_data_full(G_OBJECT(page), "diff-pdf-hash",
+                               g_strdup(hash), g_free);
+    }
+
+    return page;
+}
+
+
+std::string get_page_label(PopplerPage *page)
+{
+    if ( !page )
+        return "(null)";
+
+    gchar *label;
+    g_object_get(page, "label", &label, NULL);
+    const std::string s(label ? label : "");
+    g_free(label);
+    return s;
+}
+
+
+// Quickly compares the pages at options' prepass_resolution. Returns true if
+// they are already different at that resolution and so don't need to be
+// compared in full.
+bool page_differs_at_prepass(const DiffOptions& options,
+                             PopplerPage *page1, PopplerPage *page2)
+{
+    if ( !page1 || !page2 )
+        return true;
+
+    cairo_surface_t *img1 =
+        render_page_at(options, page1, options.prepass_resolution);
+    cairo_surface_t *img2 =
+        render_page_at(options, page2, options.prepass_resolution);
+
+    const bool differs = compare_images(options, img1, img2);
+
+    cairo_surface_destroy(img1);
+    cairo_surface_destroy(img2);
+
+    return differs;
+}
+
+
+// Resolution of the small renders that signatures of pages are computed
+// from, in DPI
+#define SIGNATURE_RESOLUTION 18
+
+// Computes signature of the page for pairing pages of documents.
+guint64 get_page_signature(const DiffOptions& options, PopplerPage *page)
+{
+    cairo_surface_t *img = render_page_at(options, page, SIGNATURE_RESOLUTION);
+    const guint64 signature = get_image_signature(img);
+    cairo_surface_destroy(img);
+    return signature;
+}
+
+
+#if CAIRO_HAS_SCRIPT_SURFACE
+
+static cairo_status_t checksum_write_func(void *closure,
+                                          const unsigned char *data,
+                                          unsigned int length)
+{
+    g_checksum_update((GChecksum*)closure, data, length);
+    return CAIRO_STATUS_SUCCESS;
+}
+
+
+// Computes hash of the drawing operations the page consists of, by
+// rendering it into a cairo script surface.
+std::string get_page_ops_hash(PopplerPage *page)
+{
+    double w, h;
+    poppler_page_get_size(page, &w, &h);
+
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+    cairo_device_t *script =
+        cairo_script_create_for_stream(checksum_write_func, checksum);
+    cairo_surface_t *surface =
+        cairo_script_surface_create(script, CAIRO_CONTENT_COLOR, w, h);
+
+    cairo_t *cr = cairo_create(surface);
+    poppler_page_render(page, cr);
+    cairo_show_page(cr);
+    cairo_destroy(cr);
+
+    cairo_surface_destroy(surface);
+    cairo_device_finish(script);
+    cairo_device_destroy(script);
+
+    const std::string hash(g_checksum_get_string(checksum));
+    g_checksum_free(checksum);
+
+    return hash;
+}
+
+#endif // CAIRO_HAS_SCRIPT_SURFACE
+
+
+// Returns true if both pages are drawn with identical operations and so
+// would render into identical images.
+bool page_ops_identical(PopplerPage *page1, PopplerPage *page2)
+{
+#if CAIRO_HAS_SCRIPT_SURFACE
+    if ( !page1 || !page2 )
+        return false;
+
+    return get_page_ops_hash(page1) == get_page_ops_hash(page2);
+#else
+    return false;
+#endif
+}
+
+
+// Returns true if pages can be compared in bands of options' band_height rows.
+bool can_compare_in_bands(const DiffOptions& options,
+                          PopplerPage *page1, PopplerPage *page2)
+{
+    if ( options.band_height <= 0 || !page1 || !page2 )
+        return false;
+
+    // finding the offset needs the whole pages, as do clusters of
+    // differences, which may span several bands
+    if ( options.auto_align || options.min_region_size > 0 )
+        return false;
+
+    // bands only make sense for pages of the same size, otherwise the
+    // images would need to be padded
+    int w1, h1, w2, h2;
+    get_page_size_px(page1, options.resolution, &w1, &h1);
+    get_page_size_px(page2, options.resolution, &w2, &h2);
+
+    return w1 == w2 && h1 == h2 && h1 > options.band_height;
+}
+
+
+// Counts differing pixels of two pages of the same size, rendering only
+// options' band_height rows of them at a time. The count and time spent are
+// stored into 'result', as well as statistics if 'stats' is true.
+void count_diff_pixels_in_bands(const DiffOptions& options,
+                                PopplerPage *page1, PopplerPage *page2,
+                                PageResult& result, bool stats)
+{
+    int w_px, h_px;
+    get_page_size_px(page1, options.resolution, &w_px, &h_px);
+
+    long pixel_diff_count = 0;
+
+    for ( int y = 0; y < h_px; y += options.band_height )
+    {
+        const int height = std::min(int(options.band_height), h_px - y);
+
+        const gint64 render1_start = g_get_monotonic_time();
+        cairo_surface_t *img1 =
+            render_page_band(options, page1, y, height, options.resolution);
+        const gint64 render2_start = g_get_monotonic_time();
+        cairo_surface_t *img2 =
+            render_page_band(options, page2, y, height, options.resolution);
+        const gint64 diff_start = g_get_monotonic_time();
+
+        result.times.times[PHASE_RENDER1] += render2_start - render1_start;
+        result.times.times[PHASE_RENDER2] += diff_start - render2_start;
+
+        const int stride1 = cairo_image_surface_get_stride(img1);
+        const int stride2 = cairo_image_surface_get_stride(img2);
+        unsigned char *data1 = cairo_image_surface_get_data(img1);
+        const unsigned char *data2 = cairo_image_surface_get_data(img2);
+
+        for ( int row = 0;
+              row < height;
+              row++, data1 += stride1, data2 += stride2 )
+        {
+            pixel_diff_count +=
+                diff_row(data1, data2, w_px, options.channel_tolerance, false,
+                         stats ? &result.stats : NULL, 0, y + row);
+        }
+
+        result.times.times[PHASE_DIFF] += g_get_monotonic_time() - diff_start;
+
+        cairo_surface_destroy(img1);
+        cairo_surface_destroy(img2);
+    }
+
+    result.pixel_diff_count = pixel_diff_count;
+    result.has_stats = stats;
+}
+
+
+// Flags for page_diff()
+enum
+{
+    // keep the diff image in the result for page_output()
+    PAGE_DIFF_KEEP_DIFF = 1,
+    // create a thumbnail with highlighted differences and page's label
+    PAGE_DIFF_THUMBNAIL = 2,
+    // try to find differences at options' prepass_resolution first
+    PAGE_DIFF_PREPASS   = 4,
+    // compare drawing operations first and skip rendering if they match
+    PAGE_DIFF_OPS       = 8,
+    // collect statistics of the differences (see DiffStats)
+    PAGE_DIFF_STATS     = 16,
+    // keep the rendered pages in the result
+    PAGE_DIFF_KEEP_IMAGES = 32,
+    // find mask of the differing pixels (see PageResult::mask)
+    PAGE_DIFF_MASK      = 64,
+    // the whole diff image is needed, don't compare the pages in bands
+    PAGE_DIFF_NO_BANDS  = 128,
+    // find connected clusters of differences (see PageResult::components),
+    // unless the pages are compared in bands
+    PAGE_DIFF_COMPONENTS = 256
+};
+
+// Thumbnails, kept images and masks need the whole page's image, so pages
+// are never compared in bands with these flags
+static const int PAGE_DIFF_WHOLE_PAGE = PAGE_DIFF_THUMBNAIL |
+                                        PAGE_DIFF_KEEP_IMAGES |
+                                        PAGE_DIFF_MASK |
+                                        PAGE_DIFF_NO_BANDS;
+
+// Smallest resolution pages are compared at to fit into the memory budget
+#define MIN_BUDGET_RESOLUTION 36
+
+// Smallest height of bands pages are compared in to fit into the memory
+// budget
+#define MIN_BUDGET_BAND_HEIGHT 16
+
+// Returns memory needed by images of the pages compared by
+// compare_rendered_pages() with given flags, in bytes.
+gint64 estimate_page_memory(const DiffOptions& options,
+                            PopplerPage *page1, PopplerPage *page2, int flags)
+{
+    int w1 = 0, h1 = 0, w2 = 0, h2 = 0;
+    if ( page1 )
+        get_page_size_px(page1, options.resolution, &w1, &h1);
+    if ( page2 )
+        get_page_size_px(page2, options.resolution, &w2, &h2);
+
+    // a band of each page
+    if ( !(flags & PAGE_DIFF_WHOLE_PAGE) &&
+         can_compare_in_bands(options, page1, page2) )
+    {
+        return 2 * 4 * gint64(w1) * options.band_height;
+    }
+
+    // both pages and, if it's kept, the diff image, which is as large as the
+    // larger one; the mask is small enough not to matter
+    gint64 size = 4 * (gint64(w1) * h1 + gint64(w2) * h2);
+    if ( flags & PAGE_DIFF_KEEP_DIFF )
+        size += 4 * gint64(std::max(w1, w2)) * std::max(h1, h2);
+    return size;
+}
+
+
+// Changes the options so that images of the pages fit into their
+// memory_budget: the pages are compared in bands if possible and at lower
+// resolution otherwise, if the budget allows it. Returns memory needed by the
+// images, which may still exceed the budget if the resolution can't be
+// lowered (any more).
+gint64 fit_page_into_budget(DiffOptions& options,
+                            PopplerPage *page1, PopplerPage *page2, int flags)
+{
+    const gint64 limit = options.memory_budget->GetLimit();
+
+    gint64 size = estimate_page_memory(options, page1, page2, flags);
+    if ( size <= limit )
+        return size;
+
+    if ( !(flags & PAGE_DIFF_WHOLE_PAGE) && page1 )
+    {
+        int w_px, h_px;
+        get_page_size_px(page1, options.resolution, &w_px, &h_px);
+
+        DiffOptions banded(options);
+        banded.band_height = (long)std::max(limit / (2 * 4 * gint64(w_px)),
+                                            gint64(MIN_BUDGET_BAND_HEIGHT));
+        if ( can_compare_in_bands(banded, page1, page2) )
+        {
+            options.band_height = banded.band_height;
+            return estimate_page_memory(options, page1, page2, flags);
+        }
+    }
+
+    // the page will be compared alone if nothing else helps
+    if ( !options.memory_budget->CanLowerResolution() )
+        return size;
+
+    // the memory needed grows with the square of the resolution
+    const long min_resolution =
+        std::min(options.resolution, long(MIN_BUDGET_RESOLUTION));
+    options.resolution =
+        std::max(long(options.resolution * sqrt(double(limit) / size)),
+                 min_resolution);
+
+    // sizes in pixels are rounded up, so the estimate may still be too large
+    while ( (size = estimate_page_memory(options, page1, page2, flags)) > limit &&
+            options.resolution > min_resolution )
+    {
+        options.resolution--;
+    }
+
+    return size;
+}
+
+
+// Renders and compares given two pages for page_diff().
+void compare_rendered_pages(const DiffOptions& options,
+                            PopplerPage *page1, PopplerPage *page2,
+                            PageResult& result, int flags)
+{
+    const bool keep_diff = (flags & PAGE_DIFF_KEEP_DIFF) != 0;
+    const bool with_thumbnail = (flags & PAGE_DIFF_THUMBNAIL) != 0;
+    const bool with_stats = (flags & PAGE_DIFF_STATS) != 0;
+    const bool keep_images = (flags & PAGE_DIFF_KEEP_IMAGES) != 0;
+    const bool with_mask = (flags & PAGE_DIFF_MASK) != 0;
+    const bool with_components = (flags & PAGE_DIFF_COMPONENTS) != 0;
+
+    if ( !(flags & PAGE_DIFF_WHOLE_PAGE) &&
+         can_compare_in_bands(options, page1, page2) )
+    {
+        result.banded = true;
+        count_diff_pixels_in_bands(options, page1, page2, result, with_stats);
+        result.same = !exceeds_tolerance(options,
+                                         result.pixel_diff_count > 0,
+                                         result.pixel_diff_count);
+        return;
+    }
+
+    const gint64 render1_start = g_get_monotonic_time();
+    cairo_surface_t *img1 = page1 ? render_page(options, page1) : NULL;
+    const gint64 render2_start = g_get_monotonic_time();
+    cairo_surface_t *img2 = page2 ? render_page(options, page2) : NULL;
+
+    result.times.times[PHASE_RENDER1] = render2_start - render1_start;
+    result.times.times[PHASE_RENDER2] = g_get_monotonic_time() - render2_start;
+
+    if ( options.auto_align && img1 && img2 )
+    {
+        const gint64 align_start = g_get_monotonic_time();
+        find_image_offset(img1, img2, options.max_align_offset,
+                          &result.offset_x, &result.offset_y);
+        result.times.times[PHASE_ALIGN] = g_get_monotonic_time() - align_start;
+    }
+
+    // the image of differences is only composed from the renders and the
+    // mask if the pages differ and the image is kept
+    DiffMask mask;
+    const bool differs =
+        compare_images(options, img1, img2, result.offset_x, result.offset_y,
+                       with_thumbnail ? &result.thumbnail : NULL, THUMBNAIL_WIDTH,
+                       &result.pixel_diff_count,
+                       with_stats ? &result.stats : NULL,
+                       &result.times,
+                       keep_diff && options.patch_output ? &result.regions : NULL,
+                       with_mask || keep_diff ? &mask : NULL,
+                       with_components ? &result.components : NULL);
+    result.same = !differs;
+    result.has_stats = with_stats;
+    result.has_components = with_components;
+
+    if ( differs && keep_diff )
+    {
+        const gint64 compose_start = g_get_monotonic_time();
+        result.diff = compose_diff_image(options, img1, img2,
+                                         result.offset_x, result.offset_y,
+                                         mask);
+        result.times.times[PHASE_DIFF] += g_get_monotonic_time() - compose_start;
+    }
+
+    if ( with_mask )
+        std::swap(result.mask, mask);
+
+    if ( with_thumbnail )
+    {
+        const std::string label1 = get_page_label(page1);
+        const std::string label2 = get_page_label(page2);
+
+        if ( label1 == label2 )
+            result.label = label1;
+        else
+            result.label = label1 + " / " + label2;
+    }
+
+    if ( keep_images )
+    {
+        result.image1 = img1;
+        result.image2 = img2;
+    }
+    else
+    {
+        if ( img1 )
+            cairo_surface_destroy(img1);
+        if ( img2 )
+            cairo_surface_destroy(img2);
+    }
+}
+
+
+// Compares given two pages, storing the outcome in 'result'. 'flags' is a
+// combination of PAGE_DIFF_* values.
+//
+// This function only uses page1 and page2 and can be called from worker
+// threads.
+void page_diff(const DiffOptions& options,
+               PopplerPage *page1, PopplerPage *page2,
+               PageResult& result, int flags)
+{
+    if ( (flags & PAGE_DIFF_OPS) && page_ops_identical(page1, page2) )
+    {
+        result.same_ops = true;
+        return;
+    }
+
+    // inserted or deleted pages differ, they only need to be rendered if
+    // their image is wanted
+    const int image_flags = PAGE_DIFF_KEEP_DIFF | PAGE_DIFF_THUMBNAIL |
+                            PAGE_DIFF_KEEP_IMAGES | PAGE_DIFF_MASK;
+    if ( (!page1 || !page2) && !(flags & image_flags) )
+    {
+        result.same = false;
+        return;
+    }
+
+    // pages that are only shifted would differ at the prepass, and small
+    // clusters that would be ignored at full resolution may look larger
+    // there; antialiasing makes different pixels differ at lower resolution
+    // too, so differences within tolerances can't be told from others
+    if ( (flags & PAGE_DIFF_PREPASS) && !options.auto_align &&
+         !options.min_region_size &&
+         !options.per_page_pixel_tolerance && !options.channel_tolerance &&
+         page_differs_at_prepass(options, page1, page2) )
+    {
+        result.same = false;
+        return;
+    }
+
+    if ( !options.memory_budget )
+    {
+        compare_rendered_pages(options, page1, page2, result, flags);
+        return;
+    }
+
+    // Wait until there's enough memory for this page's images; images kept
+    // in the result aren't accounted for, PageWorkers limit how many results
+    // are held
+    DiffOptions fitted(options);
+    const gint64 size = fit_page_into_budget(fitted, page1, page2, flags);
+    if ( fitted.resolution != options.resolution )
+        result.resolution = fitted.resolution;
+    if ( fitted.band_height != options.band_height )
+        result.band_height = fitted.band_height;
+
+    options.memory_budget->Reserve(size);
+    compare_rendered_pages(fitted, page1, page2, result, flags);
+    options.memory_budget->Release(size);
+}
+
+
+// Returns options with which the page of given result was compared, which
+// may differ from the document's ones to fit into the memory budget.
+static DiffOptions get_page_options(const DiffOptions& options,
+                                    const PageResult& result)
+{
+    DiffOptions page_options(options);
+    if ( result.resolution )
+        page_options.resolution = result.resolution;
+    if ( result.band_height )
+        page_options.band_height = result.band_height;
+    return page_options;
+}
+
+
+// Draws given regions of the diff image into cr_out, which is scaled to
+// pixels, with the image's top left corner at (0, y). Every region is copied
+// into its own image, so that the PDF only contains the changed parts.
+// The regions are outlined if options' highlight_changes is set.
+void paint_diff_regions(const DiffOptions& options, cairo_t *cr_out,
+                        cairo_surface_t *diff, int y,
+                        const std::vector<DiffRegion>& regions)
+{
+    for ( size_t i = 0; i < regions.size(); i++ )
+    {
+        const DiffRegion& r = regions[i];
+
+        cairo_surface_t *patch = create_image_surface(options, r.width, r.height);
+        cairo_t *cr = cairo_create(patch);
+        cairo_set_source_surface(cr, diff, -r.x, -r.y);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+
+        cairo_set_source_surface(cr_out, patch, r.x, y + r.y);
+        cairo_paint(cr_out);
+
+        cairo_surface_destroy(patch);
+    }
+
+    if ( options.highlight_changes && !regions.empty() )
+    {
+        cairo_save(cr_out);
+        cairo_set_source_rgb(cr_out, 1, 0, 0);
+        // 1pt wide lines
+        cairo_set_line_width(cr_out, options.resolution / 72.0);
+        for ( size_t i = 0; i < regions.size(); i++ )
+        {
+            const DiffRegion& r = regions[i];
+            cairo_rectangle(cr_out, r.x, y + r.y, r.width, r.height);
+        }
+        cairo_stroke(cr_out);
+        cairo_restore(cr_out);
+    }
+}
+
+
+// Draws image of differences of two pages to cr_out, rendering and comparing
+// them again in bands of options' band_height rows, so that the whole page's
+// images never need to be in memory.
+void output_diff_in_bands(const DiffOptions& options, cairo_t *cr_out,
+                          PopplerPage *page1, PopplerPage *page2)
+{
+    int w_px, h_px;
+    get_page_size_px(page1, options.resolution, &w_px, &h_px);
+
+    cairo_save(cr_out);
+    cairo_scale(cr_out, 72.0 / options.resolution, 72.0 / options.resolution);
+
+    for ( int y = 0; y < h_px; y += options.band_height )
+    {
+        const int height = std::min(int(options.band_height), h_px - y);
+
+        cairo_surface_t *img1 =
+            render_page_band(options, page1, y, height, options.resolution);
+        cairo_surface_t *img2 =
+            render_page_band(options, page2, y, height, options.resolution);
+
+        long pixel_diff_count;
+        bool changes;
+        std::vector<DiffRegion> regions;
+        cairo_surface_t *diff = make_diff_image(options, img1, img2, 0, 0,
+                                                NULL, -1,
+                                                &pixel_diff_count, &changes,
+                                                NULL, NULL,
+                                                options.patch_output ? &regions : NULL);
+
+        if ( options.patch_output )
+        {
+            paint_diff_regions(options, cr_out, diff, y, regions);
+        }
+        else
+        {
+            cairo_set_source_surface(cr_out, diff, 0, y);
+            cairo_paint(cr_out);
+        }
+
+        cairo_surface_destroy(diff);
+        cairo_surface_destroy(img1);
+        cairo_surface_destroy(img2);
+    }
+
+    cairo_restore(cr_out);
+}
+
+
+// Draws compared page into cr_out: either the image of differences or the
+// unmodified page1, if there are no diffs. With options' patch_output, pages
+// with differences are drawn as page1 with images of only the changed
+// regions over it.
+void page_output(const DiffOptions& doc_options, cairo_t *cr_out,
+                 PopplerPage *page1, PopplerPage *page2,
+                 const PageResult& result)
+{
+    const DiffOptions options = get_page_options(doc_options, result);
+
+    // keep the vector content where nothing changed
+    if ( options.patch_output && !result.same && page1 )
+        poppler_page_render(page1, cr_out);
+
+    if ( result.banded && !result.same )
+    {
+        output_diff_in_bands(options, cr_out, page1, page2);
+    }
+    else if ( result.diff && options.patch_output )
+    {
+        cairo_save(cr_out);
+        cairo_scale(cr_out, 72.0 / options.resolution, 72.0 / options.resolution);
+        paint_diff_regions(options, cr_out, result.diff, 0, result.regions);
+        cairo_restore(cr_out);
+    }
+    else if ( result.diff )
+    {
+        // render the difference as high-resolution bitmap
+
+        cairo_save(cr_out);
+        cairo_scale(cr_out, 72.0 / options.resolution, 72.0 / options.resolution);
+
+        cairo_set_source_surface(cr_out, result.diff, 0, 0);
+        cairo_paint(cr_out);
+
+        cairo_restore(cr_out);
+    }
+    else
+    {
+        // save space (as well as improve rendering quality) in diff pdf
+        // by writing unchanged pages in their original form rather than
+        // a rasterized one
+
+        if (!options.skip_identical)
+           poppler_page_render(page1, cr_out);
+    }
+
+    if (!result.same || !options.skip_identical)
+        cairo_show_page(cr_out);
+}
+
+
+// Task run by the worker pool's threads.
+class PoolJob
+{
+public:
+    virtual ~PoolJob() {}
+    virtual void Run() = 0;
+};
+
+// Threads that run PageWorkers' and BackgroundCompare's workers. The pool is
+// shared by all comparisons done by the process and has as many threads as
+// the comparison with the most jobs uses.
+static GThreadPool *g_worker_pool = NULL;
+static GMutex g_worker_pool_lock;
+
+static void worker_pool_func(gpointer data, gpointer user_data);
+
+static GThreadPool *get_worker_pool(int jobs)
+{
+    g_mutex_lock(&g_worker_pool_lock);
+
+    if ( !g_worker_pool )
+    {
+        g_worker_pool = g_thread_pool_new(worker_pool_func, NULL,
+                                          jobs, FALSE, NULL);
+    }
+    else if ( g_thread_pool_get_max_threads(g_worker_pool) < jobs )
+    {
+        g_thread_pool_set_max_threads(g_worker_pool, jobs, NULL);
+    }
+
+    GThreadPool *pool = g_worker_pool;
+
+    g_mutex_unlock(&g_worker_pool_lock);
+
+    return pool;
+}
+
+
+void shutdown_worker_pool()
+{
+    g_mutex_lock(&g_worker_pool_lock);
+
+    if ( g_worker_pool )
+    {
+        g_thread_pool_free(g_worker_pool, FALSE, TRUE);
+        g_worker_pool = NULL;
+    }
+
+    g_mutex_unlock(&g_worker_pool_lock);
+}
+
+
+// Workers comparing pages of two documents in parallel, in g_worker_pool's
+// threads. Every worker has its own instances of the documents and picks
+// pairs of pages in order; finished results are kept in a reorder buffer until
+// doc_compare() asks for them, so that they can be processed in the same
+// order as in serial comparison.
+class PageWorkers
+{
+public:
+    PageWorkers(const DiffOptions& options,
+                PopplerDocument *doc1, PopplerDocument *doc2,
+                const std::vector<PagePair>& pairs,
+                int jobs, int flags)
+        : m_options(options),
+          m_flags(flags),
+          m_pairs(pairs),
+          m_next_page(0),
+          m_next_result(0),
+          m_cancelled(false),
+          m_running(0)
+    {
+        g_mutex_init(&m_lock);
+        g_cond_init(&m_cond);
+
+        m_pages_total = (int)m_pairs.size();
+
+        // don't let the workers run too far ahead of the consumer, finished
+        // pages may hold large diff images
+        m_window = 2 * jobs;
+
+        for ( int i = 0; i < jobs; i++ )
+        {
+            GError *err = NULL;
+            Worker *w = new Worker;
+            w->owner = this;
+            w->doc1 = open_document_copy(doc1, &err);
+            w->doc2 = w->doc1 ? open_document_copy(doc2, &err) : NULL;
+            if ( !w->doc2 )
+            {
+                fprintf(stderr, "Error starting worker thread: %s\n", err->message);
+                g_error_free(err);
+                if ( w->doc1 )
+                    g_object_unref(w->doc1);
+                delete w;
+                break;
+            }
+
+            m_workers.push_back(w);
+        }
+
+        m_running = (int)m_workers.size();
+
+        for ( size_t i = 0; i < m_workers.size(); i++ )
+            g_thread_pool_push(get_worker_pool(jobs), m_workers[i], NULL);
+    }
+
+    ~PageWorkers()
+    {
+        g_mutex_lock(&m_lock);
+        m_cancelled = true;
+        g_cond_broadcast(&m_cond);
+        while ( m_running > 0 )
+            g_cond_wait(&m_cond, &m_lock);
+        g_mutex_unlock(&m_lock);
+
+        for ( size_t i = 0; i < m_workers.size(); i++ )
+        {
+            Worker *w = m_workers[i];
+            g_object_unref(w->doc1);
+            g_object_unref(w->doc2);
+            delete w;
+        }
+
+        for ( std::map<int, PageResult>::iterator i = m_results.begin();
+              i != m_results.end();
+              ++i )
+        {
+            i->second.DestroyImages();
+        }
+
+        g_cond_clear(&m_cond);
+        g_mutex_clear(&m_lock);
+    }
+
+    // were any workers started?
+    bool IsOk() const { return !m_workers.empty(); }
+
+    // Waits until given page is compared and moves its result into 'result'.
+    // Pages must be retrieved in order.
+    void GetResult(int page, PageResult& result)
+    {
+        g_mutex_lock(&m_lock);
+
+        assert( page == m_next_result );
+
+        std::map<int, PageResult>::iterator i;
+        while ( (i = m_results.find(page)) == m_results.end() )
+            g_cond_wait(&m_cond, &m_lock);
+
+        result.Swap(i->second);
+        m_results.erase(i);
+
+        m_next_result = page + 1;
+        g_cond_broadcast(&m_cond);
+
+        g_mutex_unlock(&m_lock);
+    }
+
+private:
+    struct Worker : public PoolJob
+    {
+        PageWorkers *owner;
+        PopplerDocument *doc1, *doc2;
+
+        // called in a pool thread to do the worker's share of comparisons
+        virtual void Run()
+        {
+            owner->Run(doc1, doc2);
+
+            g_mutex_lock(&owner->m_lock);
+            owner->m_running--;
+            g_cond_broadcast(&owner->m_cond);
+            g_mutex_unlock(&owner->m_lock);
+        }
+    };
+
+    void Run(PopplerDocument *doc1, PopplerDocument *doc2)
+    {
+        for ( ;; )
+        {
+            g_mutex_lock(&m_lock);
+
+            while ( !m_cancelled &&
+                    m_next_page < m_pages_total &&
+                    m_next_page >= m_next_result + m_window )
+            {
+                g_cond_wait(&m_cond, &m_lock);
+            }
+
+            if ( m_cancelled || m_next_page >= m_pages_total )
+            {
+                g_mutex_unlock(&m_lock);
+                return;
+            }
+
+            const int page = m_next_page++;
+
+            g_mutex_unlock(&m_lock);
+
+            PopplerPage *page1 = get_document_page(doc1, m_pairs[page].page1);
+            PopplerPage *page2 = get_document_page(doc2, m_pairs[page].page2);
+
+            PageResult result;
+            page_diff(m_options, page1, page2, result, m_flags);
+
+            if ( page1 )
+                g_object_unref(page1);
+            if ( page2 )
+                g_object_unref(page2);
+
+            g_mutex_lock(&m_lock);
+            m_results[page].Swap(result);
+            g_cond_broadcast(&m_cond);
+            g_mutex_unlock(&m_lock);
+        }
+    }
+
+private:
+    const DiffOptions m_options;
+    const int m_flags;
+    const std::vector<PagePair> m_pairs;
+    int m_pages_total;
+    int m_window;
+
+    std::vector<Worker*> m_workers;
+
+    // everything below is protected by m_lock
+    GMutex m_lock;
+    GCond m_cond;
+    int m_next_page;
+    int m_next_result;
+    bool m_cancelled;
+    int m_running;
+    std::map<int, PageResult> m_results;
+};
+
+
+static void worker_pool_func(gpointer data, gpointer /* user_data */)
+{
+    ((PoolJob*)data)->Run();
+}
+
+
+// Computes signatures of all pages of a document in g_worker_pool's threads,
+// every worker with its own instance of the document.
+class SignatureWorkers
+{
+public:
+    SignatureWorkers(const DiffOptions& options, PopplerDocument *doc,
+                     std::vector<guint64>& signatures)
+        : m_options(options),
+          m_signatures(signatures),
+          m_next_page(0),
+          m_running(0)
+    {
+        g_mutex_init(&m_lock);
+        g_cond_init(&m_cond);
+
+        m_pages = poppler_document_get_n_pages(doc);
+        m_signatures.assign(m_pages, 0);
+
+        int jobs = m_options.jobs > 1 ? (int)m_options.jobs : 1;
+        if ( jobs > m_pages )
+            jobs = m_pages;
+
+        // the document itself is used if no copies can be made
+        m_doc = doc;
+        for ( int i = 1; i < jobs; i++ )
+        {
+            Worker *w = new Worker;
+            w->owner = this;
+            w->doc = open_document_copy(doc, NULL);
+            if ( !w->doc )
+            {
+                delete w;
+                break;
+            }
+            m_workers.push_back(w);
+        }
+    }
+
+    ~SignatureWorkers()
+    {
+        for ( size_t i = 0; i < m_workers.size(); i++ )
+        {
+            g_object_unref(m_workers[i]->doc);
+            delete m_workers[i];
+        }
+
+        g_cond_clear(&m_cond);
+        g_mutex_clear(&m_lock);
+    }
+
+    // Computes the signatures, using the calling thread too, and waits until
+    // all of them are done.
+    void Run()
+    {
+        m_running = (int)m_workers.size();
+        for ( size_t i = 0; i < m_workers.size(); i++ )
+        {
+            g_thread_pool_push(get_worker_pool((int)m_workers.size()),
+                               m_workers[i], NULL);
+        }
+
+        Compute(m_doc);
+
+        g_mutex_lock(&m_lock);
+        while ( m_running > 0 )
+            g_cond_wait(&m_cond, &m_lock);
+        g_mutex_unlock(&m_lock);
+    }
+
+private:
+    struct Worker : public PoolJob
+    {
+        SignatureWorkers *owner;
+        PopplerDocument *doc;
+
+        virtual void Run()
+        {
+            owner->Compute(doc);
+
+            g_mutex_lock(&owner->m_lock);
+            owner->m_running--;
+            g_cond_broadcast(&owner->m_cond);
+            g_mutex_unlock(&owner->m_lock);
+        }
+    };
+
+    void Compute(PopplerDocument *doc)
+    {
+        int page;
+        while ( (page = g_atomic_int_add(&m_next_page, 1)) < m_pages )
+        {
+            PopplerPage *p = get_document_page(doc, page);
+            m_signatures[page] = get_page_signature(m_options, p);
+            g_object_unref(p);
+        }
+    }
+
+private:
+    const DiffOptions& m_options;
+    std::vector<guint64>& m_signatures;
+    PopplerDocument *m_doc;
+    int m_pages;
+    std::vector<Worker*> m_workers;
+
+    gint m_next_page;
+
+    // protected by m_lock
+    GMutex m_lock;
+    GCond m_cond;
+    int m_running;
+};
+
+
+std::vector<PagePair> get_page_pairs(const DiffOptions& options,
+                                     PopplerDocument *doc1,
+                                     PopplerDocument *doc2)
+{
+    const int pages1 = poppler_document_get_n_pages(doc1);
+    const int pages2 = poppler_document_get_n_pages(doc2);
+
+    if ( !options.align_pages )
+    {
+        std::vector<PagePair> pairs;
+        for ( int i = 0; i < pages1 || i < pages2; i++ )
+            pairs.push_back(PagePair(i < pages1 ? i : -1, i < pages2 ? i : -1));
+        return pairs;
+    }
+
+    std::vector<guint64> sigs1, sigs2;
+    SignatureWorkers(options, doc1, sigs1).Run();
+    SignatureWorkers(options, doc2, sigs2).Run();
+
+    return align_page_sequences(sigs1, sigs2);
+}
+
+
+struct BackgroundCompare::Worker : public PoolJob
+{
+    BackgroundCompare *owner;
+    PopplerDocument *doc1, *doc2;
+
+    virtual void Run()
+    {
+        int page;
+        while ( owner->TakePage(&page) )
+        {
+            PopplerPage *page1 = get_document_page(doc1, page);
+            PopplerPage *page2 = get_document_page(doc2, page);
+
+            if ( owner->m_observer )
+                owner->m_observer->OnPageStart(page, owner->m_pages_total);
+
+            PageResult result;
+            page_diff(owner->m_options, page1, page2, result, owner->m_flags);
+
+            if ( page1 )
+                g_object_unref(page1);
+            if ( page2 )
+                g_object_unref(page2);
+
+            if ( owner->m_observer )
+                owner->m_observer->OnPageDone(page, result);
+
+            result.DestroyImages();
+        }
+
+        owner->WorkerDone();
+    }
+};
+
+
+BackgroundCompare::BackgroundCompare(const DiffOptions& options,
+                                     PopplerDocument *doc1,
+                                     PopplerDocument *doc2,
+                                     CompareObserver *observer)
+    : m_options(options),
+      m_doc1(doc1),
+      m_doc2(doc2),
+      m_observer(observer),
+      m_flags(0),
+      m_next_page(0),
+      m_priority_page(-1),
+      m_cancelled(false),
+      m_running(0)
+{
+    g_mutex_init(&m_lock);
+    g_cond_init(&m_cond);
+
+    const int pages1 = poppler_document_get_n_pages(doc1);
+    const int pages2 = poppler_document_get_n_pages(doc2);
+    m_pages_total = pages1 > pages2 ? pages1 : pages2;
+
+    m_taken.resize(m_pages_total, false);
+
+    const bool thumbnails = observer && observer->WantsThumbnails();
+    const bool keep_images = observer && observer->WantsImages();
+    const bool components = observer && observer->WantsComponents();
+
+    if ( thumbnails )
+        m_flags |= PAGE_DIFF_THUMBNAIL;
+    if ( keep_images )
+        m_flags |= PAGE_DIFF_KEEP_IMAGES;
+    if ( options.compare_ops && !thumbnails && !keep_images )
+        m_flags |= PAGE_DIFF_OPS;
+    if ( components )
+        m_flags |= PAGE_DIFF_COMPONENTS;
+}
+
+
+BackgroundCompare::~BackgroundCompare()
+{
+    g_mutex_lock(&m_lock);
+    m_cancelled = true;
+    while ( m_running > 0 )
+        g_cond_wait(&m_cond, &m_lock);
+    g_mutex_unlock(&m_lock);
+
+    for ( size_t i = 0; i < m_workers.size(); i++ )
+    {
+        Worker *w = m_workers[i];
+        g_object_unref(w->doc1);
+        g_object_unref(w->doc2);
+        delete w;
+    }
+
+    g_cond_clear(&m_cond);
+    g_mutex_clear(&m_lock);
+}
+
+
+bool BackgroundCompare::Start()
+{
+    if ( m_pages_total == 0 )
+        return true;
+
+    int jobs = m_options.jobs > 1 ? (int)m_options.jobs : 1;
+    if ( jobs > m_pages_total )
+        jobs = m_pages_total;
+
+    for ( int i = 0; i < jobs; i++ )
+    {
+        GError *err = NULL;
+        Worker *w = new Worker;
+        w->owner = this;
+        w->doc1 = open_document_copy(m_doc1, &err);
+        w->doc2 = w->doc1 ? open_document_copy(m_doc2, &err) : NULL;
+        if ( !w->doc2 )
+        {
+            fprintf(stderr, "Error starting worker thread: %s\n", err->message);
+            g_error_free(err);
+            if ( w->doc1 )
+                g_object_unref(w->doc1);
+            delete w;
+            break;
+        }
+
+        m_workers.push_back(w);
+    }
+
+    m_running = (int)m_workers.size();
+
+    for ( size_t i = 0; i < m_workers.size(); i++ )
+        g_thread_pool_push(get_worker_pool(jobs), m_workers[i], NULL);
+
+    return !m_workers.empty();
+}
+
+
+void BackgroundCompare::Prioritize(int page)
+{
+    g_mutex_lock(&m_lock);
+    m_priority_page = page;
+    g_mutex_unlock(&m_lock);
+}
+
+
+bool BackgroundCompare::TakePage(int *page)
+{
+    g_mutex_lock(&m_lock);
+
+    bool found = false;
+
+    if ( !m_cancelled )
+    {
+        if ( m_priority_page >= 0 && m_priority_page < m_pages_total &&
+             !m_taken[m_priority_page] )
+        {
+            *page = m_priority_page;
+            found = true;
+        }
+        else
+        {
+            while ( m_next_page < m_pages_total && m_taken[m_next_page] )
+                m_next_page++;
+
+            if ( m_next_page < m_pages_total )
+            {
+                *page = m_next_page;
+                found = true;
+            }
+        }
+
+        if ( found )
+        {
+            m_taken[*page] = true;
+            if ( *page == m_priority_page )
+                m_priority_page = -1;
+        }
+    }
+
+    g_mutex_unlock(&m_lock);
+
+    return found;
+}
+
+
+void BackgroundCompare::WorkerDone()
+{
+    g_mutex_lock(&m_lock);
+    m_running--;
+    g_cond_broadcast(&m_cond);
+    g_mutex_unlock(&m_lock);
+}
+
+
+// Writes the string to the file as a JSON string literal.
+void json_write_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for ( ; *s; s++ )
+    {
+        const unsigned char c = *s;
+        if ( c == '"' || c == '\\' )
+            fprintf(f, "\\%c", c);
+        else if ( c < 0x20 )
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+
+// Writes size of the page in points and in rendered pixels as a JSON object,
+// or null if there's no page.
+void json_write_page_size(const DiffOptions& options,
+                          FILE *f, PopplerPage *page)
+{
+    if ( !page )
+    {
+        fputs("null", f);
+        return;
+    }
+
+    double w, h;
+    poppler_page_get_size(page, &w, &h);
+    int w_px, h_px;
+    get_page_size_px(page, options.resolution, &w_px, &h_px);
+
+    fprintf(f, "{ \"width_pt\": %g, \"height_pt\": %g, "
+               "\"width_px\": %d, \"height_px\": %d }",
+            w, h, w_px, h_px);
+}
+
+
+// Writes the result of comparing one pair of pages as an element of the
+// report's "pages" array.
+void json_write_page_result(const DiffOptions& options,
+                            FILE *f, int page, const PagePair& pair,
+                            PopplerPage *page1, PopplerPage *page2,
+                            const PageResult& result)
+{
+    const char *method = result.same_ops ? "ops"
+                         : result.banded ? "bands"
+                         : "full";
+
+    fprintf(f, "    {\n");
+    fprintf(f, "      \"page\": %d,\n", page);
+    if ( pair.page1 >= 0 )
+        fprintf(f, "      \"page1\": %d,\n", pair.page1);
+    else
+        fprintf(f, "      \"page1\": null,\n");
+    if ( pair.page2 >= 0 )
+        fprintf(f, "      \"page2\": %d,\n", pair.page2);
+    else
+        fprintf(f, "      \"page2\": null,\n");
+    fprintf(f, "      \"differs\": %s,\n", result.same ? "false" : "true");
+    fprintf(f, "      \"method\": \"%s\",\n", method);
+    // pages that didn't fit into the memory budget at the document's
+    // resolution were compared at a lower one
+    const DiffOptions page_options = get_page_options(options, result);
+    if ( result.resolution )
+        fprintf(f, "      \"resolution\": %ld,\n", result.resolution);
+    fprintf(f, "      \"size1\": ");
+    json_write_page_size(page_options, f, page1);
+    fprintf(f, ",\n      \"size2\": ");
+    json_write_page_size(page_options, f, page2);
+    fprintf(f, ",\n");
+    fprintf(f, "      \"pixel_diff_count\": %ld,\n", result.pixel_diff_count);
+    fprintf(f, "      \"offset\": { \"x\": %d, \"y\": %d },\n",
+            result.offset_x, result.offset_y);
+
+    if ( result.has_stats )
+    {
+        const DiffStats& stats = result.stats;
+
+        fprintf(f, "      \"max_channel_delta\": %d,\n", stats.max_delta);
+
+        fprintf(f, "      \"channel_delta_histogram\": [");
+        for ( int i = 0; i < 256; i++ )
+            fprintf(f, i ? ", %ld" : "%ld", stats.histogram[i]);
+        fprintf(f, "],\n");
+
+        if ( stats.HasBoundingBox() )
+        {
+            fprintf(f, "      \"diff_bbox\": { \"x\": %d, \"y\": %d, "
+                       "\"width\": %d, \"height\": %d },\n",
+                    stats.x1, stats.y1,
+                    stats.x2 - stats.x1 + 1, stats.y2 - stats.y1 + 1);
+        }
+        else
+        {
+            fprintf(f, "      \"diff_bbox\": null,\n");
+        }
+    }
+    else
+    {
+        fprintf(f, "      \"max_channel_delta\": null,\n");
+        fprintf(f, "      \"channel_delta_histogram\": null,\n");
+        fprintf(f, "      \"diff_bbox\": null,\n");
+    }
+
+    if ( result.has_components )
+    {
+        fprintf(f, "      \"regions\": [");
+        for ( size_t i = 0; i < result.components.size(); i++ )
+        {
+            const DiffComponent& c = result.components[i];
+            fprintf(f, "%s\n        { \"x\": %d, \"y\": %d, "
+                       "\"width\": %d, \"height\": %d, \"pixels\": %ld }",
+                    i ? "," : "", c.x, c.y, c.width, c.height, c.pixel_count);
+        }
+        fprintf(f, result.components.empty() ? "],\n" : "\n      ],\n");
+    }
+    else
+    {
+        fprintf(f, "      \"regions\": null,\n");
+    }
+
+    const PhaseTimes& t = result.times;
+    fprintf(f, "      \"render_time_ms\": %.3f,\n",
+            (t.times[PHASE_RENDER1] + t.times[PHASE_RENDER2]) / 1000.0);
+    fprintf(f, "      \"diff_time_ms\": %.3f\n", t.times[PHASE_DIFF] / 1000.0);
+    fprintf(f, "    }");
+}
+
+
+bool doc_compare(const DiffOptions& options,
+                 PopplerDocument *doc1, PopplerDocument *doc2,
+                 const char *pdf_output,
+                 std::vector<bool> *differences,
+                 CompareObserver *observer,
+                 const char *report_output,
+                 const char *png_dir,
+                 const char *mask_dir)
+{
+    const bool thumbnails = observer && observer->WantsThumbnails();
+    const bool keep_images = observer && observer->WantsImages();
+    const bool components = observer && observer->WantsComponents();
+
+    int pages_differ = 0;
+    int pages_same_ops = 0;
+
+    cairo_surface_t *surface_out = NULL;
+    cairo_t *cr_out = NULL;
+
+    if ( pdf_output )
+    {
+        double w, h;
+        poppler_page_get_size(poppler_document_get_page(doc1, 0), &w, &h);
+        surface_out = cairo_pdf_surface_create(pdf_output, w, h);
+        cr_out = cairo_create(surface_out);
+    }
+
+    int pages1 = poppler_document_get_n_pages(doc1);
+    int pages2 = poppler_document_get_n_pages(doc2);
+
+    if ( pages1 != pages2 )
+    {
+        if ( options.verbose )
+            printf("pages count differs: %d vs %d\n", pages1, pages2);
+    }
+
+    const std::vector<PagePair> pairs = get_page_pairs(options, doc1, doc2);
+    int pages_total = (int)pairs.size();
+    int pages_inserted = 0;
+    int pages_deleted = 0;
+
+    FILE *report = NULL;
+    if ( report_output )
+    {
+        report = g_fopen(report_output, "w");
+        if ( report )
+        {
+            fprintf(report, "{\n  \"file1\": ");
+            json_write_string(report, (const char*)g_object_get_data(G_OBJECT(doc1), "diff-pdf-name"));
+            fprintf(report, ",\n  \"file2\": ");
+            json_write_string(report, (const char*)g_object_get_data(G_OBJECT(doc2), "diff-pdf-name"));
+            fprintf(report, ",\n");
+            fprintf(report, "  \"resolution\": %ld,\n", options.resolution);
+            fprintf(report, "  \"channel_tolerance\": %ld,\n", options.channel_tolerance);
+            fprintf(report, "  \"per_page_pixel_tolerance\": %ld,\n", options.per_page_pixel_tolerance);
+            fprintf(report, "  \"min_region_size\": %ld,\n", options.min_region_size);
+            fprintf(report, "  \"pages\": [\n");
+        }
+        else
+        {
+            fprintf(stderr, "Error creating report file %s\n", report_output);
+        }
+    }
+
+    // Images of differing pages are written in their own threads, so that
+    // encoding them overlaps with comparing the next pages.
+    ImageWriter *image_writer = NULL;
+    if ( png_dir || mask_dir )
+    {
+        if ( png_dir )
+            g_mkdir_with_parents(png_dir, 0777);
+        if ( mask_dir )
+            g_mkdir_with_parents(mask_dir, 0777);
+        image_writer = new ImageWriter((int)options.jobs);
+    }
+
+    // If we don't need to output all different pages in any form (including
+    // verbose report of differing pages!), then we can stop comparing the
+    // PDFs as soon as we find the first difference.
+    const bool first_difference_only =
+        !options.verbose && !pdf_output && !differences && !observer && !report &&
+        !image_writer;
+
+    int flags = 0;
+    if ( pdf_output || png_dir )
+        flags |= PAGE_DIFF_KEEP_DIFF;
+    if ( png_dir )
+        flags |= PAGE_DIFF_NO_BANDS;
+    if ( mask_dir )
+        flags |= PAGE_DIFF_MASK;
+    if ( keep_images )
+        flags |= PAGE_DIFF_KEEP_IMAGES;
+    if ( thumbnails )
+        flags |= PAGE_DIFF_THUMBNAIL;
+    if ( options.prepass_resolution && first_difference_only )
+        flags |= PAGE_DIFF_PREPASS;
+    // thumbnails and kept images need the rendered page
+    if ( options.compare_ops && !thumbnails && !keep_images )
+        flags |= PAGE_DIFF_OPS;
+    if ( report )
+        flags |= PAGE_DIFF_STATS;
+    if ( report || components )
+        flags |= PAGE_DIFF_COMPONENTS;
+
+    PageWorkers *workers = NULL;
+    if ( options.jobs > 1 && pages_total > 1 )
+    {
+        workers = new PageWorkers(options, doc1, doc2, pairs,
+                                  options.jobs < pages_total ? options.jobs : pages_total,
+                                  flags);
+        if ( !workers->IsOk() )
+        {
+            delete workers;
+            workers = NULL;
+        }
+    }
+
+    for ( int page = 0; page < pages_total; page++ )
+    {
+        if ( observer )
+            observer->OnPageStart(page, pages_total);
+
+        const PagePair& pair = pairs[page];
+        PopplerPage *page1 = get_document_page(doc1, pair.page1);
+        PopplerPage *page2 = get_document_page(doc2, pair.page2);
+
+        if ( pdf_output && page != 0 )
+        {
+            double w, h;
+            poppler_page_get_size(page1 ? page1 : page2, &w, &h);
+            cairo_pdf_surface_set_size(surface_out, w, h);
+        }
+
+        if ( !page1 )
+        {
+            pages_inserted++;
+            if ( options.verbose )
+                printf("page %d of file2 was inserted\n", pair.page2);
+        }
+        else if ( !page2 )
+        {
+            pages_deleted++;
+            if ( options.verbose )
+                printf("page %d of file1 was deleted\n", pair.page1);
+        }
+
+        PageResult result;
+        if ( workers )
+            workers->GetResult(page, result);
+        else
+            page_diff(options, page1, page2, result, flags);
+
+        // the result is less precise, which must not go unnoticed
+        if ( result.resolution )
+        {
+            fprintf(stderr, "Warning: page %d was compared at %ld DPI instead of %ld to fit into the memory limit\n",
+                    page, result.resolution, options.resolution);
+        }
+
+        if ( options.verbose )
+        {
+            printf("page %d has %ld pixels that differ\n", page, result.pixel_diff_count);
+        }
+
+        if ( cr_out )
+        {
+            const gint64 output_start = g_get_monotonic_time();
+            page_output(options, cr_out, page1, page2, result);
+            result.times.times[PHASE_OUTPUT] = g_get_monotonic_time() - output_start;
+        }
+
+        if ( image_writer && !result.same )
+        {
+            char name[32];
+            g_snprintf(name, sizeof(name), "page-%04d.png", page);
+
+            if ( png_dir && result.diff )
+            {
+                gchar *path = g_build_filename(png_dir, name, NULL);
+                image_writer->Write(result.diff, path);
+                g_free(path);
+            }
+            if ( mask_dir && result.mask.IsOk() )
+            {
+                // the writer keeps its own reference to the bitmap
+                cairo_surface_t *mask = result.mask.CreateSurface();
+                gchar *path = g_build_filename(mask_dir, name, NULL);
+                image_writer->Write(mask, path);
+                g_free(path);
+                cairo_surface_destroy(mask);
+            }
+        }
+
+        if ( options.stats )
+            options.stats->AddPage(page, result.times);
+
+        if ( report )
+        {
+            if ( page != 0 )
+                fprintf(report, ",\n");
+            json_write_page_result(options, report, page, pair,
+                                   page1, page2, result);
+        }
+
+        if ( page1 )
+            g_object_unref(page1);
+        if ( page2 )
+            g_object_unref(page2);
+
+        if ( observer )
+            observer->OnPageDone(page, result);
+
+        result.DestroyImages();
+
+        if ( differences )
+            differences->push_back(!result.same);
+
+        if ( result.same_ops )
+            pages_same_ops++;
+
+        if ( !result.same )
+        {
+	    pages_differ ++;
+
+            if ( options.verbose )
+                printf("page %d differs\n", page);
+
+            if ( first_difference_only )
+                break;
+        }
+    }
+
+    // stops the workers, discarding any pages compared ahead
+    delete workers;
+
+    if ( image_writer )
+    {
+        const gint64 output_start = g_get_monotonic_time();
+        image_writer->Finish();
+        delete image_writer;
+        if ( options.stats )
+            options.stats->AddTime(PHASE_OUTPUT, g_get_monotonic_time() - output_start);
+    }
+
+    if ( pdf_output )
+    {
+        // finishing the surface writes out the rest of the PDF
+        const gint64 output_start = g_get_monotonic_time();
+        cairo_destroy(cr_out);
+        cairo_surface_destroy(surface_out);
+        if ( options.stats )
+            options.stats->AddTime(PHASE_OUTPUT, g_get_monotonic_time() - output_start);
+    }
+
+    if ( report )
+    {
+        fprintf(report, "\n  ],\n");
+        fprintf(report, "  \"pages1\": %d,\n", pages1);
+        fprintf(report, "  \"pages2\": %d,\n", pages2);
+        fprintf(report, "  \"pages_inserted\": %d,\n", pages_inserted);
+        fprintf(report, "  \"pages_deleted\": %d,\n", pages_deleted);
+        fprintf(report, "  \"pages_differ\": %d,\n", pages_differ);
+        fprintf(report, "  \"same\": %s\n",
+                (pages_differ == 0) && (pages1 == pages2) ? "true" : "false");
+        fprintf(report, "}\n");
+        fclose(report);
+    }
+
+    if (options.verbose)
+    {
+        printf("%d of %d pages differ.\n", pages_differ, pages_total);
+        if ( options.compare_ops )
+            printf("%d pages have identical drawing operations and were not rendered.\n", pages_same_ops);
+    }
+
+    // are doc1 and doc1 the same?
+    return (pages_differ == 0) && (pages1 == pages2);
+}
+
+
@@ -0,0 +1,409 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _diffpdf_h_
+#define _diffpdf_h_
+
+// The comparison engine of diff-pdf. It doesn't depend on wxWidgets, so that
+// it can be used by both the command line program and the GUI, and several
+// comparisons can run at the same time. The only global state is the pool of
+// worker threads shared by all comparisons, which is created when it's first
+// needed and must be freed by shutdown_worker_pool() before exiting.
+
+#include "align.h"
+#include "components.h"
+#include "diffkernel.h"
+#include "diffmask.h"
+#include "stats.h"
+
+#include <string>
+#include <vector>
+
+#include <glib.h>
+#include <poppler.h>
+#include <cairo/cairo.h>
+
+class MemoryBudget;
+class RasterCache;
+
+// Resolution to use for rasterization by default, in DPI
+#define DEFAULT_RESOLUTION 300
+
+// Width of thumbnails of pages created for the GUI's gutter, in pixels
+#define THUMBNAIL_WIDTH 100
+
+// Options of comparing documents.
+struct DiffOptions
+{
+    DiffOptions();
+
+    bool verbose;
+    bool skip_identical;
+    bool mark_differences;
+    long channel_tolerance;
+    long per_page_pixel_tolerance;
+    bool grayscale;
+    // Resolution to use for rasterization, in DPI
+    long resolution;
+    // Number of worker threads to compare pages with
+    long jobs;
+    // Resolution of the quick comparison done before rendering at
+    // 'resolution', in DPI; 0 if disabled. It's not done if any tolerance is
+    // set, as it can't tell differences within them from others
+    long prepass_resolution;
+    // Height of bands in which pages are rendered and compared, in pixels; 0
+    // to render whole pages at once
+    long band_height;
+    // Compare drawing operations of pages first and don't render pages with
+    // identical operations
+    bool compare_ops;
+    // Find the offset of shifted content of every page and compare the
+    // pages at that offset (see find_image_offset())
+    bool auto_align;
+    // Largest offset looked for by auto_align, in pixels
+    long max_align_offset;
+    // Pair pages of the documents by their content instead of by their
+    // numbers, so that inserted or deleted pages are detected (see
+    // get_page_pairs())
+    bool align_pages;
+    // Keep pages of the diff PDF as vector content and only overlay images
+    // of the changed regions
+    bool patch_output;
+    // Outline the changed regions in the diff PDF with rectangles
+    bool highlight_changes;
+    // Ignore connected clusters of differing pixels smaller than this many
+    // pixels (see ComponentLabeler); 0 to count all differing pixels
+    long min_region_size;
+    // Cache of rendered pages of documents that have their content hash set
+    // (see set_document_hash()); NULL if not used. Not owned.
+    RasterCache *raster_cache;
+    // Timing and memory statistics of the run; NULL if not collected. Not
+    // owned.
+    RunStats *stats;
+    // Limit of memory used by rendered pages; pages that don't fit into it
+    // are compared in bands or, if the budget allows it, at lower resolution
+    // (see page_diff()). NULL if memory use isn't limited. Not owned.
+    MemoryBudget *memory_budget;
+};
+
+// Rectangle of the image of differences containing some of them, in pixels.
+struct DiffRegion
+{
+    DiffRegion(int x_, int y_, int width_, int height_)
+        : x(x_), y(y_), width(width_), height(height_) {}
+
+    int x, y, width, height;
+};
+
+// Small image of the page with highlighted differences, in RGB format with 3
+// bytes per pixel.
+struct Thumbnail
+{
+    Thumbnail() : width(0), height(0) {}
+
+    void Create(int w, int h);
+    bool IsOk() const { return width > 0; }
+
+    unsigned char *GetPixel(int x, int y) { return &data[3 * (y * width + x)]; }
+
+    int width, height;
+    std::vector<unsigned char> data;
+};
+
+// Result of comparing two pages, computed by page_diff() and written out by
+// page_output().
+struct PageResult
+{
+    PageResult()
+        : diff(NULL), image1(NULL), image2(NULL),
+          banded(false), same_ops(false),
+          pixel_diff_count(0), same(true),
+          offset_x(0), offset_y(0),
+          resolution(0), band_height(0),
+          has_components(false),
+          has_stats(false)
+    {}
+
+    // Destroys the images held by the result.
+    void DestroyImages();
+
+    // Exchanges content with the other result, without copying the images,
+    // regions and other data of variable size.
+    void Swap(PageResult& other);
+
+    // image of differences, only composed if the pages differ and it's
+    // needed for output
+    cairo_surface_t *diff;
+    // regions of the diff image with differences, only found if the diff is
+    // kept and options' patch_output is set
+    std::vector<DiffRegion> regions;
+    // differing pixels of the diff image, only found if requested and if the
+    // pages were rendered whole
+    DiffMask mask;
+    // rendered pages, only kept if the observer wants them
+    cairo_surface_t *image1, *image2;
+    // set if the page was compared in bands (see DiffOptions::band_height);
+    // the diff image is never kept then and page_output() renders it band by
+    // band
+    bool banded;
+    // set if the pages were found identical without rendering them, because
+    // they consist of the same drawing operations (see
+    // DiffOptions::compare_ops)
+    bool same_ops;
+    long pixel_diff_count;
+    bool same;
+    // offset of the second page's image found by DiffOptions::auto_align
+    int offset_x, offset_y;
+    // resolution and band height the pages were compared with, if they had
+    // to differ from the options' ones to fit into DiffOptions::memory_budget;
+    // 0 otherwise
+    long resolution, band_height;
+
+    // connected clusters of differing pixels, only found if requested and if
+    // the pages were rendered whole
+    std::vector<DiffComponent> components;
+    bool has_components;
+
+    // statistics of the differences, only collected if requested and if the
+    // pages were rendered
+    DiffStats stats;
+    bool has_stats;
+    // time spent in phases of comparing and writing out the page
+    PhaseTimes times;
+
+    // gutter thumbnail and page label (in UTF-8), only filled if requested
+    Thumbnail thumbnail;
+    std::string label;
+};
+
+// Receives progress and results of doc_compare().
+class CompareObserver
+{
+public:
+    virtual ~CompareObserver() {}
+
+    // Should thumbnails and labels of pages be created?
+    virtual bool WantsThumbnails() const { return false; }
+
+    // Called before given page, out of pages_total, is compared.
+    virtual void OnPageStart(int /* page */, int /* pages_total */) {}
+
+    // Should the rendered pages be kept in the result passed to
+    // OnPageDone()?
+    virtual bool WantsImages() const { return false; }
+
+    // Should connected clusters of differences be found for the result
+    // passed to OnPageDone()?
+    virtual bool WantsComponents() const { return false; }
+
+    // Called when given page is compared. The result's images are destroyed
+    // afterwards, the observer must add a reference to those it keeps.
+    virtual void OnPageDone(int /* page */, const PageResult& /* result */) {}
+};
+
+// Loads content of the file, which is memory-mapped, or of the standard input
+// if filename is "-". The result must be freed with g_bytes_unref().
+GBytes *load_document_bytes(const char *filename, GError **err);
+
+// Opens PDF document with given content, which is referenced by the document,
+// so that the same content (e.g. the baseline file in batch runs) can be
+// shared by several documents. The name is used in reports.
+PopplerDocument *open_document_bytes(GBytes *bytes, const char *name,
+                                     GError **err);
+
+// Opens PDF file given by its (possibly relative) filename, or the standard
+// input if it is "-" (see load_document_bytes()).
+PopplerDocument *open_document_file(const char *filename, GError **err);
+
+// Opens another instance of a document previously opened with
+// open_document_bytes(), sharing its content. Poppler documents can't be
+// shared between threads, so every worker thread needs its own copy.
+PopplerDocument *open_document_copy(PopplerDocument *doc, GError **err);
+
+// Sets hash of the document's content, which identifies its pages in the
+// raster cache. Pages of documents without it are never cached.
+void set_document_hash(PopplerDocument *doc, const std::string& hash);
+
+// Enables caching of the document's rendered pages in options' raster cache,
+// if the cache is used.
+void cache_document_pages(const DiffOptions& options, PopplerDocument *doc);
+
+// Returns given page of the document or NULL if the document doesn't have
+// that many pages or the index is negative.
+PopplerPage *get_document_page(PopplerDocument *doc, int index);
+
+// Returns the pages of the documents to compare with each other, in order.
+// Pages are paired by their numbers, unless options' align_pages is set; then
+// signatures of small renders of the pages are compared to find inserted and
+// deleted pages, which are paired with -1.
+std::vector<PagePair> get_page_pairs(const DiffOptions& options,
+                                     PopplerDocument *doc1,
+                                     PopplerDocument *doc2);
+
+// Gets size of the rendered page at given resolution, in pixels.
+void get_page_size_px(PopplerPage *page, long resolution, int *w_px, int *h_px);
+
+// Renders the page at options' resolution.
+cairo_surface_t *render_page(const DiffOptions& options, PopplerPage *page);
+
+// Renders the rectangle of the page at given resolution, with the top left
+// corner at pixel (x, y). Parts of the rectangle outside of the page are
+// white.
+cairo_surface_t *render_page_rect(const DiffOptions& options,
+                                  PopplerPage *page, double resolution,
+                                  int x, int y, int width, int height);
+
+// Creates image of differences between s1 and s2, or returns NULL if they are
+// the same within the options' tolerance. If the offset is specified, then s2
+// is displaced by it. If thumbnail and thumbnail_width are specified, then a
+// thumbnail with highlighted differences is created too. If
+// pixel_diff_count_out is not NULL, the number of differing pixels is stored
+// into it. If stats is not NULL, statistics of the overlapping part of the
+// images are added to it. If times is not NULL, time spent comparing the
+// images and creating the thumbnail is added to it. If regions is not NULL,
+// rectangles covering the differences are stored into it. If mask is not
+// NULL, the differing pixels of the diff image are stored into it; pixels
+// outside of s2, if the images don't fully overlap, differ too. If components
+// is not NULL, connected clusters of differing pixels are stored into it.
+//
+// If options' min_region_size is set, pixels of smaller clusters aren't
+// counted and the images are the same if there are no other differences.
+// They aren't marked in the thumbnail, regions, mask or statistics' bounding
+// box either, but they are still shown in the diff image and included in
+// the statistics' histogram and largest difference.
+cairo_surface_t *diff_images(const DiffOptions& options,
+                             cairo_surface_t *s1, cairo_surface_t *s2,
+                             int offset_x = 0, int offset_y = 0,
+                             Thumbnail *thumbnail = NULL, int thumbnail_width = -1,
+                             long *pixel_diff_count_out = NULL,
+                             DiffStats *stats = NULL,
+                             PhaseTimes *times = NULL,
+                             std::vector<DiffRegion> *regions = NULL,
+                             DiffMask *mask = NULL,
+                             std::vector<DiffComponent> *components = NULL);
+
+// Compares s1 and s2 like diff_images() does, but without creating the image
+// of differences, and returns true if they differ. The pixels of the image
+// are only composed if a thumbnail is wanted, one row at a time.
+bool compare_images(const DiffOptions& options,
+                    cairo_surface_t *s1, cairo_surface_t *s2,
+                    int offset_x = 0, int offset_y = 0,
+                    Thumbnail *thumbnail = NULL, int thumbnail_width = -1,
+                    long *pixel_diff_count_out = NULL,
+                    DiffStats *stats = NULL,
+                    PhaseTimes *times = NULL,
+                    std::vector<DiffRegion> *regions = NULL,
+                    DiffMask *mask = NULL,
+                    std::vector<DiffComponent> *components = NULL);
+
+// Creates image of differences between s1 and s2 displaced by the offset, as
+// diff_images() would, from the mask found by compare_images(). This is
+// meant for when the image is only needed for some of the compared images.
+cairo_surface_t *compose_diff_image(const DiffOptions& options,
+                                    cairo_surface_t *s1, cairo_surface_t *s2,
+                                    int offset_x, int offset_y,
+                                    const DiffMask& mask);
+
+// Creates image of differences between s1 and s2, which are images of the
+// same part of two pages. Unlike diff_images(), the image is always created,
+// even if there are no differences, so that images of adjacent parts of the
+// page fit together. 'x' is the part's left edge in the page: differing
+// rows are only marked by options' mark_differences at the page's left edge.
+cairo_surface_t *diff_image_region(const DiffOptions& options,
+                                   cairo_surface_t *s1, cairo_surface_t *s2,
+                                   int x);
+
+// Compares two documents, writing diff PDF into file named 'pdf_output' if
+// not NULL. The pages are paired as by get_page_pairs() and pages passed to
+// the observer, as well as in 'differences', are numbered by the pairs. If
+// 'differences' is not NULL, puts a map of which pages differ into it. If
+// 'observer' is provided, it is notified about every compared page. If
+// 'report_output' is not NULL, a JSON report with details of every page's
+// differences is written into file of that name. If 'png_dir' or 'mask_dir'
+// is not NULL, the diff image or 1-bit mask of the differences of every
+// differing page is written into that directory as page-NNNN.png, numbered as
+// the pages in the report.
+//
+// Returns true if the documents are the same.
+bool doc_compare(const DiffOptions& options,
+                 PopplerDocument *doc1, PopplerDocument *doc2,
+                 const char *pdf_output,
+                 std::vector<bool> *differences,
+                 CompareObserver *observer = NULL,
+                 const char *report_output = NULL,
+                 const char *png_dir = NULL,
+                 const char *mask_dir = NULL);
+
+// Compares pages of two documents in worker threads while the caller goes on
+// with other things, notifying the observer from those threads. Pages are
+// compared in order, except that one page can be moved to the front of the
+// queue, e.g. because the user wants to see it.
+class BackgroundCompare
+{
+public:
+    BackgroundCompare(const DiffOptions& options,
+                      PopplerDocument *doc1, PopplerDocument *doc2,
+                      CompareObserver *observer);
+
+    // Cancels pages that aren't being compared yet and waits for the rest.
+    ~BackgroundCompare();
+
+    // Starts the worker threads. Returns false if none could be started.
+    bool Start();
+
+    // Compares given page next, if it isn't compared already. The page given
+    // in the previous call, if not started yet, goes back to its place in
+    // the queue.
+    void Prioritize(int page);
+
+    int GetPagesTotal() const { return m_pages_total; }
+
+private:
+    struct Worker;
+
+    // Picks the page that a worker should compare next. Returns false if
+    // there are none left.
+    bool TakePage(int *page);
+
+    void WorkerDone();
+
+private:
+    const DiffOptions m_options;
+    PopplerDocument *m_doc1, *m_doc2;
+    CompareObserver *m_observer;
+    int m_flags;
+    int m_pages_total;
+
+    std::vector<Worker*> m_workers;
+
+    // everything below is protected by m_lock
+    GMutex m_lock;
+    GCond m_cond;
+    std::vector<bool> m_taken;
+    int m_next_page;
+    int m_priority_page;
+    bool m_cancelled;
+    int m_running;
+};
+
+// Stops threads used for comparing pages in parallel; should be called before
+// the program exits.
+void shutdown_worker_pool();
+
+#endif // _diffpdf_h_
@@ -25,29 +25,243 @@
 
 #define EXTRA_ROOM_FOR_SCROLLBAR  20
 
+// use A4 proportions for pages that aren't compared yet
+#define PLACEHOLDER_HEIGHT  (Gutter::WIDTH * 297 / 210)
+
+// ----------------------------------------------------------------------------
+// PageCache
+// ----------------------------------------------------------------------------
+
+template<typename T>
+const T *PageCache<T>::Get(int page)
+{
+    typename std::map<int, typename Entries::iterator>::iterator i =
+        m_index.find(page);
+    if ( i == m_index.end() )
+        return NULL;
+
+    // move the value to the front
+    m_entries.splice(m_entries.begin(), m_entries, i->second);
+
+    return &i->second->value;
+}
+
+template<typename T>
+void PageCache<T>::Put(int page, const T& value, size_t size)
+{
+    Remove(page);
+
+    Entry e;
+    e.page = page;
+    e.value = value;
+    e.size = size;
+    m_entries.push_front(e);
+    m_index[page] = m_entries.begin();
+    m_size += size;
+
+    // always keep at least the new value
+    while ( m_size > m_max_size && m_entries.size() > 1 )
+    {
+        m_size -= m_entries.back().size;
+        m_index.erase(m_entries.back().page);
+        m_entries.pop_back();
+    }
+}
+
+template<typename T>
+void PageCache<T>::Remove(int page)
+{
+    typename std::map<int, typename Entries::iterator>::iterator i =
+        m_index.find(page);
+    if ( i == m_index.end() )
+        return;
+
+    m_size -= i->second->size;
+    m_entries.erase(i->second);
+    m_index.erase(i);
+}
+
+template<typename T>
+void PageCache<T>::Clear()
+{
+    m_entries.clear();
+    m_index.clear();
+    m_size = 0;
+}
+
+// ----------------------------------------------------------------------------
+// Gutter
+// ----------------------------------------------------------------------------
+
+Gutter::PageSummary::PageSummary()
+    : height(PLACEHOLDER_HEIGHT), compared(false), same(false)
+{
+}
+
+
 Gutter::Gutter(wxWindow *parent, wxWindowID winid)
-    : wxVListBox(parent, winid)
+    : wxVListBox(parent, winid),
+      m_images(THUMBNAIL_CACHE_SIZE),
+      m_bitmaps(BITMAP_CACHE_SIZE)
 {
     m_fontHeight = -1;
 
     SetFont(wxSystemSettings::GetFont(wxSYS_DEFAULT_GUI_FONT));
 
     SetMinSize(wxSize(WIDTH + 2 * BORDER + EXTRA_ROOM_FOR_SCROLLBAR, -1));
+
+    // shared by all pages that aren't compared yet
+    wxImage placeholder(WIDTH, PLACEHOLDER_HEIGHT);
+    placeholder.SetRGB(wxRect(0, 0, WIDTH, PLACEHOLDER_HEIGHT), 224, 224, 224);
+    m_placeholder = wxBitmap(placeholder);
+}
+
+
+void Gutter::SetPageCount(int count)
+{
+    m_labels.clear();
+    for ( int i = 0; i < count; i++ )
+        m_labels.push_back(wxString::Format("%d", i + 1));
+
+    m_summaries.assign(count, PageSummary());
+    m_images.Clear();
+    m_bitmaps.Clear();
+
+    SetItemCount(count);
+    RefreshAll();
+}
+
+void Gutter::SetPage(int page, const wxString& label,
+                     const wxImage& thumbnail, bool same)
+{
+    m_labels[page] = label;
+
+    // only the page's row needs repainting, unless its height changed
+    if ( UpdateThumbnail(page, thumbnail, same) )
+        RefreshAll();
+    else
+        RefreshRow(page);
 }
 
+void Gutter::SetThumbnail(int page, const wxImage& thumbnail, bool same)
+{
+    if ( UpdateThumbnail(page, thumbnail, same) )
+        RefreshAll();
+    else
+        RefreshRow(page);
+}
 
-void Gutter::AddPage(const wxString& label, const wxImage& thumbnail)
+
+bool Gutter::UpdateThumbnail(int page, const wxImage& thumbnail, bool same)
 {
-    m_labels.push_back(label);
-    m_backgrounds.push_back(wxBitmap(thumbnail));
-    SetItemCount(m_backgrounds.size());
-    Refresh();
+    PageSummary& summary = m_summaries[page];
+    const int old_height = summary.height;
+
+    summary.compared = true;
+    summary.same = same;
+    summary.density.clear();
+    m_bitmaps.Remove(page);
+
+    if ( !thumbnail.IsOk() )
+    {
+        m_images.Remove(page);
+        return false;
+    }
+
+    summary.height = thumbnail.GetHeight();
+
+    // count the pixels marked red in every cell of the thumbnail
+    const int cols = (WIDTH + DENSITY_CELL - 1) / DENSITY_CELL;
+    const int rows = (summary.height + DENSITY_CELL - 1) / DENSITY_CELL;
+    std::vector<int> counts(cols * rows, 0);
+
+    const unsigned char *p = thumbnail.GetData();
+    for ( int y = 0; y < summary.height; y++ )
+    {
+        for ( int x = 0; x < thumbnail.GetWidth(); x++, p += 3 )
+        {
+            if ( p[0] == 255 && p[1] == 0 && p[2] == 0 && x < WIDTH )
+                counts[(y / DENSITY_CELL) * cols + x / DENSITY_CELL]++;
+        }
+    }
+
+    summary.density.resize(counts.size());
+    for ( size_t i = 0; i < counts.size(); i++ )
+    {
+        // even a single differing pixel must remain visible
+        int d = counts[i] * 255 / (DENSITY_CELL * DENSITY_CELL);
+        if ( counts[i] && d == 0 )
+            d = 1;
+        summary.density[i] = (unsigned char)d;
+    }
+
+    m_images.Put(page, thumbnail,
+                 size_t(thumbnail.GetWidth()) * thumbnail.GetHeight() * 3);
+
+    return summary.height != old_height;
 }
 
-void Gutter::SetThumbnail(int page, const wxImage& thumbnail)
+
+wxImage Gutter::MakeSummaryImage(const PageSummary& summary) const
 {
-    m_backgrounds[page] = wxBitmap(thumbnail);
-    Refresh();
+    // same colors as in thumbnails: lightened white page, tinted green if
+    // there are no differences
+    unsigned char bg[3] = { 255, 255, 255 };
+    if ( summary.same )
+    {
+        bg[0] = 170/2 + 255/2;
+        bg[1] = 230/2 + 255/2;
+        bg[2] = 130/2 + 255/2;
+    }
+
+    wxImage image(WIDTH, summary.height, false);
+
+    const int cols = (WIDTH + DENSITY_CELL - 1) / DENSITY_CELL;
+    unsigned char *p = image.GetData();
+    for ( int y = 0; y < summary.height; y++ )
+    {
+        for ( int x = 0; x < WIDTH; x++, p += 3 )
+        {
+            const size_t cell = (y / DENSITY_CELL) * cols + x / DENSITY_CELL;
+            const int d = cell < summary.density.size()
+                          ? summary.density[cell] : 0;
+            if ( d == 0 )
+            {
+                p[0] = bg[0];
+                p[1] = bg[1];
+                p[2] = bg[2];
+            }
+            else
+            {
+                // the more differences, the redder the cell
+                const int keep = 127 - d / 2;
+                p[0] = 255;
+                p[1] = bg[1] * keep / 255;
+                p[2] = bg[2] * keep / 255;
+            }
+        }
+    }
+
+    return image;
+}
+
+
+const wxBitmap& Gutter::GetBitmap(int page) const
+{
+    const PageSummary& summary = m_summaries[page];
+    if ( !summary.compared || summary.height == 0 )
+        return m_placeholder;
+
+    const wxBitmap *bitmap = m_bitmaps.Get(page);
+    if ( bitmap )
+        return *bitmap;
+
+    const wxImage *thumbnail = m_images.Get(page);
+    const wxBitmap created(thumbnail ? *thumbnail : MakeSummaryImage(summary));
+    m_bitmaps.Put(page, created,
+                  size_t(created.GetWidth()) * created.GetHeight() * 4);
+
+    return *m_bitmaps.Get(page);
 }
 
 
@@ -60,8 +274,8 @@ void Gutter::UpdateViewPos(wxScrolledWindow *win)
     int total_x, total_y;
     win->GetVirtualSize(&total_x, &total_y);
 
-    float scale_x = float(m_backgrounds[sel].GetWidth()) / float(total_x);
-    float scale_y = float(m_backgrounds[sel].GetHeight()) / float(total_y);
+    float scale_x = float(WIDTH) / float(total_x);
+    float scale_y = float(m_summaries[sel].height) / float(total_y);
 
     win->GetViewStart(&m_viewPos.x, &m_viewPos.y);
     win->GetClientSize(&m_viewPos.width, &m_viewPos.height);
@@ -71,7 +285,8 @@ void Gutter::UpdateViewPos(wxScrolledWindow *win)
     m_viewPos.width = int(m_viewPos.width * scale_x);
     m_viewPos.height = int(m_viewPos.height * scale_y);
 
-    Refresh();
+    // only the selected page shows the position
+    RefreshRow(sel);
 }
 
 
@@ -80,7 +295,7 @@ wxCoord Gutter::OnMeasureItem(size_t n) const
     if ( m_fontHeight == -1 )
         wxConstCast(this, Gutter)->m_fontHeight = GetCharHeight();
 
-    return m_backgrounds[n].GetHeight() + 3 * BORDER + m_fontHeight;
+    return m_summaries[n].height + 3 * BORDER + m_fontHeight;
 }
 
 
@@ -90,7 +305,7 @@ void Gutter::OnDrawItem(wxDC& dc, const wxRect& rect, size_t n) const
     const int yoffset = BORDER;
 
 
-    dc.DrawBitmap(m_backgrounds[n], rect.x + xoffset, rect.y + yoffset);
+    dc.DrawBitmap(GetBitmap(n), rect.x + xoffset, rect.y + yoffset);
 
     const wxString label = m_labels[n];
     int tw;
@@ -100,7 +315,7 @@ void Gutter::OnDrawItem(wxDC& dc, const wxRect& rect, size_t n) const
        (
            label,
            rect.x + xoffset + (WIDTH - tw) / 2,
-           rect.y + yoffset + m_backgrounds[n].GetHeight() + BORDER
+           rect.y + yoffset + m_summaries[n].height + BORDER
        );
 
     if ( GetSelection() == n )
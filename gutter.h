@@ -20,6 +20,8 @@
 #ifndef _gutter_h_
 #define _gutter_h_
 
+#include <list>
+#include <map>
 #include <vector>
 
 #include <wx/image.h>
@@ -28,7 +30,45 @@
 
 class WXDLLIMPEXP_FWD_CORE wxScrolledWindow;
 
+// Least recently used cache of per-page values (thumbnails), with limited
+// total size.
+template<typename T>
+class PageCache
+{
+public:
+    PageCache(size_t max_size) : m_size(0), m_max_size(max_size) {}
+
+    // Returns the page's value or NULL if it isn't cached.
+    const T *Get(int page);
+
+    // Adds the page's value of given size, removing least recently used
+    // values if needed.
+    void Put(int page, const T& value, size_t size);
+
+    void Remove(int page);
+    void Clear();
+
+private:
+    struct Entry
+    {
+        int page;
+        T value;
+        size_t size;
+    };
+    typedef std::list<Entry> Entries;
+
+    // most recently used values first
+    Entries m_entries;
+    std::map<int, typename Entries::iterator> m_index;
+    size_t m_size, m_max_size;
+};
+
 // widget showing places of differences as well as scroll window's position
+//
+// Only a compact summary of differences is kept for every page. Thumbnails
+// are kept in a cache of limited size and bitmaps are only created for the
+// pages being shown, so that documents with thousands of pages can be
+// viewed.
 class Gutter : public wxVListBox
 {
 public:
@@ -38,13 +78,26 @@ public:
     // standard border
     static const int BORDER = 5;
 
+    // size of the squares of the thumbnail summarized by one density value
+    static const int DENSITY_CELL = 10;
+
+    // maximum total size of kept thumbnails and of their bitmaps, in bytes
+    static const size_t THUMBNAIL_CACHE_SIZE = 16 * 1024 * 1024;
+    static const size_t BITMAP_CACHE_SIZE = 4 * 1024 * 1024;
+
     Gutter(wxWindow *parent, wxWindowID winid);
 
-    // Add a new page to the gutter, with thumbnail's background to be shown
-    void AddPage(const wxString& label, const wxImage& thumbnail);
+    // Sets the number of pages in the gutter. They are shown as blank
+    // placeholders until SetPage() is called for them.
+    void SetPageCount(int count);
+
+    // Set the label of a page and its thumbnail; 'same' indicates that
+    // there are no differences on the page.
+    void SetPage(int page, const wxString& label,
+                 const wxImage& thumbnail, bool same);
 
-    // Set the bitmap with thumbnail's background to be shown
-    void SetThumbnail(int page, const wxImage& thumbnail);
+    // Set the thumbnail to be shown
+    void SetThumbnail(int page, const wxImage& thumbnail, bool same);
 
     // Updates shown view position, i.e. the visible subset of scrolled window.
     // The gutter will indicate this area with a blue rectangle.
@@ -55,8 +108,37 @@ protected:
     virtual void OnDrawItem(wxDC& dc, const wxRect& rect, size_t n) const;
 
 private:
+    // What is known about a page, kept for all pages.
+    struct PageSummary
+    {
+        PageSummary();
+
+        // thumbnail's height
+        int height;
+
+        bool compared, same;
+
+        // fraction of differing pixels (0-255) in every DENSITY_CELL square
+        // of the thumbnail, row by row
+        std::vector<unsigned char> density;
+    };
+
+    // Updates the page's summary and cached thumbnail, returns true if the
+    // thumbnail's height changed.
+    bool UpdateThumbnail(int page, const wxImage& thumbnail, bool same);
+
+    // Creates the image shown for the page when its thumbnail is no longer
+    // cached, from its summary.
+    wxImage MakeSummaryImage(const PageSummary& summary) const;
+
+    // Returns the bitmap shown for the page, creating it if needed.
+    const wxBitmap& GetBitmap(int page) const;
+
     std::vector<wxString> m_labels;
-    std::vector<wxBitmap> m_backgrounds;
+    std::vector<PageSummary> m_summaries;
+    wxBitmap m_placeholder;
+    mutable PageCache<wxImage> m_images;
+    mutable PageCache<wxBitmap> m_bitmaps;
     wxRect m_viewPos;
     int m_fontHeight;
 };
@@ -0,0 +1,101 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "imagewriter.h"
+
+#include <stdio.h>
+
+ImageWriter::ImageWriter(int threads)
+    : m_pending(0),
+      m_failed(false)
+{
+    g_mutex_init(&m_lock);
+    g_cond_init(&m_cond);
+
+    if ( threads < 1 )
+        threads = 1;
+
+    // every image waiting to be written may be a whole page
+    m_max_pending = 2 * threads;
+
+    m_pool = g_thread_pool_new(ThreadFunc, this, threads, FALSE, NULL);
+}
+
+
+ImageWriter::~ImageWriter()
+{
+    // waits for the queued jobs
+    g_thread_pool_free(m_pool, FALSE, TRUE);
+
+    g_cond_clear(&m_cond);
+    g_mutex_clear(&m_lock);
+}
+
+
+void ImageWriter::Write(cairo_surface_t *surface, const std::string& filename)
+{
+    g_mutex_lock(&m_lock);
+    while ( m_pending >= m_max_pending )
+        g_cond_wait(&m_cond, &m_lock);
+    m_pending++;
+    g_mutex_unlock(&m_lock);
+
+    Job *job = new Job;
+    job->surface = cairo_surface_reference(surface);
+    job->filename = filename;
+
+    g_thread_pool_push(m_pool, job, NULL);
+}
+
+
+bool ImageWriter::Finish()
+{
+    g_mutex_lock(&m_lock);
+    while ( m_pending > 0 )
+        g_cond_wait(&m_cond, &m_lock);
+    const bool ok = !m_failed;
+    g_mutex_unlock(&m_lock);
+
+    return ok;
+}
+
+
+void ImageWriter::ThreadFunc(gpointer data, gpointer user_data)
+{
+    Job *job = (Job*)data;
+    ImageWriter *self = (ImageWriter*)user_data;
+
+    const cairo_status_t status =
+        cairo_surface_write_to_png(job->surface, job->filename.c_str());
+    if ( status != CAIRO_STATUS_SUCCESS )
+    {
+        fprintf(stderr, "Error writing %s: %s\n",
+                job->filename.c_str(), cairo_status_to_string(status));
+    }
+
+    cairo_surface_destroy(job->surface);
+    delete job;
+
+    g_mutex_lock(&self->m_lock);
+    if ( status != CAIRO_STATUS_SUCCESS )
+        self->m_failed = true;
+    self->m_pending--;
+    g_cond_broadcast(&self->m_cond);
+    g_mutex_unlock(&self->m_lock);
+}
@@ -0,0 +1,67 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _imagewriter_h_
+#define _imagewriter_h_
+
+#include <string>
+
+#include <glib.h>
+#include <cairo/cairo.h>
+
+// Writes images into PNG files in its own threads, so that encoding them
+// overlaps with comparing the next pages.
+class ImageWriter
+{
+public:
+    // Creates writer with given number of threads.
+    ImageWriter(int threads);
+
+    // Waits until all images are written.
+    ~ImageWriter();
+
+    // Queues the image to be written into the file; a reference to it is
+    // kept until then. Blocks if too many images are already waiting, so
+    // that they don't use too much memory.
+    void Write(cairo_surface_t *surface, const std::string& filename);
+
+    // Waits until all queued images are written. Returns false if writing
+    // any of them failed; errors are reported to stderr.
+    bool Finish();
+
+private:
+    struct Job
+    {
+        cairo_surface_t *surface;
+        std::string filename;
+    };
+
+    static void ThreadFunc(gpointer data, gpointer user_data);
+
+    GThreadPool *m_pool;
+    int m_max_pending;
+
+    // protected by m_lock
+    GMutex m_lock;
+    GCond m_cond;
+    int m_pending;
+    bool m_failed;
+};
+
+#endif // _imagewriter_h_
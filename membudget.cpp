@@ -0,0 +1,210 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "membudget.h"
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+MemoryBudget::MemoryBudget(gint64 limit, bool lower_resolution)
+    : m_limit(limit),
+      m_lower_resolution(lower_resolution),
+      m_used(0),
+      m_waits(0)
+{
+    g_mutex_init(&m_lock);
+    g_cond_init(&m_cond);
+}
+
+
+MemoryBudget::~MemoryBudget()
+{
+    g_cond_clear(&m_cond);
+    g_mutex_clear(&m_lock);
+}
+
+
+void MemoryBudget::Reserve(gint64 size)
+{
+    g_mutex_lock(&m_lock);
+
+    if ( m_used > 0 && m_used + size > m_limit )
+    {
+        m_waits++;
+        while ( m_used > 0 && m_used + size > m_limit )
+            g_cond_wait(&m_cond, &m_lock);
+    }
+
+    m_used += size;
+
+    g_mutex_unlock(&m_lock);
+}
+
+
+void MemoryBudget::Release(gint64 size)
+{
+    g_mutex_lock(&m_lock);
+
+    m_used -= size;
+    g_cond_broadcast(&m_cond);
+
+    g_mutex_unlock(&m_lock);
+}
+
+
+// Reads the first line of a cgroup control file; returns false if it doesn't
+// exist, e.g. because the cgroup version differs or this isn't Linux.
+static bool read_cgroup_file(const char *path, std::string& value)
+{
+    gchar *contents;
+    if ( !g_file_get_contents(path, &contents, NULL, NULL) )
+        return false;
+
+    value = contents;
+    g_free(contents);
+
+    const size_t eol = value.find('\n');
+    if ( eol != std::string::npos )
+        value.erase(eol);
+
+    return true;
+}
+
+
+// Finds the directories of the cgroup of this process and all of its
+// ancestors, innermost first, for the given cgroup v1 controller or for the
+// unified cgroup v2 hierarchy, whichever is used: a limit set on any of them
+// applies. The root is always included, as the cgroup's path may be unknown
+// in the mounted hierarchy, e.g. in a container with its own cgroup
+// namespace.
+static std::vector<std::string> get_cgroup_dirs(const char *controller)
+{
+    std::string base("/sys/fs/cgroup");
+    std::string path;
+
+    gchar *contents;
+    if ( g_file_get_contents("/proc/self/cgroup", &contents, NULL, NULL) )
+    {
+        // lines are "$ID:$CONTROLLERS:$PATH", with "0::$PATH" for v2
+        gchar **lines = g_strsplit(contents, "\n", -1);
+        for ( gchar **line = lines; *line; line++ )
+        {
+            gchar **fields = g_strsplit(*line, ":", 3);
+            if ( g_strv_length(fields) == 3 )
+            {
+                if ( strcmp(fields[0], "0") == 0 && !*fields[1] )
+                {
+                    // v1 controllers take precedence if they are used too
+                    if ( path.empty() )
+                        path = fields[2];
+                }
+                else
+                {
+                    gchar **names = g_strsplit(fields[1], ",", -1);
+                    for ( gchar **name = names; *name; name++ )
+                    {
+                        if ( strcmp(*name, controller) == 0 )
+                        {
+                            base = std::string("/sys/fs/cgroup/") + controller;
+                            path = fields[2];
+                        }
+                    }
+                    g_strfreev(names);
+                }
+            }
+            g_strfreev(fields);
+        }
+        g_strfreev(lines);
+        g_free(contents);
+    }
+
+    std::vector<std::string> dirs;
+    while ( !path.empty() && path != "/" )
+    {
+        dirs.push_back(base + path);
+        path.erase(path.rfind('/'));
+    }
+    dirs.push_back(base);
+
+    return dirs;
+}
+
+
+gint64 get_container_memory_limit()
+{
+    const std::vector<std::string> dirs = get_cgroup_dirs("memory");
+    gint64 result = 0;
+
+    for ( size_t i = 0; i < dirs.size(); i++ )
+    {
+        // cgroup v2 uses "max" for no limit, v1 a huge number
+        std::string value;
+        if ( read_cgroup_file((dirs[i] + "/memory.max").c_str(), value) ||
+             read_cgroup_file((dirs[i] + "/memory.limit_in_bytes").c_str(), value) )
+        {
+            const gint64 limit = g_ascii_strtoll(value.c_str(), NULL, 10);
+            if ( limit > 0 && limit < (G_GINT64_CONSTANT(1) << 60) &&
+                 (result == 0 || limit < result) )
+                result = limit;
+        }
+    }
+
+    return result;
+}
+
+
+int get_container_cpu_limit()
+{
+    const std::vector<std::string> dirs = get_cgroup_dirs("cpu");
+    int result = 0;
+
+    for ( size_t i = 0; i < dirs.size(); i++ )
+    {
+        std::string value;
+        gint64 quota = -1, period = 0;
+
+        // cgroup v2 has "$QUOTA $PERIOD" with "max" for no limit, v1
+        // separate files with -1 for no limit
+        if ( read_cgroup_file((dirs[i] + "/cpu.max").c_str(), value) )
+        {
+            if ( value.compare(0, 3, "max") != 0 )
+            {
+                gchar *end;
+                quota = g_ascii_strtoll(value.c_str(), &end, 10);
+                period = g_ascii_strtoll(end, NULL, 10);
+            }
+        }
+        else if ( read_cgroup_file((dirs[i] + "/cpu.cfs_quota_us").c_str(), value) )
+        {
+            quota = g_ascii_strtoll(value.c_str(), NULL, 10);
+            if ( read_cgroup_file((dirs[i] + "/cpu.cfs_period_us").c_str(), value) )
+                period = g_ascii_strtoll(value.c_str(), NULL, 10);
+        }
+
+        if ( quota <= 0 || period <= 0 )
+            continue;
+
+        const int limit = (int)((quota + period - 1) / period);
+        if ( result == 0 || limit < result )
+            result = limit;
+    }
+
+    return result;
+}
@@ -0,0 +1,74 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _membudget_h_
+#define _membudget_h_
+
+#include <glib.h>
+
+// Limit of memory used by images of pages being compared at the same time.
+// Workers reserve the memory their page needs before rendering it and wait
+// while the other workers' pages don't leave enough of it, so that fewer
+// pages are compared in parallel when they are large.
+//
+// Methods may be called from several threads at once.
+class MemoryBudget
+{
+public:
+    // Creates budget with given limit in bytes. If lower_resolution is
+    // true, pages that don't fit into it otherwise may be compared at lower
+    // resolution; this makes the comparison less precise, so it must be
+    // asked for explicitly.
+    MemoryBudget(gint64 limit, bool lower_resolution);
+    ~MemoryBudget();
+
+    gint64 GetLimit() const { return m_limit; }
+    bool CanLowerResolution() const { return m_lower_resolution; }
+
+    // Waits until 'size' bytes are available and reserves them. Reservations
+    // larger than the limit are granted when nothing else is reserved, so
+    // that they can't wait forever.
+    void Reserve(gint64 size);
+
+    // Returns memory previously reserved with Reserve().
+    void Release(gint64 size);
+
+    // Returns number of reservations that had to wait.
+    int GetWaits() const { return m_waits; }
+
+private:
+    const gint64 m_limit;
+    const bool m_lower_resolution;
+
+    // everything below is protected by m_lock
+    GMutex m_lock;
+    GCond m_cond;
+    gint64 m_used;
+    int m_waits;
+};
+
+// Returns memory limit of the cgroup (container) the process runs in, in
+// bytes, or 0 if there is none or it can't be determined.
+gint64 get_container_memory_limit();
+
+// Returns number of CPUs the cgroup (container) the process runs in may use,
+// rounded up, or 0 if it isn't limited or it can't be determined.
+int get_container_cpu_limit();
+
+#endif // _membudget_h_
@@ -0,0 +1,295 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pagestore.h"
+
+#include <string.h>
+
+
+namespace
+{
+
+// Run-length encodes pixels of a 32bpp image surface into 'out'. Runs don't
+// cross rows.
+void pack_surface(cairo_surface_t *surface, std::vector<guint32>& out)
+{
+    cairo_surface_flush(surface);
+
+    const int w = cairo_image_surface_get_width(surface);
+    const int h = cairo_image_surface_get_height(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+    const unsigned char *data = cairo_image_surface_get_data(surface);
+
+    out.clear();
+
+    for ( int y = 0; y < h; y++ )
+    {
+        const guint32 *row = (const guint32*)(data + y * stride);
+
+        int x = 0;
+        while ( x < w )
+        {
+            const guint32 value = row[x];
+            int run = 1;
+            while ( x + run < w && row[x + run] == value )
+                run++;
+
+            out.push_back(run);
+            out.push_back(value);
+            x += run;
+        }
+    }
+}
+
+
+cairo_surface_t *unpack_surface(const std::vector<guint32>& packed,
+                                cairo_format_t format, int w, int h)
+{
+    cairo_surface_t *surface = cairo_image_surface_create(format, w, h);
+    if ( cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS )
+    {
+        cairo_surface_destroy(surface);
+        return NULL;
+    }
+
+    const int stride = cairo_image_surface_get_stride(surface);
+    unsigned char *data = cairo_image_surface_get_data(surface);
+
+    size_t i = 0;
+    for ( int y = 0; y < h; y++ )
+    {
+        guint32 *row = (guint32*)(data + y * stride);
+
+        int x = 0;
+        while ( x < w )
+        {
+            const guint32 run = packed[i++];
+            const guint32 value = packed[i++];
+            for ( guint32 n = 0; n < run; n++ )
+                row[x++] = value;
+        }
+    }
+
+    cairo_surface_mark_dirty(surface);
+    return surface;
+}
+
+} // anonymous namespace
+
+
+guint64 PageStore::Entry::GetSize() const
+{
+    if ( surface )
+        return guint64(cairo_image_surface_get_stride(surface)) * height;
+    else
+        return packed.size() * sizeof(guint32);
+}
+
+
+PageStore::PageStore(guint64 max_size)
+    : m_max_size(max_size),
+      m_size(0),
+      m_use_counter(0)
+{
+}
+
+
+PageStore::~PageStore()
+{
+    for ( Entries::iterator i = m_entries.begin(); i != m_entries.end(); ++i )
+    {
+        if ( i->second.surface )
+            cairo_surface_destroy(i->second.surface);
+    }
+}
+
+
+void PageStore::Put(int page, PageImage which, cairo_surface_t *surface)
+{
+    Remove(page, which);
+
+    Entry& e = m_entries[Key(page, which)];
+    e.last_use = ++m_use_counter;
+
+    if ( surface )
+    {
+        e.surface = cairo_surface_reference(surface);
+        e.width = cairo_image_surface_get_width(surface);
+        e.height = cairo_image_surface_get_height(surface);
+        e.format = cairo_image_surface_get_format(surface);
+        m_size += e.GetSize();
+    }
+
+    Drop(page);
+}
+
+
+bool PageStore::Get(int page, PageImage which, cairo_surface_t **surface)
+{
+    Entries::iterator i = m_entries.find(Key(page, which));
+    if ( i == m_entries.end() )
+        return false;
+
+    Entry& e = i->second;
+    e.last_use = ++m_use_counter;
+
+    if ( !e.surface && !e.packed.empty() )
+    {
+        cairo_surface_t *unpacked =
+            unpack_surface(e.packed, e.format, e.width, e.height);
+        if ( !unpacked )
+        {
+            Erase(i);
+            return false;
+        }
+
+        m_size -= e.GetSize();
+        e.surface = unpacked;
+        std::vector<guint32>().swap(e.packed);
+        m_size += e.GetSize();
+
+        Drop(page);
+    }
+
+    *surface = e.surface ? cairo_surface_reference(e.surface) : NULL;
+    return true;
+}
+
+
+void PageStore::Remove(int page, PageImage which)
+{
+    Entries::iterator i = m_entries.find(Key(page, which));
+    if ( i != m_entries.end() )
+        Erase(i);
+}
+
+
+void PageStore::RemoveAll(PageImage which)
+{
+    Entries::iterator i = m_entries.begin();
+    while ( i != m_entries.end() )
+    {
+        Entries::iterator next = i;
+        ++next;
+        if ( i->first.second == which )
+            Erase(i);
+        i = next;
+    }
+}
+
+
+void PageStore::Erase(Entries::iterator i)
+{
+    m_size -= i->second.GetSize();
+    if ( i->second.surface )
+        cairo_surface_destroy(i->second.surface);
+    m_entries.erase(i);
+}
+
+
+void PageStore::FindOldest(int keep_page,
+                           Entries::iterator& oldest_unpacked,
+                           Entries::iterator& oldest_packed)
+{
+    oldest_unpacked = m_entries.end();
+    oldest_packed = m_entries.end();
+
+    for ( Entries::iterator i = m_entries.begin(); i != m_entries.end(); ++i )
+    {
+        const Entry& e = i->second;
+        if ( i->first.first == keep_page )
+            continue;
+
+        if ( e.surface )
+        {
+            if ( oldest_unpacked == m_entries.end() ||
+                 e.last_use < oldest_unpacked->second.last_use )
+                oldest_unpacked = i;
+        }
+        else if ( !e.packed.empty() )
+        {
+            if ( oldest_packed == m_entries.end() ||
+                 e.last_use < oldest_packed->second.last_use )
+                oldest_packed = i;
+        }
+    }
+}
+
+
+void PageStore::Drop(int keep_page)
+{
+    while ( m_size > 2 * m_max_size )
+    {
+        Entries::iterator oldest_unpacked, oldest_packed;
+        FindOldest(keep_page, oldest_unpacked, oldest_packed);
+
+        // compressed images take less memory, but they are used less
+        // recently too
+        if ( oldest_packed != m_entries.end() )
+            Erase(oldest_packed);
+        else if ( oldest_unpacked != m_entries.end() )
+            Erase(oldest_unpacked);
+        else
+            break;
+    }
+}
+
+
+bool PageStore::Trim(int keep_page)
+{
+    if ( m_size <= m_max_size )
+        return false;
+
+    // prefer images that can still be compressed
+    Entries::iterator oldest_unpacked, oldest_packed;
+    FindOldest(keep_page, oldest_unpacked, oldest_packed);
+
+    if ( oldest_unpacked != m_entries.end() )
+    {
+        Entry& e = oldest_unpacked->second;
+        const guint64 size = e.GetSize();
+
+        std::vector<guint32> packed;
+        pack_surface(e.surface, packed);
+
+        if ( packed.size() * sizeof(guint32) >= size )
+        {
+            // the image doesn't compress, it's cheaper to recreate it
+            Erase(oldest_unpacked);
+        }
+        else
+        {
+            cairo_surface_destroy(e.surface);
+            e.surface = NULL;
+            e.packed.swap(packed);
+            m_size = m_size - size + e.GetSize();
+        }
+    }
+    else if ( oldest_packed != m_entries.end() )
+    {
+        Erase(oldest_packed);
+    }
+    else
+    {
+        // only images of keep_page are left
+        return false;
+    }
+
+    return m_size > m_max_size;
+}
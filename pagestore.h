@@ -0,0 +1,120 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _pagestore_h_
+#define _pagestore_h_
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <glib.h>
+#include <cairo/cairo.h>
+
+// Images kept for every page by PageStore
+enum PageImage
+{
+    PAGE_IMAGE_LEFT,
+    PAGE_IMAGE_RIGHT,
+    PAGE_IMAGE_DIFF
+};
+
+// In-memory store of rendered pages and their differences, so that the viewer
+// doesn't need to render them again when the user moves between pages or
+// changes what is shown.
+//
+// The total size of the images is kept under a limit by Trim(). When it is
+// exceeded, least recently used images are compressed first (rendered pages
+// are mostly runs of the same color, so this typically makes them many times
+// smaller) and dropped only if that isn't enough. Compressing takes a while,
+// so it's up to the caller to call Trim() when there's time for it, e.g. when
+// the application is idle; if the images take twice the limit in the
+// meantime, they are dropped right away. Dropped images must be recreated by
+// the caller.
+//
+// The store is not thread-safe.
+class PageStore
+{
+public:
+    PageStore(guint64 max_size);
+    ~PageStore();
+
+    // Stores the image of the page, adding a reference to it. NULL may be
+    // stored too, meaning that the page doesn't have that image (e.g. it is
+    // missing in one of the documents or doesn't have any differences).
+    void Put(int page, PageImage which, cairo_surface_t *surface);
+
+    // Retrieves the image of the page. Returns false if it isn't stored,
+    // otherwise puts a new reference to it (or NULL, see Put()) into
+    // 'surface'.
+    bool Get(int page, PageImage which, cairo_surface_t **surface);
+
+    // Removes the image of the page or given image of all pages.
+    void Remove(int page, PageImage which);
+    void RemoveAll(PageImage which);
+
+    // Compresses or drops one image if the size limit is exceeded. Images of
+    // 'keep_page' are left alone. Returns true if the limit is still
+    // exceeded, i.e. if this should be called again.
+    bool Trim(int keep_page);
+
+    guint64 GetSize() const { return m_size; }
+
+private:
+    struct Entry
+    {
+        Entry() : surface(NULL), width(0), height(0), last_use(0) {}
+
+        guint64 GetSize() const;
+
+        // the image, NULL if it is compressed into 'packed' or if the page
+        // doesn't have the image
+        cairo_surface_t *surface;
+        // run-length encoded pixels of the image, as pairs of run length
+        // and pixel value
+        std::vector<guint32> packed;
+        int width, height;
+        cairo_format_t format;
+        guint64 last_use;
+    };
+
+    typedef std::pair<int, int> Key;
+    typedef std::map<Key, Entry> Entries;
+
+    void Erase(Entries::iterator i);
+
+    // Finds the least recently used uncompressed and compressed images,
+    // except for those of 'keep_page'; m_entries.end() is stored if there
+    // are none.
+    void FindOldest(int keep_page,
+                    Entries::iterator& oldest_unpacked,
+                    Entries::iterator& oldest_packed);
+
+    // Drops images until they take at most twice the size limit, without
+    // compressing them. Images of 'keep_page' are left alone.
+    void Drop(int keep_page);
+
+private:
+    guint64 m_max_size;
+    guint64 m_size;
+    guint64 m_use_counter;
+    Entries m_entries;
+};
+
+#endif // _pagestore_h_
@@ -0,0 +1,192 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pixelconv.h"
+
+// See diffkernel.cpp for how the vectorized kernels are built and chosen.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define HAVE_X86_KERNELS
+    #include <immintrin.h>
+#endif
+
+
+void convert_row(const unsigned char *src, unsigned char *dst, int width,
+                 int dst_bytes_per_pixel, int red, int green, int blue)
+{
+    for ( int x = 0; x < width; x++, src += 4, dst += dst_bytes_per_pixel )
+    {
+        dst[red] = src[2];
+        dst[green] = src[1];
+        dst[blue] = src[0];
+    }
+}
+
+
+static void convert_row_to_rgb_scalar(const unsigned char *src,
+                                      unsigned char *dst, int width)
+{
+    convert_row(src, dst, width, 3, 0, 1, 2);
+}
+
+
+static void convert_row_to_bgr_scalar(const unsigned char *src,
+                                      unsigned char *dst, int width)
+{
+    convert_row(src, dst, width, 3, 2, 1, 0);
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+// Shuffles of 4 pixels from BGRx to 12 bytes of RGB or BGR; the last 4 bytes
+// are zeroed.
+#define SHUFFLE_TO_RGB 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+#define SHUFFLE_TO_BGR 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+
+// Every iteration stores 16 bytes, of which only 12 are part of the output,
+// so the last few pixels are left to the scalar code to not write past the
+// end of the row.
+
+__attribute__((target("ssse3")))
+static int convert_row_ssse3(const unsigned char *src, unsigned char *dst,
+                             int width, __m128i shuffle)
+{
+    int x = 0;
+    for ( ; x + 6 <= width; x += 4 )
+    {
+        const __m128i in = _mm_loadu_si128((const __m128i*)(src + 4 * x));
+        _mm_storeu_si128((__m128i*)(dst + 3 * x), _mm_shuffle_epi8(in, shuffle));
+    }
+    return x;
+}
+
+__attribute__((target("ssse3")))
+static void convert_row_to_rgb_ssse3(const unsigned char *src,
+                                     unsigned char *dst, int width)
+{
+    const __m128i shuffle = _mm_setr_epi8(SHUFFLE_TO_RGB);
+    const int done = convert_row_ssse3(src, dst, width, shuffle);
+    convert_row_to_rgb_scalar(src + 4 * done, dst + 3 * done, width - done);
+}
+
+__attribute__((target("ssse3")))
+static void convert_row_to_bgr_ssse3(const unsigned char *src,
+                                     unsigned char *dst, int width)
+{
+    const __m128i shuffle = _mm_setr_epi8(SHUFFLE_TO_BGR);
+    const int done = convert_row_ssse3(src, dst, width, shuffle);
+    convert_row_to_bgr_scalar(src + 4 * done, dst + 3 * done, width - done);
+}
+
+
+// AVX2 shuffles within 128-bit lanes, so the 12 bytes of output of each lane
+// are then moved together with a permutation of 32-bit words.
+__attribute__((target("avx2")))
+static int convert_row_avx2(const unsigned char *src, unsigned char *dst,
+                            int width, __m256i shuffle)
+{
+    const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+    int x = 0;
+    for ( ; x + 11 <= width; x += 8 )
+    {
+        const __m256i in = _mm256_loadu_si256((const __m256i*)(src + 4 * x));
+        const __m256i out =
+            _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(in, shuffle), pack);
+        _mm256_storeu_si256((__m256i*)(dst + 3 * x), out);
+    }
+    return x;
+}
+
+__attribute__((target("avx2")))
+static void convert_row_to_rgb_avx2(const unsigned char *src,
+                                    unsigned char *dst, int width)
+{
+    const __m256i shuffle = _mm256_setr_epi8(SHUFFLE_TO_RGB, SHUFFLE_TO_RGB);
+    const int done = convert_row_avx2(src, dst, width, shuffle);
+    convert_row_to_rgb_scalar(src + 4 * done, dst + 3 * done, width - done);
+}
+
+__attribute__((target("avx2")))
+static void convert_row_to_bgr_avx2(const unsigned char *src,
+                                    unsigned char *dst, int width)
+{
+    const __m256i shuffle = _mm256_setr_epi8(SHUFFLE_TO_BGR, SHUFFLE_TO_BGR);
+    const int done = convert_row_avx2(src, dst, width, shuffle);
+    convert_row_to_bgr_scalar(src + 4 * done, dst + 3 * done, width - done);
+}
+
+#endif // HAVE_X86_KERNELS
+
+
+typedef void (*convert_row_func)(const unsigned char*, unsigned char*, int);
+
+struct ConvertKernel
+{
+    convert_row_func to_rgb;
+    convert_row_func to_bgr;
+    const char *name;
+};
+
+static ConvertKernel select_kernel()
+{
+    ConvertKernel k = { convert_row_to_rgb_scalar, convert_row_to_bgr_scalar, "scalar" };
+
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx2") )
+    {
+        k.to_rgb = convert_row_to_rgb_avx2;
+        k.to_bgr = convert_row_to_bgr_avx2;
+        k.name = "avx2";
+    }
+    else if ( __builtin_cpu_supports("ssse3") )
+    {
+        k.to_rgb = convert_row_to_rgb_ssse3;
+        k.to_bgr = convert_row_to_bgr_ssse3;
+        k.name = "ssse3";
+    }
+#endif
+
+    return k;
+}
+
+static const ConvertKernel& get_kernel()
+{
+    static const ConvertKernel kernel = select_kernel();
+    return kernel;
+}
+
+
+void convert_row_to_rgb(const unsigned char *src, unsigned char *dst, int width)
+{
+    get_kernel().to_rgb(src, dst, width);
+}
+
+
+void convert_row_to_bgr(const unsigned char *src, unsigned char *dst, int width)
+{
+    get_kernel().to_bgr(src, dst, width);
+}
+
+
+const char *convert_row_kernel_name()
+{
+    return get_kernel().name;
+}
@@ -0,0 +1,45 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _pixelconv_h_
+#define _pixelconv_h_
+
+// Conversion of rows of CAIRO_FORMAT_RGB24 pixels (4 bytes per pixel, in B,
+// G, R order followed by an unused byte) to the 3 bytes per pixel formats
+// used by wxImage and native bitmaps.
+//
+// The fastest implementation supported by the CPU is used; all of them give
+// identical results.
+
+// Converts 'width' pixels to R, G, B order (wxImage, native bitmaps on GTK).
+void convert_row_to_rgb(const unsigned char *src, unsigned char *dst, int width);
+
+// Converts 'width' pixels to B, G, R order (native bitmaps on Windows).
+void convert_row_to_bgr(const unsigned char *src, unsigned char *dst, int width);
+
+// Converts 'width' pixels to any format with given number of bytes per pixel
+// and positions of the channels in it. Other bytes of the pixels are left
+// alone.
+void convert_row(const unsigned char *src, unsigned char *dst, int width,
+                 int dst_bytes_per_pixel, int red, int green, int blue);
+
+// Returns the name of the implementation used by the functions above.
+const char *convert_row_kernel_name();
+
+#endif // _pixelconv_h_
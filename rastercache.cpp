@@ -0,0 +1,282 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rastercache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <glib/gstdio.h>
+#include <poppler.h>
+
+// Cache files consist of this header followed by the image rows. The header
+// is padded to 64 bytes, so that the pixel data are suitably aligned in the
+// mapped file.
+struct RasterCacheHeader
+{
+    char magic[8];
+    guint32 width;
+    guint32 height;
+    guint32 stride;
+    guint32 format;
+    char padding[40];
+};
+
+static const char RASTER_CACHE_MAGIC[8] = { 'D', 'P', 'D', 'F', 'R', 'A', 'W', '1' };
+static const char RASTER_CACHE_EXT[] = ".raw";
+
+static cairo_user_data_key_t mapped_file_key;
+
+
+RasterCache::RasterCache(const std::string& dir, guint64 max_size)
+    : m_dir(dir),
+      m_max_size(max_size),
+      m_hits(0),
+      m_misses(0),
+      m_evictions(0),
+      m_size(-1)
+{
+    g_mutex_init(&m_evict_lock);
+    g_mkdir_with_parents(m_dir.c_str(), 0755);
+}
+
+
+RasterCache::~RasterCache()
+{
+    g_mutex_clear(&m_evict_lock);
+}
+
+
+std::string RasterCache::MakeKey(const char *doc_hash, int page, long resolution)
+{
+    gchar *data = g_strdup_printf("%s:%d:%ld:poppler-%s:cairo-%s",
+                                  doc_hash, page, resolution,
+                                  poppler_get_version(),
+                                  cairo_version_string());
+    gchar *key = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                             (const guchar*)data, strlen(data));
+    const std::string s(key);
+    g_free(key);
+    g_free(data);
+    return s;
+}
+
+
+std::string RasterCache::GetPath(const std::string& key) const
+{
+    const std::string name = key + RASTER_CACHE_EXT;
+    gchar *path = g_build_filename(m_dir.c_str(), name.c_str(), NULL);
+    const std::string s(path);
+    g_free(path);
+    return s;
+}
+
+
+cairo_surface_t *RasterCache::Load(const std::string& key, int width, int height)
+{
+    const std::string path = GetPath(key);
+
+    // the mapping is writable, but private, so that the surface can be
+    // modified like any other without affecting the file
+    GMappedFile *file = g_mapped_file_new(path.c_str(), TRUE, NULL);
+    if ( !file )
+    {
+        g_atomic_int_inc(&m_misses);
+        return NULL;
+    }
+
+    const gsize length = g_mapped_file_get_length(file);
+    unsigned char *data = (unsigned char*)g_mapped_file_get_contents(file);
+    const RasterCacheHeader *header = (const RasterCacheHeader*)data;
+
+    const int stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, width);
+
+    if ( length < sizeof(RasterCacheHeader) ||
+         memcmp(header->magic, RASTER_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+         header->format != CAIRO_FORMAT_RGB24 ||
+         int(header->width) != width ||
+         int(header->height) != height ||
+         int(header->stride) != stride ||
+         length < sizeof(RasterCacheHeader) + gsize(stride) * height )
+    {
+        // corrupted or incompatible entry, get rid of it
+        g_mapped_file_unref(file);
+        g_unlink(path.c_str());
+        g_atomic_int_inc(&m_misses);
+        return NULL;
+    }
+
+    cairo_surface_t *surface =
+        cairo_image_surface_create_for_data(data + sizeof(RasterCacheHeader),
+                                            CAIRO_FORMAT_RGB24,
+                                            width, height, stride);
+    cairo_surface_set_user_data(surface, &mapped_file_key, file,
+                                (cairo_destroy_func_t)g_mapped_file_unref);
+
+    // mark the entry as recently used
+    g_utime(path.c_str(), NULL);
+
+    g_atomic_int_inc(&m_hits);
+    return surface;
+}
+
+
+void RasterCache::Store(const std::string& key, cairo_surface_t *surface)
+{
+    cairo_surface_flush(surface);
+
+    RasterCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RASTER_CACHE_MAGIC, sizeof(header.magic));
+    header.width = cairo_image_surface_get_width(surface);
+    header.height = cairo_image_surface_get_height(surface);
+    header.stride = cairo_image_surface_get_stride(surface);
+    header.format = cairo_image_surface_get_format(surface);
+
+    const std::string path = GetPath(key);
+
+    // write into a uniquely named temporary file first, so that other
+    // threads and processes never see incomplete entries; it doesn't have
+    // the entries' extension, so it's never evicted while being written
+    gchar *tmp_path = g_strdup_printf("%s.XXXXXX", path.c_str());
+
+    const int fd = g_mkstemp_full(tmp_path, O_WRONLY, 0644);
+    FILE *f = fd != -1 ? fdopen(fd, "wb") : NULL;
+    if ( !f )
+    {
+        if ( fd != -1 )
+        {
+            g_close(fd, NULL);
+            g_unlink(tmp_path);
+        }
+        g_free(tmp_path);
+        return;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    if ( ok && header.height > 0 )
+    {
+        ok = fwrite(cairo_image_surface_get_data(surface),
+                    gsize(header.stride) * header.height, 1, f) == 1;
+    }
+    ok = (fclose(f) == 0) && ok;
+
+    if ( !ok || g_rename(tmp_path, path.c_str()) != 0 )
+    {
+        g_unlink(tmp_path);
+        ok = false;
+    }
+
+    g_free(tmp_path);
+
+    if ( ok )
+        AddSize(sizeof(header) + guint64(header.stride) * header.height);
+}
+
+
+void RasterCache::AddSize(guint64 size)
+{
+    g_mutex_lock(&m_evict_lock);
+
+    // Scanning the directory is only needed when the limit may have been
+    // exceeded. Entries stored by other processes aren't counted until then,
+    // so the cache may exceed the limit by their size in the meantime.
+    if ( m_size != -1 )
+        m_size += size;
+    if ( m_size == -1 || guint64(m_size) > m_max_size )
+        Evict();
+
+    g_mutex_unlock(&m_evict_lock);
+}
+
+
+namespace
+{
+
+struct CacheEntry
+{
+    std::string path;
+    guint64 size;
+    time_t mtime;
+
+    bool operator<(const CacheEntry& other) const { return mtime < other.mtime; }
+};
+
+} // anonymous namespace
+
+void RasterCache::Evict()
+{
+    std::vector<CacheEntry> entries;
+    guint64 total_size = 0;
+
+    GDir *dir = g_dir_open(m_dir.c_str(), 0, NULL);
+    if ( dir )
+    {
+        const gchar *name;
+        while ( (name = g_dir_read_name(dir)) != NULL )
+        {
+            if ( !g_str_has_suffix(name, RASTER_CACHE_EXT) )
+                continue;
+
+            gchar *path = g_build_filename(m_dir.c_str(), name, NULL);
+            GStatBuf st;
+            if ( g_stat(path, &st) == 0 )
+            {
+                CacheEntry e;
+                e.path = path;
+                e.size = st.st_size;
+                e.mtime = st.st_mtime;
+                entries.push_back(e);
+                total_size += e.size;
+            }
+            g_free(path);
+        }
+        g_dir_close(dir);
+    }
+
+    if ( total_size > m_max_size )
+    {
+        // remove least recently used entries first
+        std::sort(entries.begin(), entries.end());
+
+        for ( std::vector<CacheEntry>::const_iterator i = entries.begin();
+              i != entries.end() && total_size > m_max_size;
+              ++i )
+        {
+            if ( g_unlink(i->path.c_str()) == 0 )
+                g_atomic_int_inc(&m_evictions);
+            total_size -= i->size;
+        }
+    }
+
+    m_size = total_size;
+}
+
+
+std::string get_data_hash(GBytes *data)
+{
+    gchar *hash = g_compute_checksum_for_bytes(G_CHECKSUM_SHA256, data);
+    const std::string s(hash);
+    g_free(hash);
+    return s;
+}
@@ -0,0 +1,86 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _rastercache_h_
+#define _rastercache_h_
+
+#include <string>
+
+#include <glib.h>
+#include <cairo/cairo.h>
+
+// On-disk cache of rendered pages. Every entry is a raw RGB24 image that is
+// memory-mapped and used directly as a cairo surface's data when loaded. The
+// total size of the cache is kept under a limit by removing least recently
+// used entries.
+//
+// The cache may be used from several threads as well as processes at once.
+class RasterCache
+{
+public:
+    RasterCache(const std::string& dir, guint64 max_size);
+    ~RasterCache();
+
+    // Returns the key for given page of a document with given content hash,
+    // rendered at given resolution. The key also covers poppler and cairo
+    // versions, as they may affect the rendering.
+    static std::string MakeKey(const char *doc_hash, int page, long resolution);
+
+    // Returns cached image for the key or NULL if there is none. The
+    // returned surface is a copy-on-write mapping of the cache file.
+    cairo_surface_t *Load(const std::string& key, int width, int height);
+
+    // Stores the image in the cache, evicting old entries if needed.
+    void Store(const std::string& key, cairo_surface_t *surface);
+
+    int GetHits() const { return m_hits; }
+    int GetMisses() const { return m_misses; }
+    int GetEvictions() const { return m_evictions; }
+
+private:
+    std::string GetPath(const std::string& key) const;
+
+    // Adds the size of a new entry to the cache's size and evicts entries if
+    // it exceeds the limit.
+    void AddSize(guint64 size);
+
+    // Scans the cache directory to find its size and removes least recently
+    // used entries if it exceeds the limit. Must be called with m_evict_lock
+    // locked.
+    void Evict();
+
+private:
+    std::string m_dir;
+    guint64 m_max_size;
+
+    volatile gint m_hits, m_misses, m_evictions;
+
+    // serializes evictions done by this process and protects m_size
+    GMutex m_evict_lock;
+
+    // size of the cache as of the last scan of its directory plus the sizes
+    // of entries stored by this process since then; -1 before the first scan
+    gint64 m_size;
+};
+
+// Computes SHA-256 hash of a document's content, to be used with
+// RasterCache::MakeKey().
+std::string get_data_hash(GBytes *data);
+
+#endif // _rastercache_h_
@@ -0,0 +1,210 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+
+#ifndef _WIN32
+    #include <sys/resource.h>
+#endif
+
+static const char *const PHASE_NAMES[PHASE_COUNT] =
+{
+    "load",
+    "render1",
+    "render2",
+    "diff",
+    "align",
+    "thumbnail",
+    "output"
+};
+
+static cairo_user_data_key_t tracked_surface_key;
+
+
+PhaseTimes::PhaseTimes()
+{
+    for ( int i = 0; i < PHASE_COUNT; i++ )
+        times[i] = 0;
+}
+
+
+void PhaseTimes::Add(const PhaseTimes& other)
+{
+    for ( int i = 0; i < PHASE_COUNT; i++ )
+        times[i] += other.times[i];
+}
+
+
+gint64 PhaseTimes::GetTotal() const
+{
+    gint64 total = 0;
+    for ( int i = 0; i < PHASE_COUNT; i++ )
+        total += times[i];
+    return total;
+}
+
+
+// Returns peak resident set size of the process in bytes, or 0 if it's not
+// known.
+static gint64 get_peak_rss()
+{
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if ( getrusage(RUSAGE_SELF, &usage) != 0 )
+        return 0;
+    #ifdef __APPLE__
+        return usage.ru_maxrss;  // in bytes
+    #else
+        return gint64(usage.ru_maxrss) * 1024;  // in kilobytes
+    #endif
+#endif
+}
+
+
+RunStats::RunStats()
+    : m_start(g_get_monotonic_time()),
+      m_surfaces_count(0),
+      m_surfaces_total(0),
+      m_surfaces_current(0),
+      m_surfaces_peak(0)
+{
+    g_mutex_init(&m_lock);
+}
+
+
+RunStats::~RunStats()
+{
+    g_mutex_clear(&m_lock);
+}
+
+
+void RunStats::AddPage(int page, const PhaseTimes& times)
+{
+    PageTimes p;
+    p.page = page;
+    p.times = times;
+
+    g_mutex_lock(&m_lock);
+    m_pages.push_back(p);
+    m_total.Add(times);
+    g_mutex_unlock(&m_lock);
+}
+
+
+void RunStats::AddTime(StatsPhase phase, gint64 time)
+{
+    g_mutex_lock(&m_lock);
+    m_total.times[phase] += time;
+    g_mutex_unlock(&m_lock);
+}
+
+
+struct RunStats::TrackedSurface
+{
+    RunStats *stats;
+    gint64 size;
+};
+
+
+void RunStats::TrackSurface(cairo_surface_t *surface)
+{
+    TrackedSurface *t = new TrackedSurface;
+    t->stats = this;
+    t->size = gint64(cairo_image_surface_get_stride(surface)) *
+              cairo_image_surface_get_height(surface);
+
+    if ( cairo_surface_set_user_data(surface, &tracked_surface_key,
+                                     t, OnSurfaceDestroyed)
+         != CAIRO_STATUS_SUCCESS )
+    {
+        delete t;
+        return;
+    }
+
+    g_mutex_lock(&m_lock);
+    m_surfaces_count++;
+    m_surfaces_total += t->size;
+    m_surfaces_current += t->size;
+    if ( m_surfaces_current > m_surfaces_peak )
+        m_surfaces_peak = m_surfaces_current;
+    g_mutex_unlock(&m_lock);
+}
+
+
+void RunStats::OnSurfaceDestroyed(void *data)
+{
+    TrackedSurface *t = (TrackedSurface*)data;
+    t->stats->SurfaceDestroyed(t->size);
+    delete t;
+}
+
+
+void RunStats::SurfaceDestroyed(gint64 size)
+{
+    g_mutex_lock(&m_lock);
+    m_surfaces_current -= size;
+    g_mutex_unlock(&m_lock);
+}
+
+
+static void print_times_row(FILE *f, const char *label, const PhaseTimes& t)
+{
+    fprintf(f, "%-8s", label);
+    for ( int i = 0; i < PHASE_COUNT; i++ )
+        fprintf(f, " %10.1f", t.times[i] / 1000.0);
+    fprintf(f, " %10.1f\n", t.GetTotal() / 1000.0);
+}
+
+
+void RunStats::PrintSummary(FILE *f)
+{
+    g_mutex_lock(&m_lock);
+
+    fprintf(f, "%-8s", "page");
+    for ( int i = 0; i < PHASE_COUNT; i++ )
+        fprintf(f, " %10s", PHASE_NAMES[i]);
+    fprintf(f, " %10s\n", "total");
+
+    for ( size_t i = 0; i < m_pages.size(); i++ )
+    {
+        char label[16];
+        g_snprintf(label, sizeof(label), "%d", m_pages[i].page);
+        print_times_row(f, label, m_pages[i].times);
+    }
+
+    print_times_row(f, "total", m_total);
+
+    fprintf(f, "times are in ms; wall time %.1f ms\n",
+            (g_get_monotonic_time() - m_start) / 1000.0);
+
+    fprintf(f, "surfaces: %" G_GINT64_FORMAT " allocated, %.1f MB in total, %.1f MB peak\n",
+            m_surfaces_count,
+            m_surfaces_total / (1024.0 * 1024.0),
+            m_surfaces_peak / (1024.0 * 1024.0));
+
+    const gint64 rss = get_peak_rss();
+    if ( rss )
+        fprintf(f, "peak RSS: %.1f MB\n", rss / (1024.0 * 1024.0));
+    else
+        fprintf(f, "peak RSS: unknown\n");
+
+    g_mutex_unlock(&m_lock);
+}
@@ -0,0 +1,102 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _stats_h_
+#define _stats_h_
+
+#include <stdio.h>
+
+#include <vector>
+
+#include <glib.h>
+#include <cairo/cairo.h>
+
+// Phases of the comparison that are timed separately by RunStats.
+enum StatsPhase
+{
+    PHASE_LOAD,         // opening the documents
+    PHASE_RENDER1,      // rendering pages of the first document
+    PHASE_RENDER2,      // rendering pages of the second document
+    PHASE_DIFF,         // comparing rendered pages
+    PHASE_ALIGN,        // finding offsets of shifted pages
+    PHASE_THUMBNAIL,    // creating gutter thumbnails
+    PHASE_OUTPUT,       // writing the diff PDF
+    PHASE_COUNT
+};
+
+// Time spent in every phase, in microseconds.
+struct PhaseTimes
+{
+    PhaseTimes();
+
+    void Add(const PhaseTimes& other);
+    gint64 GetTotal() const;
+
+    gint64 times[PHASE_COUNT];
+};
+
+// Statistics of a run of the program: time spent in every phase of comparing
+// every page, memory used by image surfaces and peak memory use of the
+// process.
+//
+// Methods may be called from several threads at once.
+class RunStats
+{
+public:
+    RunStats();
+    ~RunStats();
+
+    // Adds times of comparing the next page.
+    void AddPage(int page, const PhaseTimes& times);
+
+    // Adds time spent in given phase that isn't related to any page.
+    void AddTime(StatsPhase phase, gint64 time);
+
+    // Accounts for the surface's memory until it is destroyed.
+    void TrackSurface(cairo_surface_t *surface);
+
+    // Prints table with times of all pages and totals.
+    void PrintSummary(FILE *f);
+
+private:
+    void SurfaceDestroyed(gint64 size);
+
+    struct TrackedSurface;
+    static void OnSurfaceDestroyed(void *data);
+
+private:
+    gint64 m_start;
+
+    struct PageTimes
+    {
+        int page;
+        PhaseTimes times;
+    };
+
+    // everything below is protected by m_lock
+    GMutex m_lock;
+    std::vector<PageTimes> m_pages;
+    PhaseTimes m_total;
+    gint64 m_surfaces_count;
+    gint64 m_surfaces_total;
+    gint64 m_surfaces_current;
+    gint64 m_surfaces_peak;
+};
+
+#endif // _stats_h_
@@ -0,0 +1,92 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tilecache.h"
+
+static size_t get_bitmap_size(const wxBitmap& bitmap)
+{
+    return size_t(bitmap.GetWidth()) * bitmap.GetHeight() * 4;
+}
+
+
+bool TileKey::operator<(const TileKey& k) const
+{
+    if ( page != k.page )
+        return page < k.page;
+    if ( which != k.which )
+        return which < k.which;
+    if ( resolution != k.resolution )
+        return resolution < k.resolution;
+    if ( y != k.y )
+        return y < k.y;
+    if ( x != k.x )
+        return x < k.x;
+    if ( offset_x != k.offset_x )
+        return offset_x < k.offset_x;
+    return offset_y < k.offset_y;
+}
+
+
+bool TileKey::operator==(const TileKey& k) const
+{
+    return !(*this < k) && !(k < *this);
+}
+
+
+TileCache::TileCache(size_t max_size)
+    : m_size(0), m_max_size(max_size)
+{
+}
+
+
+const wxBitmap *TileCache::Get(const TileKey& key)
+{
+    std::map<TileKey, Tiles::iterator>::iterator i = m_index.find(key);
+    if ( i == m_index.end() )
+        return NULL;
+
+    // move the tile to the front
+    m_tiles.splice(m_tiles.begin(), m_tiles, i->second);
+
+    return &i->second->second;
+}
+
+
+void TileCache::Put(const TileKey& key, const wxBitmap& bitmap)
+{
+    std::map<TileKey, Tiles::iterator>::iterator i = m_index.find(key);
+    if ( i != m_index.end() )
+    {
+        m_size -= get_bitmap_size(i->second->second);
+        m_tiles.erase(i->second);
+        m_index.erase(i);
+    }
+
+    m_tiles.push_front(std::make_pair(key, bitmap));
+    m_index[key] = m_tiles.begin();
+    m_size += get_bitmap_size(bitmap);
+
+    // always keep at least the new tile
+    while ( m_size > m_max_size && m_tiles.size() > 1 )
+    {
+        m_size -= get_bitmap_size(m_tiles.back().second);
+        m_index.erase(m_tiles.back().first);
+        m_tiles.pop_back();
+    }
+}
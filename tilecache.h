@@ -0,0 +1,72 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _tilecache_h_
+#define _tilecache_h_
+
+#include "tilerender.h"
+
+#include <list>
+#include <map>
+#include <utility>
+
+#include <wx/bitmap.h>
+
+// Identifies a rendered tile: the page and its image, the resolution and the
+// tile's position in pixels at that resolution.
+struct TileKey
+{
+    TileKey(const TileRequest& r)
+        : page(r.page), which(r.which), resolution(r.resolution),
+          x(r.x), y(r.y), offset_x(r.offset_x), offset_y(r.offset_y)
+    {}
+
+    bool operator<(const TileKey& k) const;
+    bool operator==(const TileKey& k) const;
+
+    int page;
+    PageImage which;
+    double resolution;
+    int x, y;
+    int offset_x, offset_y;
+};
+
+// Least recently used cache of tiles shown by BitmapViewer, with limited
+// total size.
+class TileCache
+{
+public:
+    TileCache(size_t max_size);
+
+    // Returns the tile's bitmap or NULL if it isn't cached.
+    const wxBitmap *Get(const TileKey& key);
+
+    // Adds the tile, removing least recently used tiles if needed.
+    void Put(const TileKey& key, const wxBitmap& bitmap);
+
+private:
+    typedef std::list< std::pair<TileKey, wxBitmap> > Tiles;
+
+    // most recently used tiles first
+    Tiles m_tiles;
+    std::map<TileKey, Tiles::iterator> m_index;
+    size_t m_size, m_max_size;
+};
+
+#endif // _tilecache_h_
@@ -0,0 +1,187 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tilerender.h"
+
+#include <stdio.h>
+
+
+struct TileRenderer::Worker
+{
+    TileRenderer *owner;
+    PopplerDocument *doc1, *doc2;
+    GThread *thread;
+};
+
+
+TileRenderer::TileRenderer(const DiffOptions& options,
+                           PopplerDocument *doc1, PopplerDocument *doc2,
+                           TileObserver *observer, int threads)
+    : m_options(options),
+      m_doc1(doc1),
+      m_doc2(doc2),
+      m_observer(observer),
+      m_quit(false)
+{
+    g_mutex_init(&m_lock);
+    g_cond_init(&m_cond);
+
+    for ( int i = 0; i < threads; i++ )
+    {
+        // Poppler documents can't be shared between threads
+        GError *err = NULL;
+        Worker *w = new Worker;
+        w->owner = this;
+        w->doc1 = open_document_copy(doc1, &err);
+        w->doc2 = w->doc1 ? open_document_copy(doc2, &err) : NULL;
+        if ( !w->doc2 )
+        {
+            fprintf(stderr, "Error starting rendering thread: %s\n", err->message);
+            g_error_free(err);
+            if ( w->doc1 )
+                g_object_unref(w->doc1);
+            delete w;
+            break;
+        }
+
+        w->thread = g_thread_new("diff-pdf-tiles", WorkerFunc, w);
+        m_workers.push_back(w);
+    }
+}
+
+
+TileRenderer::~TileRenderer()
+{
+    g_mutex_lock(&m_lock);
+    m_quit = true;
+    m_queue.clear();
+    g_cond_broadcast(&m_cond);
+    g_mutex_unlock(&m_lock);
+
+    for ( size_t i = 0; i < m_workers.size(); i++ )
+    {
+        Worker *w = m_workers[i];
+        g_thread_join(w->thread);
+        g_object_unref(w->doc1);
+        g_object_unref(w->doc2);
+        delete w;
+    }
+
+    g_cond_clear(&m_cond);
+    g_mutex_clear(&m_lock);
+}
+
+
+void TileRenderer::Request(const TileRequest& request)
+{
+    if ( m_workers.empty() )
+    {
+        m_observer->OnTileReady(request, Render(m_doc1, m_doc2, request));
+        return;
+    }
+
+    g_mutex_lock(&m_lock);
+    m_queue.push_back(request);
+    g_cond_signal(&m_cond);
+    g_mutex_unlock(&m_lock);
+}
+
+
+void TileRenderer::CancelQueued()
+{
+    g_mutex_lock(&m_lock);
+    m_queue.clear();
+    g_mutex_unlock(&m_lock);
+}
+
+
+gpointer TileRenderer::WorkerFunc(gpointer data)
+{
+    Worker *w = (Worker*)data;
+    TileRenderer *self = w->owner;
+
+    for ( ;; )
+    {
+        g_mutex_lock(&self->m_lock);
+
+        while ( !self->m_quit && self->m_queue.empty() )
+            g_cond_wait(&self->m_cond, &self->m_lock);
+
+        if ( self->m_quit )
+        {
+            g_mutex_unlock(&self->m_lock);
+            break;
+        }
+
+        // the most recently requested tiles are most likely to be visible
+        const TileRequest request = self->m_queue.back();
+        self->m_queue.pop_back();
+
+        g_mutex_unlock(&self->m_lock);
+
+        self->m_observer->OnTileReady(request,
+                                      self->Render(w->doc1, w->doc2, request));
+    }
+
+    return NULL;
+}
+
+
+cairo_surface_t *TileRenderer::Render(PopplerDocument *doc1,
+                                      PopplerDocument *doc2,
+                                      const TileRequest& r)
+{
+    PopplerPage *page1 = get_document_page(doc1, r.page);
+    PopplerPage *page2 = get_document_page(doc2, r.page);
+
+    cairo_surface_t *tile;
+
+    if ( r.which == PAGE_IMAGE_DIFF && page1 && page2 )
+    {
+        cairo_surface_t *tile1 =
+            render_page_rect(m_options, page1, r.resolution,
+                             r.x, r.y, r.width, r.height);
+        cairo_surface_t *tile2 =
+            render_page_rect(m_options, page2, r.resolution,
+                             r.x - r.offset_x, r.y - r.offset_y,
+                             r.width, r.height);
+
+        tile = diff_image_region(m_options, tile1, tile2, r.x);
+
+        cairo_surface_destroy(tile1);
+        cairo_surface_destroy(tile2);
+    }
+    else
+    {
+        // show the other document's page if this one doesn't have it
+        PopplerPage *page = (r.which == PAGE_IMAGE_RIGHT) ? page2 : page1;
+        if ( !page )
+            page = page1 ? page1 : page2;
+
+        tile = render_page_rect(m_options, page, r.resolution,
+                                r.x, r.y, r.width, r.height);
+    }
+
+    if ( page1 )
+        g_object_unref(page1);
+    if ( page2 )
+        g_object_unref(page2);
+
+    return tile;
+}
@@ -0,0 +1,102 @@
+/*
+ * This file is part of diff-pdf.
+ *
+ * Copyright (C) 2009 TT-Solutions.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _tilerender_h_
+#define _tilerender_h_
+
+#include "diffpdf.h"
+#include "pagestore.h"
+
+#include <deque>
+#include <vector>
+
+// Describes a tile, i.e. a rectangular part of a page's image.
+struct TileRequest
+{
+    TileRequest()
+        : page(0), which(PAGE_IMAGE_LEFT), resolution(0),
+          x(0), y(0), width(0), height(0),
+          offset_x(0), offset_y(0)
+    {}
+
+    int page;
+    PageImage which;
+    // resolution to render the page at, in DPI
+    double resolution;
+    // the tile's rectangle, in pixels of the page rendered at 'resolution'
+    int x, y, width, height;
+    // offset of the right page in the diff image, in the same pixels
+    int offset_x, offset_y;
+};
+
+// Receives tiles rendered by TileRenderer.
+class TileObserver
+{
+public:
+    virtual ~TileObserver() {}
+
+    // Called from a worker thread when the tile is rendered. The observer
+    // takes ownership of the surface.
+    virtual void OnTileReady(const TileRequest& request, cairo_surface_t *tile) = 0;
+};
+
+// Renders tiles of pages of two documents in worker threads, directly from
+// the documents at any resolution. The last requested tiles are rendered
+// first.
+class TileRenderer
+{
+public:
+    TileRenderer(const DiffOptions& options,
+                 PopplerDocument *doc1, PopplerDocument *doc2,
+                 TileObserver *observer, int threads);
+
+    // Discards queued tiles and waits for those being rendered.
+    ~TileRenderer();
+
+    // Adds the tile to the queue. If no worker threads could be started, the
+    // tile is rendered immediately and the observer is called from this
+    // thread.
+    void Request(const TileRequest& request);
+
+    // Discards all queued tiles, e.g. because they are no longer visible.
+    void CancelQueued();
+
+private:
+    struct Worker;
+
+    cairo_surface_t *Render(PopplerDocument *doc1, PopplerDocument *doc2,
+                            const TileRequest& request);
+
+    static gpointer WorkerFunc(gpointer data);
+
+private:
+    const DiffOptions m_options;
+    PopplerDocument *m_doc1, *m_doc2;
+    TileObserver *m_observer;
+
+    std::vector<Worker*> m_workers;
+
+    // everything below is protected by m_lock
+    GMutex m_lock;
+    GCond m_cond;
+    std::deque<TileRequest> m_queue;
+    bool m_quit;
+};
+
+#endif // _tilerender_h_